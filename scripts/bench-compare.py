@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+
+# compare two reports from "make bench" (src/bench/bench.json) and exit
+# nonzero if any benchmark's median got slower by more than the threshold
+
+import json
+import sys
+
+
+def load(filename):
+    with open(filename) as f:
+        report = json.load(f)
+    return {(r['name'], r['resolution']): r for r in report['results']}
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        print('Usage: %s BASELINE.json CANDIDATE.json [THRESHOLD_PERCENT]' % sys.argv[0], file=sys.stderr)
+        sys.exit(2)
+
+    baseline = load(sys.argv[1])
+    candidate = load(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) == 4 else 10.0
+
+    regressions = 0
+    print('%-24s %-8s %12s %12s %8s' % ('# benchmark', 'size', 'base p50', 'new p50', 'change'))
+    for key in sorted(baseline.keys() & candidate.keys()):
+        before = baseline[key]['p50_ns']
+        after = candidate[key]['p50_ns']
+        change = 100.0 * (after - before) / before
+        flag = ''
+        if change > threshold:
+            flag = '  REGRESSION'
+            regressions += 1
+        print('%-24s %-8s %12d %12d %+7.1f%%%s' % (key[0], key[1], before, after, change, flag))
+
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == '__main__':
+    main()
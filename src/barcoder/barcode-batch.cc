@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+
+#include "barcode.hh"
+#include "frame_source.hh"
+#include "stats.hh"
+#include "thread_pool.hh"
+
+using namespace std;
+
+unsigned int paranoid_atoi( const string & in )
+{
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [options] MANIFEST...\n"
+       << "       " << argv0 << " [options] --size WxH FILE-OR-GLOB...\n\n"
+       << "\t--size WxH          dimensions of every file named on the command line\n"
+       << "\t--format FORMAT     bgra (default), i420 or nv12, with --size\n"
+       << "\t--threads N         worker threads (default: one per CPU)\n"
+       << "\t--range FRAMES      frames per unit of work (default 256)\n"
+       << "\t--output-dir DIR    where to write the per-file logs (default .)\n"
+       << "\t--checkpoint FILE   record finished work in FILE and skip it when rerun\n"
+       << "\t--io BACKEND        mmap (default) or uring (see barcode-read)\n"
+       << "\t--queue-depth N     with --io uring, frames in flight per thread (default 16)\n"
+       << "\t--direct            with --io uring, bypass the page cache (O_DIRECT)\n\n"
+       << "\tA manifest has one capture per line: FILE WIDTH HEIGHT [FORMAT].\n"
+       << "\tEach FILE gets DIR/BASENAME.log in the format of barcode-read's stderr.\n\n";
+}
+
+bool is_uring_backend( const string & in )
+{
+  if ( in == "mmap" ) { return false; }
+  if ( in == "uring" ) { return true; }
+
+  throw runtime_error( "invalid I/O backend: " + in );
+}
+
+/* one capture file and what has been read from it so far */
+struct Job
+{
+  string filename;
+  PixelFormat format;
+  unsigned int width, height;
+  uint64_t file_size {};
+  uint64_t frame_count {};
+  string log_filename {};
+
+  vector<pair<uint64_t, uint64_t>> barcodes {};
+  vector<bool> range_done {};
+  atomic<size_t> ranges_left { 0 };
+
+  Job( const string & s_filename, const PixelFormat s_format,
+       const unsigned int s_width, const unsigned int s_height )
+    : filename( s_filename ), format( s_format ), width( s_width ), height( s_height )
+  {}
+};
+
+/* append-only record of finished ranges and their barcodes
+
+   range FILE_SIZE START COUNT UL LR UL LR ...<tab>FILENAME
+   done FILE_SIZE<tab>FILENAME
+
+   A line cut short by an interruption is ignored. */
+class Checkpoint
+{
+private:
+  struct Range
+  {
+    uint64_t start {};
+    vector<pair<uint64_t, uint64_t>> barcodes {};
+  };
+
+  map<pair<string, uint64_t>, vector<Range>> ranges_ {};
+  set<pair<string, uint64_t>> done_ {};
+  unique_ptr<FileDescriptor> fd_ {};
+  mutex lock_ {};
+
+  void append( const string & line )
+  {
+    lock_guard<mutex> guard { lock_ };
+    fd_->write( line );
+  }
+
+public:
+  Checkpoint( const string & filename )
+  {
+    if ( filename.empty() ) {
+      return;
+    }
+
+    ifstream previous { filename };
+    string contents { istreambuf_iterator<char>( previous ), istreambuf_iterator<char>() };
+
+    size_t line_start = 0;
+    for ( size_t newline = contents.find( '\n' ); newline != string::npos;
+          line_start = newline + 1, newline = contents.find( '\n', line_start ) ) {
+      const string line = contents.substr( line_start, newline - line_start );
+      const size_t tab = line.find( '\t' );
+      if ( tab == string::npos ) {
+        continue;
+      }
+
+      const string name = line.substr( tab + 1 );
+      istringstream fields { line.substr( 0, tab ) };
+      string kind;
+      uint64_t file_size;
+      fields >> kind >> file_size;
+
+      if ( kind == "done" and fields ) {
+        done_.emplace( name, file_size );
+      } else if ( kind == "range" ) {
+        Range range;
+        uint64_t count;
+        fields >> range.start >> count;
+        pair<uint64_t, uint64_t> barcode;
+        while ( fields >> barcode.first >> barcode.second ) {
+          range.barcodes.push_back( barcode );
+        }
+        if ( range.barcodes.size() == count ) {
+          ranges_[ { name, file_size } ].push_back( move( range ) );
+        }
+      }
+    }
+
+    fd_ = make_unique<FileDescriptor>( SystemCall( filename,
+      open( filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644 ) ) );
+
+    /* end a torn last line so the next record starts on its own */
+    if ( not contents.empty() and contents.back() != '\n' ) {
+      fd_->write( string( "\n" ) );
+    }
+  }
+
+  bool enabled() const { return fd_ != nullptr; }
+
+  bool done( const Job & job ) const { return done_.count( { job.filename, job.file_size } ); }
+
+  /* fill in the ranges finished by an earlier run; returns how many */
+  size_t restore( Job & job, const uint64_t range_length ) const
+  {
+    const auto it = ranges_.find( { job.filename, job.file_size } );
+    if ( it == ranges_.end() ) {
+      return 0;
+    }
+
+    size_t restored = 0;
+    for ( const Range & range : it->second ) {
+      const uint64_t index = range.start / range_length;
+      if ( range.start % range_length
+           or index >= job.range_done.size()
+           or range.barcodes.size() != min( range_length, job.frame_count - range.start )
+           or job.range_done[ index ] ) {
+        continue; /* from a run with a different --range */
+      }
+
+      copy( range.barcodes.begin(), range.barcodes.end(), job.barcodes.begin() + range.start );
+      job.range_done[ index ] = true;
+      restored++;
+    }
+
+    return restored;
+  }
+
+  void record_range( const Job & job, const uint64_t start, const uint64_t count )
+  {
+    if ( not enabled() ) {
+      return;
+    }
+
+    ostringstream line;
+    line << "range " << job.file_size << " " << start << " " << count;
+    for ( uint64_t frame_no = start; frame_no < start + count; frame_no++ ) {
+      line << " " << job.barcodes[ frame_no ].first << " " << job.barcodes[ frame_no ].second;
+    }
+    line << "\t" << job.filename << "\n";
+    append( line.str() );
+  }
+
+  void record_done( const Job & job )
+  {
+    if ( enabled() ) {
+      append( "done " + to_string( job.file_size ) + "\t" + job.filename + "\n" );
+    }
+  }
+};
+
+void parse_size( const string & size, unsigned int & width, unsigned int & height )
+{
+  const size_t x = size.find( 'x' );
+  if ( x == string::npos ) {
+    throw runtime_error( "invalid size (expected WxH): " + size );
+  }
+  width = paranoid_atoi( size.substr( 0, x ) );
+  height = paranoid_atoi( size.substr( x + 1 ) );
+}
+
+void read_manifest( const string & filename, vector<unique_ptr<Job>> & jobs )
+{
+  ifstream manifest { filename };
+  if ( not manifest ) {
+    throw runtime_error( "could not open manifest " + filename );
+  }
+
+  string line;
+  unsigned int line_no = 0;
+  while ( getline( manifest, line ) ) {
+    line_no++;
+    istringstream fields { line };
+    string file, width, height, format = "bgra";
+    if ( not ( fields >> file ) or file[ 0 ] == '#' ) {
+      continue;
+    }
+    if ( not ( fields >> width >> height ) ) {
+      throw runtime_error( filename + ":" + to_string( line_no ) + ": expected FILE WIDTH HEIGHT [FORMAT]" );
+    }
+    fields >> format;
+    jobs.push_back( make_unique<Job>( file, parse_pixel_format( format ),
+                                      paranoid_atoi( width ), paranoid_atoi( height ) ) );
+  }
+}
+
+void expand_pattern( const string & pattern, const PixelFormat format,
+                     const unsigned int width, const unsigned int height,
+                     vector<unique_ptr<Job>> & jobs )
+{
+  glob_t matches;
+  const int ret = glob( pattern.c_str(), GLOB_NOCHECK, nullptr, &matches );
+  if ( ret != 0 ) {
+    throw runtime_error( "glob failed for " + pattern );
+  }
+
+  for ( size_t i = 0; i < matches.gl_pathc; i++ ) {
+    jobs.push_back( make_unique<Job>( matches.gl_pathv[ i ], format, width, height ) );
+  }
+
+  globfree( &matches );
+}
+
+string basename_of( const string & path )
+{
+  const size_t slash = path.rfind( '/' );
+  return slash == string::npos ? path : path.substr( slash + 1 );
+}
+
+/* write the same log barcode-read would, replacing it atomically */
+void write_log( const Job & job )
+{
+  ostringstream log;
+  log << "# Reading barcodes from the file: " << job.filename << ".\n";
+  log << "# Found " << job.frame_count << " frames of size " << job.width << "x" << job.height
+      << " (" << pixel_format_name( job.format ) << ").\n";
+  const time_t now = time( nullptr );
+  log << "# Time stamp: " << asctime( localtime( &now ) );
+  log << "# frame_num" << "," << "upper_left_barcode" << "," << "lower_right_barcode" << "\n";
+
+  for ( uint64_t frame_no = 0; frame_no < job.frame_count; frame_no++ ) {
+    log << frame_no << "," << job.barcodes[ frame_no ].first << "," << job.barcodes[ frame_no ].second << "\n";
+  }
+
+  const string temporary = job.log_filename + ".partial";
+  {
+    FileDescriptor output { SystemCall( temporary,
+      open( temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) };
+    output.write( log.str() );
+  }
+  SystemCall( "rename", rename( temporary.c_str(), job.log_filename.c_str() ) );
+}
+
+static Stats::Probe range_probe { "batch.range" };
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    const StatsReporter stats_reporter;
+
+    unsigned int threads = max( 1u, thread::hardware_concurrency() );
+    uint64_t range_length = 256;
+    string output_dir = ".", checkpoint_filename, size;
+    PixelFormat format = PixelFormat::BGRX;
+    bool use_uring = false;
+    UringOptions uring_options;
+
+    const option command_line_options[] = {
+      { "size",       required_argument, nullptr, 's' },
+      { "format",     required_argument, nullptr, 'f' },
+      { "threads",    required_argument, nullptr, 'j' },
+      { "range",      required_argument, nullptr, 'r' },
+      { "output-dir", required_argument, nullptr, 'o' },
+      { "checkpoint", required_argument, nullptr, 'c' },
+      { "io",         required_argument, nullptr, 'I' },
+      { "queue-depth", required_argument, nullptr, 'Q' },
+      { "direct",     no_argument,       nullptr, 'D' },
+      { nullptr,      0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "s:f:j:r:o:c:I:Q:D", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 's': size = optarg; break;
+      case 'f': format = parse_pixel_format( optarg ); break;
+      case 'j': threads = max( 1u, paranoid_atoi( optarg ) ); break;
+      case 'r': range_length = max( 1u, paranoid_atoi( optarg ) ); break;
+      case 'o': output_dir = optarg; break;
+      case 'c': checkpoint_filename = optarg; break;
+      case 'I': use_uring = is_uring_backend( optarg ); break;
+      case 'Q': uring_options.queue_depth = paranoid_atoi( optarg ); break;
+      case 'D': uring_options.direct = true; break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( optind == argc ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    /* gather the captures */
+    vector<unique_ptr<Job>> jobs;
+    for ( int i = optind; i < argc; i++ ) {
+      if ( size.empty() ) {
+        read_manifest( argv[ i ], jobs );
+      } else {
+        unsigned int width, height;
+        parse_size( size, width, height );
+        expand_pattern( argv[ i ], format, width, height, jobs );
+      }
+    }
+
+    set<string> log_filenames;
+    for ( auto & job : jobs ) {
+      job->log_filename = output_dir + "/" + basename_of( job->filename ) + ".log";
+      if ( not log_filenames.insert( job->log_filename ).second ) {
+        throw runtime_error( "two captures would share the log " + job->log_filename );
+      }
+
+      job->frame_count = open_frame_source( job->filename, job->format, job->width, job->height )->frame_count();
+      job->file_size = FileDescriptor( SystemCall( job->filename, open( job->filename.c_str(), O_RDONLY ) ) ).size();
+    }
+
+    /* start the biggest captures first, so that no long one is left for the end */
+    stable_sort( jobs.begin(), jobs.end(), []( const unique_ptr<Job> & a, const unique_ptr<Job> & b ) {
+        return a->frame_count * frame_length( a->format, a->width, a->height )
+          > b->frame_count * frame_length( b->format, b->width, b->height );
+      } );
+
+    Checkpoint checkpoint { checkpoint_filename };
+    ThreadPool pool { threads };
+
+    const auto start_time = chrono::steady_clock::now();
+    uint64_t total_frames = 0, ranges_resumed = 0, ranges_queued = 0, files_skipped = 0;
+
+    for ( auto & job_ptr : jobs ) {
+      Job & job = *job_ptr;
+      total_frames += job.frame_count;
+
+      if ( checkpoint.done( job ) and access( job.log_filename.c_str(), F_OK ) == 0 ) {
+        files_skipped++;
+        continue;
+      }
+
+      job.barcodes.resize( job.frame_count );
+      job.range_done.resize( ( job.frame_count + range_length - 1 ) / range_length );
+      ranges_resumed += checkpoint.restore( job, range_length );
+      job.ranges_left = count( job.range_done.begin(), job.range_done.end(), false );
+
+      if ( job.ranges_left == 0 ) {
+        write_log( job );
+        checkpoint.record_done( job );
+        continue;
+      }
+
+      for ( size_t range = 0; range < job.range_done.size(); range++ ) {
+        if ( job.range_done[ range ] ) {
+          continue;
+        }
+
+        const uint64_t first = range * range_length;
+        const uint64_t count = min( range_length, job.frame_count - first );
+        ranges_queued++;
+
+        pool.submit( [&job, &checkpoint, use_uring, &uring_options, first, count] {
+            const Stats::ScopedTimer timer { range_probe };
+
+            /* each range maps the file for itself, since frame sources
+               are not shared between threads */
+            unique_ptr<FrameSource> source;
+            if ( use_uring ) {
+              UringOptions options = uring_options;
+              options.queue_depth = min<uint64_t>( options.queue_depth, count );
+              options.regions = Barcode::regions( job.width, job.height );
+              source = open_frame_source( job.filename, job.format, job.width, job.height, options );
+            } else {
+              MMap_Region::Options options;
+              options.access = MMap_Region::Access::Sequential;
+              source = open_frame_source( job.filename, job.format, job.width, job.height, options );
+            }
+
+            for ( uint64_t frame_no = first; frame_no < first + count; frame_no++ ) {
+              job.barcodes[ frame_no ] = Barcode::readBarcodes( source->frame( frame_no ) );
+            }
+
+            checkpoint.record_range( job, first, count );
+
+            if ( --job.ranges_left == 0 ) {
+              write_log( job );
+              checkpoint.record_done( job );
+            }
+          } );
+      }
+    }
+
+    pool.wait();
+
+    const double seconds = chrono::duration<double>( chrono::steady_clock::now() - start_time ).count();
+    cerr << "# Batch of " << jobs.size() << " files (" << total_frames << " frames) on "
+         << pool.size() << " threads in " << seconds << " s.\n";
+    cerr << "# Ranges of " << range_length << " frames: " << ranges_queued << " decoded, "
+         << ranges_resumed << " resumed from the checkpoint, " << pool.steals() << " stolen; "
+         << files_skipped << " files already done.\n";
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
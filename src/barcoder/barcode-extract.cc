@@ -0,0 +1,123 @@
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "frame_source.hh"
+#include "strip_file.hh"
+
+using namespace std;
+
+unsigned int paranoid_atoi( const string & in )
+{
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [--format FORMAT] [--margin PIXELS] [--stripes N] INPUT WIDTH HEIGHT OUTPUT\n\n"
+       << "\t--format FORMAT  bgra (default), i420 or nv12\n"
+       << "\t--margin PIXELS  keep this many pixels around each barcode (default 16)\n"
+       << "\t--stripes N      also keep the N stripes written by barcode-write --stripes\n\n"
+       << "\tCopies just the barcodes of each frame of INPUT (headerless frames or a\n"
+       << "\ttiled video) to OUTPUT, which barcode-read and barcode-batch then read\n"
+       << "\tin place of the capture.\n\n";
+}
+
+/* flush extracted frames to the output about this often */
+static const size_t write_batch_length = 4 << 20;
+
+int main( int argc, char *argv[] )
+{
+  try {
+    /* check arguments */
+    if ( argc <= 0 ) { /* for sticklers */
+      abort();
+    }
+
+    PixelFormat format = PixelFormat::BGRX;
+    unsigned int margin = 16;
+    unsigned int stripes = 0;
+
+    const option command_line_options[] = {
+      { "format",  required_argument, nullptr, 'f' },
+      { "margin",  required_argument, nullptr, 'm' },
+      { "stripes", required_argument, nullptr, 'N' },
+      { nullptr,   0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "f:m:N:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'f': format = parse_pixel_format( optarg ); break;
+      case 'm': margin = paranoid_atoi( optarg ); break;
+      case 'N': stripes = paranoid_atoi( optarg ); break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( argc - optind != 4 ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    const string input_filename = argv[ optind ];
+    const uint16_t width = paranoid_atoi( argv[ optind + 1 ] );
+    const uint16_t height = paranoid_atoi( argv[ optind + 2 ] );
+    const string output_filename = argv[ optind + 3 ];
+
+    MMap_Region::Options map_options;
+    map_options.access = MMap_Region::Access::Sequential;
+    unique_ptr<FrameSource> input = open_frame_source( input_filename, format, width, height, map_options );
+    const StripLayout layout = StripLayout::for_barcodes( format, width, height, margin, stripes );
+
+    cerr << "# Extracting barcodes from the file: " << input_filename << ".\n";
+    cerr << "# Found " << input->frame_count() << " frames of size " << width << "x" << height
+         << " (" << pixel_format_name( format ) << "); keeping " << layout.regions().size()
+         << " regions, " << layout.frame_length() << " bytes of each.\n";
+
+    /* write to a temporary name, so OUTPUT is only ever complete */
+    const string temporary = output_filename + ".partial";
+    {
+      FileDescriptor output { SystemCall( temporary,
+        open( temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) };
+
+      string pending = layout.header();
+      for ( uint64_t frame_no = 0; frame_no < input->frame_count(); frame_no++ ) {
+        layout.extract( input->frame( frame_no ), pending );
+        if ( pending.size() >= write_batch_length ) {
+          output.write( pending );
+          pending.clear();
+        }
+      }
+      output.write( pending );
+    }
+    SystemCall( "rename", rename( temporary.c_str(), output_filename.c_str() ) );
+
+    const uint64_t strip_length = layout.header_length() + input->frame_count() * layout.frame_length();
+    const uint64_t capture_length = input->frame_count() * frame_length( format, width, height );
+    cerr << "# Wrote " << strip_length << " bytes to " << output_filename << ", 1/"
+         << ( strip_length ? capture_length / strip_length : 0 ) << " of the frames' size.\n";
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+#include <cstdlib>
+#include <iostream>
+
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "barcode.hh"
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "fingerprint.hh"
+#include "frame_source.hh"
+
+using namespace std;
+
+unsigned int paranoid_atoi( const string & in )
+{
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [--format FORMAT] INPUT WIDTH HEIGHT INDEX\n\n"
+       << "\t--format FORMAT  bgra (default), i420 or nv12\n\n"
+       << "\tWrites the barcode and a content fingerprint of each frame of INPUT\n"
+       << "\t(headerless frames or a tiled video, as sent) to INDEX, so that\n"
+       << "\tbarcode-read --index can name the source of captured frames whose\n"
+       << "\tbarcodes are unreadable. The index takes 264 bytes a frame.\n\n";
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    /* check arguments */
+    if ( argc <= 0 ) { /* for sticklers */
+      abort();
+    }
+
+    PixelFormat format = PixelFormat::BGRX;
+
+    const option command_line_options[] = {
+      { "format",  required_argument, nullptr, 'f' },
+      { nullptr,   0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "f:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'f': format = parse_pixel_format( optarg ); break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( argc - optind != 4 ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    const string input_filename = argv[ optind ];
+    const uint16_t width = paranoid_atoi( argv[ optind + 1 ] );
+    const uint16_t height = paranoid_atoi( argv[ optind + 2 ] );
+    const string index_filename = argv[ optind + 3 ];
+
+    MMap_Region::Options map_options;
+    map_options.access = MMap_Region::Access::Sequential;
+    unique_ptr<FrameSource> input = open_frame_source( input_filename, format, width, height, map_options );
+    const uint64_t frame_count = input->frame_count();
+    const auto mask = barcode_cells( width, height );
+
+    cerr << "# Indexing the file: " << input_filename << ".\n";
+    cerr << "# Found " << frame_count << " frames of size " << width << "x" << height
+         << " (" << pixel_format_name( format ) << ").\n";
+
+    /* barcodes come first in the file, so gather the fingerprints aside */
+    string barcodes = FingerprintIndex::header( width, height, frame_count );
+    string fingerprints;
+    barcodes.reserve( barcodes.size() + frame_count * sizeof( uint64_t ) );
+    fingerprints.reserve( frame_count * fingerprint_length );
+    uint64_t unreadable = 0;
+
+    for ( uint64_t frame_no = 0; frame_no < frame_count; frame_no++ ) {
+      const FrameView frame = input->frame( frame_no );
+      const pair<uint64_t, uint64_t> codes = Barcode::readBarcodes( frame );
+      if ( codes.first != codes.second ) {
+        unreadable++;
+      }
+      const uint64_t le = htole64( codes.first );
+      barcodes.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+
+      const Fingerprint fingerprint = take_fingerprint( frame, mask );
+      fingerprints.append( reinterpret_cast<const char *>( fingerprint.data() ), fingerprint.size() );
+    }
+
+    /* write to a temporary name, so INDEX is only ever complete */
+    const string temporary = index_filename + ".partial";
+    {
+      FileDescriptor output { SystemCall( temporary,
+        open( temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) };
+      output.write( barcodes );
+      output.write( fingerprints );
+    }
+    SystemCall( "rename", rename( temporary.c_str(), index_filename.c_str() ) );
+
+    cerr << "# Wrote " << barcodes.size() + fingerprints.size() << " bytes to " << index_filename << ".\n";
+    if ( unreadable ) {
+      cerr << "# Warning: the two barcodes of " << unreadable << " frames disagree; "
+           << "those frames are indexed by their upper-left barcode.\n";
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
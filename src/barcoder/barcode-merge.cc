@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <vector>
+
+#include <getopt.h>
+
+#include "exception.hh"
+#include "frame_source.hh"
+
+using namespace std;
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " LOG...\n\n"
+       << "\tStitches the logs of barcode-read or barcode-write run with --shard,\n"
+       << "\t--start-frame or --frame-count back into one log of the whole capture,\n"
+       << "\twith its frames in order, and writes it to stdout. Fails, naming them,\n"
+       << "\tif any frames are missing or appear more than once, or if the logs\n"
+       << "\tare of different captures or columns.\n\n";
+}
+
+/* one shard's log: its range, its CSV header, and a line per frame */
+struct ShardLog
+{
+  string filename {};
+  FrameRange::Resolved range {};
+  string header {};
+  vector<pair<uint64_t, string>> rows {};
+};
+
+ShardLog read_log( const string & filename )
+{
+  ifstream in { filename };
+  if ( not in ) {
+    throw runtime_error( filename + ": cannot open" );
+  }
+
+  ShardLog log;
+  log.filename = filename;
+  optional<FrameRange::Resolved> range;
+
+  string line;
+  for ( unsigned int line_no = 1; getline( in, line ); line_no++ ) {
+    if ( line.empty() ) {
+      continue;
+    }
+
+    if ( line[ 0 ] == '#' ) {
+      if ( auto parsed = FrameRange::Resolved::parse( line ) ) {
+        range = parsed;
+      } else if ( line.rfind( "# frame_num,", 0 ) == 0 ) {
+        log.header = line;
+      }
+      continue;
+    }
+
+    size_t digits = 0;
+    uint64_t frame_no = 0;
+    try {
+      frame_no = stoull( line, &digits );
+    } catch ( const logic_error & ) {}
+    if ( digits == 0 or digits >= line.size() or line[ digits ] != ',' ) {
+      throw runtime_error( filename + ":" + to_string( line_no ) + ": not a frame's line" );
+    }
+    log.rows.emplace_back( frame_no, line );
+  }
+
+  if ( not range ) {
+    throw runtime_error( filename + ": no \"# Range:\" line (is it from an older barcode-read?)" );
+  }
+  if ( log.header.empty() ) {
+    throw runtime_error( filename + ": no CSV header" );
+  }
+  log.range = *range;
+
+  for ( const auto & [ frame_no, row ] : log.rows ) {
+    if ( frame_no < log.range.first or frame_no >= log.range.end ) {
+      throw runtime_error( filename + ": frame " + to_string( frame_no ) + " is outside its range" );
+    }
+  }
+
+  return log;
+}
+
+/* "a-b, c, ..." for the sorted frame numbers */
+string describe_frames( const vector<uint64_t> & frames )
+{
+  string ret;
+  for ( size_t i = 0; i < frames.size(); ) {
+    size_t j = i;
+    while ( j + 1 < frames.size() and frames[ j + 1 ] == frames[ j ] + 1 ) {
+      j++;
+    }
+    ret += ( ret.empty() ? "" : ", " ) + to_string( frames[ i ] )
+      + ( j > i ? "-" + to_string( frames[ j ] ) : string() );
+    i = j + 1;
+  }
+  return ret;
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    /* check arguments */
+    if ( argc <= 0 ) { /* for sticklers */
+      abort();
+    }
+
+    const option command_line_options[] = {
+      { nullptr, 0, nullptr, 0 }
+    };
+
+    if ( getopt_long( argc, argv, "", command_line_options, nullptr ) != -1 or argc - optind < 1 ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    vector<ShardLog> logs;
+    for ( int i = optind; i < argc; i++ ) {
+      logs.push_back( read_log( argv[ i ] ) );
+    }
+
+    const uint64_t total = logs.front().range.total;
+    const string & header = logs.front().header;
+    for ( const ShardLog & log : logs ) {
+      if ( log.range.total != total ) {
+        throw runtime_error( log.filename + ": a capture of " + to_string( log.range.total )
+                             + " frames, not " + to_string( total ) );
+      }
+      if ( log.header != header ) {
+        throw runtime_error( log.filename + ": columns differ from " + logs.front().filename );
+      }
+    }
+
+    /* every frame of the capture, from whichever log has it */
+    vector<const string *> rows( total, nullptr );
+    vector<uint64_t> duplicated, missing;
+    for ( const ShardLog & log : logs ) {
+      for ( const auto & [ frame_no, row ] : log.rows ) {
+        if ( rows[ frame_no ] ) {
+          duplicated.push_back( frame_no );
+        } else {
+          rows[ frame_no ] = &row;
+        }
+      }
+    }
+    for ( uint64_t frame_no = 0; frame_no < total; frame_no++ ) {
+      if ( not rows[ frame_no ] ) {
+        missing.push_back( frame_no );
+      }
+    }
+
+    if ( not missing.empty() or not duplicated.empty() ) {
+      sort( duplicated.begin(), duplicated.end() );
+      duplicated.erase( unique( duplicated.begin(), duplicated.end() ), duplicated.end() );
+      if ( not missing.empty() ) {
+        cerr << argv[ 0 ] << ": " << missing.size() << " frames missing: " << describe_frames( missing ) << "\n";
+      }
+      if ( not duplicated.empty() ) {
+        cerr << argv[ 0 ] << ": " << duplicated.size() << " frames duplicated: "
+             << describe_frames( duplicated ) << "\n";
+      }
+      return EXIT_FAILURE;
+    }
+
+    cout << "# Merged " << logs.size() << " logs of a capture of " << total << " frames.\n";
+    cout << FrameRange::Resolved { 0, total, total, 0, 0 }.describe() << "\n";
+    cout << header << "\n";
+    for ( const string * row : rows ) {
+      cout << *row << "\n";
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
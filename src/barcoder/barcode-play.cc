@@ -0,0 +1,255 @@
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <latch>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <getopt.h>
+#include <time.h>
+
+#include "barcode.hh"
+#include "display_backend.hh"
+#include "exception.hh"
+#include "file.hh"
+#include "stats.hh"
+
+using namespace std;
+
+unsigned int paranoid_atoi( const string & in )
+{
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [--output DISPLAY[@CRTC]]... [--fps FPS] [--stamp [--stripes N]] FILE WIDTH HEIGHT\n\n"
+       << "\t--output DISPLAY[@CRTC]  show the frames in a window on DISPLAY (e.g. :1.1),\n"
+       << "\t                         presenting on the given CRTC if one is named;\n"
+       << "\t                         repeat for more outputs (default: one on $DISPLAY)\n"
+       << "\t--output offscreen[:HZ[:FILE]]\n"
+       << "\t                         present to memory instead, flipping at HZ (default\n"
+       << "\t                         60, 0 for as fast as possible), and append each\n"
+       << "\t                         presented frame to FILE if one is named\n"
+       << "\t--fps FPS                frames per second (default 60)\n"
+       << "\t--stamp                  rewrite each frame's barcodes just before it is\n"
+       << "\t                         shown, with a payload of its frame number and the\n"
+       << "\t                         time (see barcode-read --payload stamped), so that\n"
+       << "\t                         the capture side can tell the latency\n"
+       << "\t--stripes N              with --stamp, rewrite N stripes as well, for files\n"
+       << "\t                         written with barcode-write --stripes N\n\n"
+       << "\tFILE holds headerless BGRA frames, e.g. from barcode-write.\n"
+       << "\tEvery output has its own connection and thread, and all of them\n"
+       << "\tfollow one schedule; an output that falls behind skips frames\n"
+       << "\trather than delaying the others.\n"
+       << "\tNote: this program writes log file to stderr.\n\n";
+}
+
+struct Output
+{
+  string spec {};
+  uint64_t presented { 0 }, dropped { 0 };
+  uint64_t total_lateness_ns { 0 };
+  exception_ptr error {};
+};
+
+static uint64_t monotonic_ns()
+{
+  timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return uint64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until( const uint64_t deadline_ns )
+{
+  const timespec deadline { time_t( deadline_ns / 1000000000 ), long( deadline_ns % 1000000000 ) };
+  while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr ) == EINTR ) {}
+}
+
+static string milliseconds( const uint64_t ns )
+{
+  ostringstream out;
+  out << fixed << setprecision( 3 ) << ns / 1e6;
+  return out.str();
+}
+
+static Stats::Probe present_probe { "play.present" };
+
+int main( int argc, char *argv[] )
+{
+  try {
+    /* check arguments */
+    if ( argc <= 0 ) { /* for sticklers */
+      abort();
+    }
+
+    const StatsReporter stats_reporter;
+
+    vector<Output> outputs;
+    unsigned int fps = 60;
+    bool stamp = false;
+    unsigned int stripes = 0;
+
+    const option command_line_options[] = {
+      { "output",  required_argument, nullptr, 'o' },
+      { "fps",     required_argument, nullptr, 'r' },
+      { "stamp",   no_argument,       nullptr, 's' },
+      { "stripes", required_argument, nullptr, 'N' },
+      { nullptr,   0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "o:r:sN:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'o': outputs.push_back( Output { optarg } ); break;
+      case 'r': fps = paranoid_atoi( optarg ); break;
+      case 's': stamp = true; break;
+      case 'N': stripes = paranoid_atoi( optarg ); break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( argc - optind != 3 or fps == 0 or ( stripes and not stamp ) ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    if ( outputs.empty() ) {
+      outputs.emplace_back();
+    }
+
+    const string filename = argv[ optind ];
+    const uint16_t width = paranoid_atoi( argv[ optind + 1 ] );
+    const uint16_t height = paranoid_atoi( argv[ optind + 2 ] );
+    const size_t frame_length = size_t( width ) * height * sizeof( RGBPixel );
+
+    const File file { filename };
+    const uint64_t frame_count = file.size() / frame_length;
+    if ( file.size() != frame_count * frame_length ) {
+      throw runtime_error( "file size is not multiple of frame size" );
+    }
+
+    if ( stripes ) {
+      Barcode::stripeRegions( width, height, stripes ); /* throws if they don't fit */
+    }
+
+    cerr << "# Playing the file: " << filename << ".\n";
+    cerr << "# Found " << frame_count << " frames of size " << width << "x" << height
+         << ", at " << fps << " fps on " << outputs.size() << " output(s).\n";
+    std::time_t result = std::time(nullptr);
+    cerr << "# Time stamp: " << std::asctime(std::localtime(&result));
+
+    /* times are relative to the shared start, in ms */
+    cerr << "# output,frame_num,scheduled,presented,late\n";
+
+    const uint64_t period_ns = 1000000000 / fps;
+    mutex log_lock;
+    latch ready { ptrdiff_t( outputs.size() ) }, go { 1 };
+    atomic<uint64_t> start_ns { 0 };
+    atomic<bool> aborted { false };
+
+    vector<thread> threads;
+    for ( size_t index = 0; index < outputs.size(); index++ ) {
+      threads.emplace_back( [&, index] {
+          Output & output = outputs[ index ];
+          try {
+            unique_ptr<DisplayBackend> display;
+            try {
+              display = open_display( output.spec, width, height, "barcode-play " + to_string( index ) );
+              display->flush();
+            } catch ( ... ) {
+              aborted = true;
+              ready.count_down();
+              throw;
+            }
+
+            ready.count_down();
+            go.wait();
+            if ( aborted ) {
+              return;
+            }
+
+            for ( uint64_t frame_no = 0; frame_no < frame_count; frame_no++ ) {
+              const uint64_t scheduled = start_ns + frame_no * period_ns;
+
+              /* too late for this frame's slot: skip to the next one */
+              if ( monotonic_ns() >= scheduled + period_ns ) {
+                output.dropped++;
+                continue;
+              }
+
+              XImage image { file( frame_no * frame_length, frame_length ), width, height };
+              sleep_until( scheduled );
+
+              /* the send time is now, not when the file was written */
+              if ( stamp ) {
+                const uint64_t barcode_num = Barcode::encodePayload( { uint32_t( frame_no ), Barcode::payloadClock() } );
+                Barcode::writeBarcodes( image, barcode_num );
+                if ( stripes ) {
+                  Barcode::writeStripes( MutableFrameView::packed( image.data_unsafe(), PixelFormat::BGRX, width, height ),
+                                         barcode_num, stripes );
+                }
+              }
+
+              {
+                const Stats::ScopedTimer timer { present_probe };
+                display->put( image );
+                display->present( 0, 0 );
+              }
+              const uint64_t presented = monotonic_ns();
+
+              output.presented++;
+              output.total_lateness_ns += presented - scheduled;
+
+              lock_guard<mutex> guard { log_lock };
+              cerr << index << "," << frame_no << "," << milliseconds( scheduled - start_ns )
+                   << "," << milliseconds( presented - start_ns )
+                   << "," << milliseconds( presented - scheduled ) << "\n";
+            }
+          } catch ( ... ) {
+            output.error = current_exception();
+          }
+        } );
+    }
+
+    /* start every output on the same clock once all are ready */
+    ready.wait();
+    start_ns = monotonic_ns() + period_ns;
+    go.count_down();
+
+    for ( auto & thread : threads ) {
+      thread.join();
+    }
+
+    for ( size_t index = 0; index < outputs.size(); index++ ) {
+      const Output & output = outputs[ index ];
+      if ( output.error ) {
+        rethrow_exception( output.error );
+      }
+      cerr << "# Output " << index << " (" << ( output.spec.empty() ? "$DISPLAY" : output.spec )
+           << "): " << output.presented << " presented, " << output.dropped << " dropped, mean lateness "
+           << milliseconds( output.presented ? output.total_lateness_ns / output.presented : 0 ) << " ms.\n";
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
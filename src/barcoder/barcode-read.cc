@@ -1,9 +1,22 @@
+#include <chrono>
 #include <cstdlib>
 #include <ctime>
+#include <fstream>
+#include <functional>
 #include <iostream>
 
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "exception.hh"
 #include "file.hh"
 #include "barcode.hh"
+#include "fingerprint.hh"
+#include "frame_ring.hh"
+#include "frame_source.hh"
+#include "inotify.hh"
+#include "stats.hh"
 
 using namespace std;
 
@@ -17,50 +30,567 @@ unsigned int paranoid_atoi( const string & in )
   return ret;
 }
 
-int main( int argc, char *argv[] )
+MMap_Region::Access parse_access( const string & in )
 {
-  /* check arguments */
-  if ( argc <= 0 ) { /* for sticklers */
-    abort();
+  if ( in == "normal" ) { return MMap_Region::Access::Normal; }
+  if ( in == "sequential" ) { return MMap_Region::Access::Sequential; }
+  if ( in == "random" ) { return MMap_Region::Access::Random; }
+  if ( in == "willneed" ) { return MMap_Region::Access::WillNeed; }
+
+  throw runtime_error( "invalid access pattern: " + in );
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [options] FILE WIDTH HEIGHT\n"
+       << "       " << argv0 << " [options] --shm-ring NAME WIDTH HEIGHT\n\n"
+       << "\t--format FORMAT   bgra (default), i420 or nv12\n"
+       << "\t--access PATTERN  normal, sequential (default), random or willneed\n"
+       << "\t--populate        prefault the mapping\n"
+       << "\t--hugepages       ask for transparent hugepages\n"
+       << "\t--window MIB      map only MIB mebibytes at a time, dropping frames already read\n"
+       << "\t--io BACKEND      mmap (default) or uring: read ahead with io_uring, fetching\n"
+       << "\t                  only the rows under the barcodes (not with --follow)\n"
+       << "\t--queue-depth N   with --io uring, frames in flight (default 16)\n"
+       << "\t--direct          with --io uring, bypass the page cache (O_DIRECT)\n"
+       << "\t--stats           report page faults and mapped bytes when done\n"
+       << "\t--payload stamped decode barcodes written with barcode-write --payload stamped,\n"
+       << "\t                  adding the sequence number, send time (ms) and whether\n"
+       << "\t                  both, one (ul/lr) or neither (bad) copy passed its CRC,\n"
+       << "\t                  or if the two disagree (mismatch)\n"
+       << "\t--stripes N       also read the N stripes written by barcode-write --stripes,\n"
+       << "\t                  adding the bands of rows where the frame changes from\n"
+       << "\t                  one update to the next (FIRST-LAST;...), or - if none\n"
+       << "\t--samples N       decide each bit from an NxN grid in the middle of its block\n"
+       << "\t                  (1 to 8), reading the whole block only when the samples\n"
+       << "\t                  are within the margin of mid-grey; 0 (default) always\n"
+       << "\t                  reads the whole block\n"
+       << "\t--margin M        with --samples, the margin (default 64, out of 255)\n"
+       << "\t--start-frame N   start at frame N (counting from 0)\n"
+       << "\t--frame-count N   read only N frames\n"
+       << "\t--shard I/N       read only the Ith of N equal runs of frames (I from 0),\n"
+       << "\t                  for splitting a capture across machines; the logs of\n"
+       << "\t                  all N go back together with barcode-merge\n"
+       << "\t--index FILE      name the source frame of each frame from an index made by\n"
+       << "\t                  barcode-index, by its barcode or, if that is unreadable,\n"
+       << "\t                  by the nearest fingerprint near the last frame named;\n"
+       << "\t                  adds the source frame and how it was found (barcode,\n"
+       << "\t                  fingerprint/DISTANCE or none)\n"
+       << "\t--search-window N with --index, look N frames either side (default 300)\n"
+       << "\t--max-distance D  with --index, accept fingerprints at most D apart\n"
+       << "\t                  (default 4096, out of 65280)\n"
+       << "\t--follow          keep reading frames as they are appended to FILE\n"
+       << "\t--state FILE      with --follow, remember the next frame to read in FILE\n"
+       << "\t                  and start from there when restarted\n"
+       << "\t--idle-timeout S  with --follow, stop after S seconds without a new frame\n"
+       << "\t--shm-ring NAME   read frames from the shared-memory ring NAME (see\n"
+       << "\t                  barcode-write --shm-ring) instead of a file, decoding\n"
+       << "\t                  each where it lies, until the writer closes the ring\n\n"
+       << "\tFILE may be headerless frames, a tiled BGRX video (see raw-to-tiled)\n"
+       << "\tor a strip file (see barcode-extract).\n"
+       << "\tNote: thie program writes log file to stderr.\n\n";
+}
+
+static Stats::Probe frame_probe { "read.frame" };
+static Stats::Probe decode_probe { "read.decode" };
+static Stats::Probe log_probe { "read.log" };
+static Stats::Probe match_probe { "read.match" };
+
+bool is_uring_backend( const string & in )
+{
+  if ( in == "mmap" ) { return false; }
+  if ( in == "uring" ) { return true; }
+
+  throw runtime_error( "invalid I/O backend: " + in );
+}
+
+/* only the stamped scheme (see barcode-write) can be decoded */
+bool is_stamped_payload( const string & in )
+{
+  if ( in == "random" or in == "counter" ) { return false; }
+  if ( in == "stamped" ) { return true; }
+
+  throw runtime_error( "invalid payload scheme: " + in );
+}
+
+void print_csv_header( const bool stamped_payload, const unsigned int stripes, const bool indexed )
+{
+  cerr << "# frame_num" << "," << "upper_left_barcode" << "," << "lower_right_barcode";
+  if ( stamped_payload ) {
+    cerr << "," << "sequence" << "," << "sent_ms" << "," << "payload";
+  }
+  if ( stripes ) {
+    cerr << "," << "tears";
   }
+  if ( indexed ) {
+    cerr << "," << "source_frame" << "," << "match";
+  }
+  cerr << "\n";
+}
 
-  if ( argc != 4 ) {
-    cerr << "Usage: " << argv[ 0 ] << " FILE WIDTH HEIGHT\n\n\tNote: thie program writes log file to stderr.\n\n";
-    return EXIT_FAILURE;
+/* sequence,sent_ms,status for a frame stamped with Barcode::encodePayload */
+string describe_payload( const pair<uint64_t, uint64_t> & barcodes )
+{
+  const auto upper_left = Barcode::decodePayload( barcodes.first );
+  const auto lower_right = Barcode::decodePayload( barcodes.second );
+
+  string status;
+  if ( upper_left and lower_right ) {
+    status = barcodes.first == barcodes.second ? "ok" : "mismatch";
+  } else if ( upper_left or lower_right ) {
+    status = upper_left ? "ul" : "lr";
+  } else {
+    return ",,bad";
   }
 
-  /* open file and check for sane length */
-  File input { argv[ 1 ] };
-  const uint16_t width = paranoid_atoi( argv[ 2 ] );
-  const uint16_t height = paranoid_atoi( argv[ 3 ] );
-  const size_t frame_length = width * height * sizeof( RGBPixel );
+  const Barcode::Payload & payload = upper_left ? *upper_left : *lower_right;
+  const uint64_t ticks_per_ms = 1000000 / Barcode::payload_tick_ns;
+  return to_string( payload.sequence ) + "," + to_string( payload.timestamp / ticks_per_ms )
+    + "." + to_string( payload.timestamp % ticks_per_ms ) + "," + status;
+}
+
+/* names the source frame of each captured frame from a FingerprintIndex:
+   by barcode when the frame's two copies agree (and pass their CRCs, if
+   stamped), otherwise by the nearest fingerprint within search_window
+   frames of the last frame named, or in the whole index until one is */
+class SourceMatcher
+{
+private:
+  const FingerprintIndex index_;
+  const bool stamped_payload_;
+  uint64_t search_window_, max_distance_;
+  uint64_t last_source_;
 
-  const size_t frame_count = input.size() / frame_length;
+public:
+  SourceMatcher( const string & filename, const bool stamped_payload,
+                 const uint64_t search_window, const uint64_t max_distance )
+    : index_( filename ),
+      stamped_payload_( stamped_payload ),
+      search_window_( search_window ),
+      max_distance_( max_distance ),
+      last_source_( index_.frame_count() )
+  {}
 
-  if ( input.size() != frame_count * frame_length ) {
-    throw runtime_error( "file size is not multiple of frame size" );
-  } else {
-    cerr << "# Reading barcodes from the file: " << argv[ 1 ] <<  ".\n";    
-    cerr << "# Found " << frame_count << " frames of size " << width << "x" << height << ".\n";
+  const FingerprintIndex & index() const { return index_; }
+
+  /* source_frame,match */
+  string describe( const FrameView & frame, const pair<uint64_t, uint64_t> & barcodes )
+  {
+    const uint64_t none = index_.frame_count();
+    uint64_t source = none;
+    string match = "none";
+
+    if ( barcodes.first == barcodes.second
+         and ( not stamped_payload_ or Barcode::decodePayload( barcodes.first ) ) ) {
+      source = index_.find_barcode( barcodes.first );
+      if ( source != none ) {
+        match = "barcode";
+      }
+    }
+
+    if ( source == none ) {
+      uint64_t first = 0, end = none;
+      if ( last_source_ != none ) {
+        first = last_source_ > search_window_ ? last_source_ - search_window_ : 0;
+        end = last_source_ + search_window_ + 1;
+      }
+      const FingerprintIndex::Match nearest = index_.nearest( index_.take( frame ), first, end );
+      if ( nearest.frame_no != none and nearest.distance <= max_distance_ ) {
+        source = nearest.frame_no;
+        match = "fingerprint/" + to_string( nearest.distance );
+      }
+    }
+
+    if ( source == none ) {
+      return "," + match;
+    }
+
+    last_source_ = source;
+    return to_string( source ) + "," + match;
+  }
+};
+
+/* FIRST-LAST;... for each band of rows where the stripes change value */
+string describe_tears( const vector<uint32_t> & stripes, const unsigned int height )
+{
+  string tears;
+  for ( const auto & [ first, last ] : Barcode::findTears( stripes, height ) ) {
+    tears += ( tears.empty() ? "" : ";" ) + to_string( first ) + "-" + to_string( last );
+  }
+  return tears.empty() ? "-" : tears;
+}
+
+/* where a followed capture was left: the next frame and the file's identity */
+struct FollowState
+{
+  uint64_t next_frame { 0 };
+  dev_t device { 0 };
+  ino_t inode { 0 };
+};
+
+FollowState load_state( const string & state_filename, const struct stat & capture )
+{
+  FollowState state;
+  ifstream in { state_filename };
+  if ( in >> state.next_frame >> state.device >> state.inode
+       and state.device == capture.st_dev and state.inode == capture.st_ino ) {
+    return state;
+  }
+
+  /* missing, unreadable, or about some other file */
+  return { 0, capture.st_dev, capture.st_ino };
+}
+
+void save_state( const string & state_filename, const FollowState & state )
+{
+  const string temporary = state_filename + ".partial";
+  {
+    FileDescriptor out { SystemCall( temporary,
+      open( temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) };
+    out.write( to_string( state.next_frame ) + " " + to_string( state.device )
+               + " " + to_string( state.inode ) + "\n" );
+  }
+  SystemCall( "rename", rename( temporary.c_str(), state_filename.c_str() ) );
+}
 
-    std::time_t result = std::time(nullptr);
-    cerr << "# Time stamp: " << std::asctime(std::localtime(&result));    
+/* decode the whole frames of a capture that is still being written,
+   waking up on inotify events as it grows, until it has gained no whole
+   frame for idle_timeout seconds (if nonzero) or is deleted or renamed */
+void follow_capture( const string & filename, const PixelFormat format,
+                     const unsigned int width, const unsigned int height,
+                     const MMap_Region::Options & map_options, const size_t window_length,
+                     const string & state_filename, const unsigned int idle_timeout,
+                     const bool stamped_payload, const unsigned int stripes, const bool indexed,
+                     const function<void( uint64_t, const FrameView & )> & report )
+{
+  /* watch before the first look, so that no append goes unnoticed */
+  Inotify inotify;
+  inotify.add_watch( filename, IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF );
+
+  File file { filename, map_options, window_length };
+
+  if ( file.size() >= 8 and TiledVideoReader::is_tiled_video( file( 0, 8 ) ) ) {
+    throw runtime_error( "--follow needs headerless frames, not a tiled video" );
   }
 
-  /* print csv header */
-  cerr << "# frame_num" << "," << "upper_left_barcode" << "," << "lower_right_barcode" << "\n";
-  
-  FileDescriptor stdout { STDOUT_FILENO };
-  
-  /* iterate through frames and read barcode from each one */
-  for ( unsigned int frame_no = 0; frame_no < frame_count; frame_no++ ) {
-    const Chunk this_frame_chunk = input( frame_no * frame_length, frame_length );
-    XImage this_frame { this_frame_chunk, width, height };
-
-    /* read barcode */
-    pair<uint64_t, uint64_t> barcodes = Barcode::readBarcodes( this_frame );
-    cerr << frame_no << "," << barcodes.first << "," << barcodes.second << "\n";
+  struct stat capture;
+  SystemCall( "stat", stat( filename.c_str(), &capture ) );
+  FollowState state = state_filename.empty()
+    ? FollowState { 0, capture.st_dev, capture.st_ino }
+    : load_state( state_filename, capture );
+
+  const size_t frame_length = ::frame_length( format, width, height );
+
+  cerr << "# Following the file: " << filename << ".\n";
+  cerr << "# Frames of size " << width << "x" << height << " (" << pixel_format_name( format )
+       << "), starting at frame " << state.next_frame << ".\n";
+
+  std::time_t result = std::time(nullptr);
+  cerr << "# Time stamp: " << std::asctime(std::localtime(&result));
+  print_csv_header( stamped_payload, stripes, indexed );
+
+  /* only a new whole frame puts the deadline back; appending part of one does not */
+  using namespace std::chrono;
+  auto deadline = steady_clock::now() + seconds( idle_timeout );
+
+  while ( true ) {
+    /* a trailing partial frame waits for the next pass */
+    const uint64_t whole_frames = file.refresh() / frame_length;
+
+    if ( whole_frames > state.next_frame ) {
+      for ( ; state.next_frame < whole_frames; state.next_frame++ ) {
+        const Chunk frame = file( state.next_frame * frame_length, frame_length );
+        report( state.next_frame, FrameView::packed( frame.buffer(), format, width, height ) );
+      }
+
+      if ( not state_filename.empty() ) {
+        save_state( state_filename, state );
+      }
+
+      deadline = steady_clock::now() + seconds( idle_timeout );
+    }
+
+    int timeout_ms = -1;
+    if ( idle_timeout ) {
+      const int64_t remaining_ms = duration_cast<milliseconds>( deadline - steady_clock::now() ).count();
+      if ( remaining_ms <= 0 ) {
+        cerr << "# No new frames for " << idle_timeout << " s, stopping.\n";
+        return;
+      }
+      timeout_ms = remaining_ms;
+    }
+
+    const vector<Inotify::Event> events = inotify.wait( timeout_ms );
+
+    for ( const auto & event : events ) {
+      if ( event.mask & ( IN_DELETE_SELF | IN_MOVE_SELF ) ) {
+        cerr << "# The file was deleted or renamed, stopping.\n";
+        return;
+      }
+    }
+  }
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    /* check arguments */
+    if ( argc <= 0 ) { /* for sticklers */
+      abort();
+    }
+
+    const StatsReporter stats_reporter;
+
+    PixelFormat format = PixelFormat::BGRX;
+    MMap_Region::Options map_options;
+    map_options.access = MMap_Region::Access::Sequential;
+    size_t window_length = 0;
+    bool print_stats = false;
+    bool follow = false;
+    string state_filename;
+    unsigned int idle_timeout = 0;
+    bool stamped_payload = false;
+    unsigned int stripes = 0;
+    Barcode::DecodeOptions decode_options;
+    bool use_uring = false;
+    UringOptions uring_options;
+    FrameRange range;
+    string index_filename;
+    unsigned int search_window = 300;
+    unsigned int max_distance = 4096;
+    string ring_name;
+
+    const option command_line_options[] = {
+      { "format",    required_argument, nullptr, 'f' },
+      { "access",    required_argument, nullptr, 'a' },
+      { "populate",  no_argument,       nullptr, 'p' },
+      { "hugepages", no_argument,       nullptr, 'H' },
+      { "window",    required_argument, nullptr, 'w' },
+      { "stats",     no_argument,       nullptr, 's' },
+      { "follow",    no_argument,       nullptr, 'F' },
+      { "state",     required_argument, nullptr, 'S' },
+      { "idle-timeout", required_argument, nullptr, 'T' },
+      { "payload",   required_argument, nullptr, 'P' },
+      { "stripes",   required_argument, nullptr, 'N' },
+      { "samples",   required_argument, nullptr, 'n' },
+      { "margin",    required_argument, nullptr, 'm' },
+      { "io",        required_argument, nullptr, 'I' },
+      { "queue-depth", required_argument, nullptr, 'Q' },
+      { "direct",    no_argument,       nullptr, 'D' },
+      { "start-frame", required_argument, nullptr, 'j' },
+      { "frame-count", required_argument, nullptr, 'c' },
+      { "shard",     required_argument, nullptr, 'x' },
+      { "index",     required_argument, nullptr, 'i' },
+      { "search-window", required_argument, nullptr, 'W' },
+      { "max-distance", required_argument, nullptr, 'M' },
+      { "shm-ring",  required_argument, nullptr, 'R' },
+      { nullptr,     0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "f:a:pHw:sFS:T:P:N:n:m:I:Q:Dj:c:x:i:W:M:R:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'f': format = parse_pixel_format( optarg ); break;
+      case 'a': map_options.access = parse_access( optarg ); break;
+      case 'p': map_options.populate = true; break;
+      case 'H': map_options.hugepages = true; break;
+      case 'w': window_length = size_t( paranoid_atoi( optarg ) ) << 20; break;
+      case 's': print_stats = true; break;
+      case 'F': follow = true; break;
+      case 'S': state_filename = optarg; break;
+      case 'T': idle_timeout = paranoid_atoi( optarg ); break;
+      case 'P': stamped_payload = is_stamped_payload( optarg ); break;
+      case 'N': stripes = paranoid_atoi( optarg ); break;
+      case 'n': decode_options.samples = paranoid_atoi( optarg ); break;
+      case 'm': decode_options.margin = paranoid_atoi( optarg ); break;
+      case 'I': use_uring = is_uring_backend( optarg ); break;
+      case 'Q': uring_options.queue_depth = paranoid_atoi( optarg ); break;
+      case 'D': uring_options.direct = true; break;
+      case 'j': range.start = paranoid_atoi( optarg ); break;
+      case 'c': range.count = paranoid_atoi( optarg ); break;
+      case 'x': {
+        const FrameRange shard = FrameRange::parse_shard( optarg );
+        range.shard = shard.shard;
+        range.shards = shard.shards;
+        break;
+      }
+      case 'i': index_filename = optarg; break;
+      case 'W': search_window = paranoid_atoi( optarg ); break;
+      case 'M': max_distance = paranoid_atoi( optarg ); break;
+      case 'R': ring_name = optarg; break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    const bool from_ring = not ring_name.empty();
+    if ( argc - optind != ( from_ring ? 2 : 3 ) ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    const bool ranged = range.start or range.count or range.shards;
+    if ( range.shards and ( range.start or range.count ) ) {
+      throw runtime_error( "--shard cannot be combined with --start-frame or --frame-count" );
+    }
+    if ( follow and ranged ) {
+      throw runtime_error( "--follow reads the whole capture, so takes no range or shard" );
+    }
+    if ( follow and use_uring ) {
+      throw runtime_error( "--follow reads through mmap, so takes no --io uring" );
+    }
+    if ( from_ring and ( follow or ranged or use_uring ) ) {
+      throw runtime_error( "--shm-ring takes no --follow, --io uring, range or shard" );
+    }
+
+    const int dimensions = from_ring ? optind : optind + 1;
+    const uint16_t width = paranoid_atoi( argv[ dimensions ] );
+    const uint16_t height = paranoid_atoi( argv[ dimensions + 1 ] );
+
+    if ( stripes ) {
+      Barcode::stripeRegions( width, height, stripes ); /* throws if they don't fit */
+    }
+
+    unique_ptr<SourceMatcher> matcher;
+    if ( not index_filename.empty() ) {
+      matcher = make_unique<SourceMatcher>( index_filename, stamped_payload, search_window, max_distance );
+      if ( matcher->index().width() != width or matcher->index().height() != height ) {
+        throw runtime_error( index_filename + ": indexes frames of size " + to_string( matcher->index().width() )
+                             + "x" + to_string( matcher->index().height() ) );
+      }
+    }
+
+    Barcode::DecodeStats decode_stats;
+
+    auto report = [&, stamped_payload, stripes]( const uint64_t frame_no, const FrameView & this_frame ) {
+      /* read barcode */
+      pair<uint64_t, uint64_t> barcodes;
+      vector<uint32_t> stripe_values;
+      {
+        const Stats::ScopedTimer timer { decode_probe };
+        barcodes = Barcode::readBarcodes( this_frame, decode_options, &decode_stats );
+        if ( stripes ) {
+          stripe_values = Barcode::readStripes( this_frame, stripes );
+        }
+      }
+
+      const Stats::ScopedTimer timer { log_probe };
+      cerr << frame_no << "," << barcodes.first << "," << barcodes.second;
+      if ( stamped_payload ) {
+        cerr << "," << describe_payload( barcodes );
+      }
+      if ( stripes ) {
+        cerr << "," << describe_tears( stripe_values, this_frame.height );
+      }
+      if ( matcher ) {
+        const Stats::ScopedTimer match_timer { match_probe };
+        cerr << "," << matcher->describe( this_frame, barcodes );
+      }
+      cerr << "\n";
+    };
+
+    FileDescriptor stdout { STDOUT_FILENO };
+
+    const MappingStats stats_before = MappingStats::current();
+
+    if ( follow ) {
+      follow_capture( argv[ optind ], format, width, height, map_options, window_length,
+                      state_filename, idle_timeout, stamped_payload, stripes, bool( matcher ), report );
+    } else if ( from_ring ) {
+      FrameRingReader ring { ring_name };
+      if ( ring.slot_length() != frame_length( format, width, height ) ) {
+        throw runtime_error( "the ring " + ring_name + " holds frames of " + to_string( ring.slot_length() )
+                             + " bytes, not " + to_string( frame_length( format, width, height ) ) );
+      }
+
+      cerr << "# Reading barcodes from the ring: " << ring_name << " (" << ring.slot_count() << " slots).\n";
+      cerr << "# Frames of size " << width << "x" << height << " (" << pixel_format_name( format ) << ").\n";
+      std::time_t result = std::time(nullptr);
+      cerr << "# Time stamp: " << std::asctime(std::localtime(&result));
+      print_csv_header( stamped_payload, stripes, bool( matcher ) );
+
+      /* decode each frame in its slot, then hand the slot back */
+      while ( const optional<FrameRingReader::Slot> slot = ring.next() ) {
+        report( slot->frame_no, FrameView::packed( slot->data, format, width, height ) );
+        ring.release();
+      }
+
+      const FrameRing::Counters counters = ring.counters();
+      cerr << "# Received " << counters.frames << " frames; at most " << counters.peak_occupancy
+           << " slots full, writer stalled " << counters.writer_stalls << " times, reader waited "
+           << counters.reader_waits << " times.\n";
+    } else {
+      /* open file and check for sane length */
+      unique_ptr<FrameSource> input;
+      if ( use_uring ) {
+        /* fingerprints need the whole frame, which no regions means */
+        if ( not matcher ) {
+          uring_options.regions = Barcode::regions( width, height );
+        }
+        if ( stripes and not matcher ) {
+          const auto stripe_regions = Barcode::stripeRegions( width, height, stripes );
+          uring_options.regions.insert( uring_options.regions.end(), stripe_regions.begin(), stripe_regions.end() );
+        }
+        input = open_frame_source( argv[ optind ], format, width, height, uring_options );
+      } else {
+        input = open_frame_source( argv[ optind ], format, width, height, map_options, window_length );
+      }
+
+      if ( matcher and dynamic_cast<StripFrameSource *>( input.get() ) ) {
+        throw runtime_error( "--index needs whole frames to fingerprint, not a strip file" );
+      }
+
+      const size_t frame_count = input->frame_count();
+      const FrameRange::Resolved frames = range.resolve( frame_count );
+      if ( ranged ) {
+        input->restrict_to( frames.first, frames.count() );
+      }
+
+      cerr << "# Reading barcodes from the file: " << argv[ optind ] <<  ".\n";
+      cerr << "# Found " << frame_count << " frames of size " << width << "x" << height
+           << " (" << pixel_format_name( format ) << ").\n";
+      cerr << frames.describe() << "\n";
+
+      std::time_t result = std::time(nullptr);
+      cerr << "# Time stamp: " << std::asctime(std::localtime(&result));
+
+      /* print csv header */
+      print_csv_header( stamped_payload, stripes, bool( matcher ) );
+
+      /* iterate through frames and read barcode from each one */
+      for ( uint64_t frame_no = frames.first; frame_no < frames.end; frame_no++ ) {
+        FrameView this_frame;
+        {
+          const Stats::ScopedTimer timer { frame_probe };
+          this_frame = input->frame( frame_no );
+        }
+
+        report( frame_no, this_frame );
+      }
+    }
+
+    if ( decode_options.samples ) {
+      cerr << "# Decoded " << decode_stats.sampled_bits << " bits from " << decode_options.samples << "x"
+           << decode_options.samples << " samples, reading " << decode_stats.escalated_bits
+           << " of them from the whole block.\n";
+    }
+
+    if ( print_stats ) {
+      const MappingStats stats_after = MappingStats::current();
+      cerr << "# Major page faults: " << stats_after.major_faults - stats_before.major_faults << "\n";
+      cerr << "# Minor page faults: " << stats_after.minor_faults - stats_before.minor_faults << "\n";
+      cerr << "# Peak mapped bytes: " << stats_after.peak_mapped_bytes << "\n";
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
   }
-  
+
   return EXIT_SUCCESS;
 }
@@ -1,11 +1,21 @@
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 #include <limits>
 #include <random>
 
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "direct_writer.hh"
+#include "exception.hh"
 #include "file.hh"
+#include "frame_pool.hh"
+#include "frame_ring.hh"
+#include "frame_source.hh"
 #include "barcode.hh"
+#include "stats.hh"
 
 using namespace std;
 
@@ -19,58 +29,292 @@ unsigned int paranoid_atoi( const string & in )
   return ret;
 }
 
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [--format FORMAT] [--payload SCHEME] [--stripes N] [--start-frame N] [--frame-count N | --shard I/N]\n"
+       << "\t\t[--in-place | --output OUTPUT | --direct-output OUTPUT | --shm-ring NAME [--ring-slots N]] FILE WIDTH HEIGHT\n\n"
+       << "\t--format FORMAT  bgra (default), i420 or nv12\n"
+       << "\t--payload SCHEME random (default), counter (the frame number), or stamped\n"
+       << "\t                 (sequence number, send time and CRC; see barcode-read --payload)\n"
+       << "\t--stripes N      also stamp N narrow stripes down the right edge, to locate\n"
+       << "\t                 tears (see barcode-read --stripes)\n"
+       << "\t--start-frame N  start at frame N (counting from 0)\n"
+       << "\t--frame-count N  stamp only N frames\n"
+       << "\t--shard I/N      stamp only the Ith of N equal runs of frames (I from 0);\n"
+       << "\t                 the N outputs, concatenated in order, make the whole\n"
+       << "\t                 (with --in-place or --output, the other frames are left as they are)\n"
+       << "\t--in-place       stamp the barcodes directly into FILE\n"
+       << "\t--output OUTPUT  clone FILE to OUTPUT (sharing extents when possible), then stamp OUTPUT\n"
+       << "\t--direct-output OUTPUT\n"
+       << "\t                 write the stamped frames to OUTPUT with O_DIRECT from a background\n"
+       << "\t                 thread, bypassing the page cache\n"
+       << "\t--shm-ring NAME  stamp each frame straight into a slot of the shared-memory\n"
+       << "\t                 ring NAME, waiting for its reader (e.g. barcode-read --shm-ring)\n"
+       << "\t                 to connect, and for a free slot whenever the ring is full\n"
+       << "\t--ring-slots N   with --shm-ring, frames the ring holds (default 8)\n\n"
+       << "\tNOTE: this program...\n"
+       << "\t(1) writes barcoded image to stdout (unless --in-place, --output, --direct-output or --shm-ring is given).\n"
+       << "\t(2) writes log file to stderr.\n\n";
+}
+
+enum class PayloadScheme { Random, Counter, Stamped };
+
+PayloadScheme parse_payload_scheme( const string & in )
+{
+  if ( in == "random" ) { return PayloadScheme::Random; }
+  if ( in == "counter" ) { return PayloadScheme::Counter; }
+  if ( in == "stamped" ) { return PayloadScheme::Stamped; }
+
+  throw runtime_error( "invalid payload scheme: " + in );
+}
+
+static Stats::Probe copy_probe { "write.copy" };
+static Stats::Probe encode_probe { "write.encode" };
+static Stats::Probe log_probe { "write.log" };
+static Stats::Probe output_probe { "write.output" };
+
 int main( int argc, char *argv[] )
 {
-  /* check arguments */
-  if ( argc <= 0 ) { /* for sticklers */
-    abort();
-  }
+  try {
+    /* check arguments */
+    if ( argc <= 0 ) { /* for sticklers */
+      abort();
+    }
 
-  if ( argc != 4 ) {
-    cerr << "Usage: " << argv[ 0 ] << " FILE WIDTH HEIGHT\n\n\tNOTE: this program...\n\t(1) writes barcoded image to stdout.\n\t(2) writes log file to stderr.\n\n";
-    return EXIT_FAILURE;
-  }
+    const StatsReporter stats_reporter;
 
-  /* open file and check for sane length */
-  File input { argv[ 1 ] };
-  const uint16_t width = paranoid_atoi( argv[ 2 ] );
-  const uint16_t height = paranoid_atoi( argv[ 3 ] );
-  const size_t frame_length = width * height * sizeof( RGBPixel );
-
-  const size_t frame_count = input.size() / (uint64_t)frame_length;
-  if ( input.size() != frame_count * frame_length ) {
-    throw runtime_error( "file size is not multiple of frame size" );
-  } else {
-    cerr << "# Writing barcodes to the file: " << argv[ 1 ] <<  ".\n";    
-    cerr << "# Found " << frame_count << " frames of size " << width << "x" << height << ".\n";
-
-    std::time_t result = std::time(nullptr);
-    cerr << "# Time stamp: " << std::asctime(std::localtime(&result));    
-  }
+    PixelFormat format = PixelFormat::BGRX;
+    bool in_place = false;
+    string output_filename;
+    string direct_output_filename;
+    string ring_name;
+    unsigned int ring_slots = 8;
+    PayloadScheme payload_scheme = PayloadScheme::Random;
+    unsigned int stripes = 0;
+    FrameRange range;
+
+    const option command_line_options[] = {
+      { "format",   required_argument, nullptr, 'f' },
+      { "in-place", no_argument,       nullptr, 'i' },
+      { "output",   required_argument, nullptr, 'o' },
+      { "payload",  required_argument, nullptr, 'P' },
+      { "stripes",  required_argument, nullptr, 'N' },
+      { "direct-output", required_argument, nullptr, 'D' },
+      { "start-frame", required_argument, nullptr, 'j' },
+      { "frame-count", required_argument, nullptr, 'c' },
+      { "shard",    required_argument, nullptr, 'x' },
+      { "shm-ring", required_argument, nullptr, 'R' },
+      { "ring-slots", required_argument, nullptr, 'L' },
+      { nullptr,    0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "f:io:P:N:D:j:c:x:R:L:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'f': format = parse_pixel_format( optarg ); break;
+      case 'i': in_place = true; break;
+      case 'o': output_filename = optarg; break;
+      case 'P': payload_scheme = parse_payload_scheme( optarg ); break;
+      case 'N': stripes = paranoid_atoi( optarg ); break;
+      case 'D': direct_output_filename = optarg; break;
+      case 'j': range.start = paranoid_atoi( optarg ); break;
+      case 'c': range.count = paranoid_atoi( optarg ); break;
+      case 'R': ring_name = optarg; break;
+      case 'L': ring_slots = paranoid_atoi( optarg ); break;
+      case 'x': {
+        const FrameRange shard = FrameRange::parse_shard( optarg );
+        range.shard = shard.shard;
+        range.shards = shard.shards;
+        break;
+      }
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( argc - optind != 3
+         or int( in_place ) + int( not output_filename.empty() ) + int( not direct_output_filename.empty() )
+            + int( not ring_name.empty() ) > 1
+         or ( range.shards and ( range.start or range.count ) ) ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    const string input_filename = argv[ optind ];
+    const uint16_t width = paranoid_atoi( argv[ optind + 1 ] );
+    const uint16_t height = paranoid_atoi( argv[ optind + 2 ] );
+    const size_t frame_length = ::frame_length( format, width, height );
+
+    if ( stripes ) {
+      Barcode::stripeRegions( width, height, stripes ); /* throws if they don't fit */
+    }
+
+    /* in the patching modes, map the destination writable and leave
+       everything but the barcode rows untouched */
+    unique_ptr<MutableFile> patched;
+
+    if ( in_place ) {
+      patched = make_unique<MutableFile>( input_filename );
+    } else if ( not output_filename.empty() ) {
+      FileDescriptor source { SystemCall( input_filename, open( input_filename.c_str(), O_RDONLY ) ) };
+      /* no O_TRUNC: OUTPUT may be FILE itself, which clone_file() refuses */
+      FileDescriptor destination { SystemCall( output_filename,
+                                               open( output_filename.c_str(), O_RDWR | O_CREAT, 0644 ) ) };
+      const string method = clone_file( source, destination );
+      cerr << "# Cloned " << input_filename << " to " << output_filename << " using " << method << ".\n";
+      patched = make_unique<MutableFile>( move( destination ) );
+    }
+
+    /* open file and check for sane length */
+    unique_ptr<File> input;
+    if ( not patched ) {
+      MMap_Region::Options map_options;
+      map_options.access = MMap_Region::Access::Sequential;
+      input = make_unique<File>( input_filename, map_options );
+    }
 
-  /* print csv header */
-  cerr << "# frame_num" << "," << "barcode" << "\n";
-
-  FileDescriptor stdout { STDOUT_FILENO };
-
-  /* initialize random number generator */
-  random_device rd;
-  mt19937 generator(rd());
-  uniform_int_distribution<uint64_t> uniform_distribution(0, numeric_limits<uint64_t>::max());
-  
-  /* iterate through frames and add barcode to each one */
-  for ( unsigned int frame_no = 0; frame_no < frame_count; frame_no++ ) {
-    const Chunk this_frame_chunk = input( frame_no * frame_length, frame_length );
-    XImage this_frame { this_frame_chunk, width, height };
-
-    /* generate random barcode and add it to the frame */
-    uint64_t barcode_num = uniform_distribution(generator);
-    Barcode::writeBarcodes( this_frame, barcode_num );
-    cerr << frame_no << "," << barcode_num << "\n";
-    
-    /* print out the image */
-    stdout.write( this_frame.chunk() );
+    const size_t input_size = patched ? patched->size() : input->size();
+
+    const size_t frame_count = input_size / (uint64_t)frame_length;
+    if ( input_size != frame_count * frame_length ) {
+      throw runtime_error( "file size is not multiple of frame size" );
+    }
+
+    const FrameRange::Resolved frames = range.resolve( frame_count );
+    if ( input ) {
+      input->narrow( frames.first * frame_length, frames.count() * frame_length );
+    }
+
+    {
+      cerr << "# Writing barcodes to the file: " << ( output_filename.empty() ? input_filename : output_filename ) <<  ".\n";
+      cerr << "# Found " << frame_count << " frames of size " << width << "x" << height
+           << " (" << pixel_format_name( format ) << ").\n";
+      cerr << frames.describe() << "\n";
+
+      std::time_t result = std::time(nullptr);
+      cerr << "# Time stamp: " << std::asctime(std::localtime(&result));
+    }
+
+    /* print csv header */
+    cerr << "# frame_num" << "," << "barcode" << "\n";
+
+    FileDescriptor stdout { STDOUT_FILENO };
+
+    unique_ptr<DirectWriter> recording;
+    if ( not direct_output_filename.empty() ) {
+      DirectWriter::Options options;
+      options.preallocate = frames.count() * frame_length;
+      recording = make_unique<DirectWriter>( direct_output_filename, options );
+    }
+
+    unique_ptr<FrameRingWriter> ring;
+    if ( not ring_name.empty() ) {
+      cerr << "# Waiting for a reader on the ring " << ring_name << ".\n";
+      ring = make_unique<FrameRingWriter>( ring_name, frame_length, ring_slots );
+    }
+
+    /* initialize random number generator */
+    random_device rd;
+    mt19937 generator(rd());
+    uniform_int_distribution<uint64_t> uniform_distribution(0, numeric_limits<uint64_t>::max());
+
+    /* reused for every frame; page-aligned and never zeroed */
+    const FramePool::Buffer frame_copy = FramePool::global().acquire( patched or ring ? 0 : frame_length );
+
+    /* generate barcode */
+    auto generate_barcode = [&]( const uint64_t frame_no ) -> uint64_t {
+      switch ( payload_scheme ) {
+      case PayloadScheme::Counter: return frame_no;
+      case PayloadScheme::Stamped: return Barcode::encodePayload( { uint32_t( frame_no ), Barcode::payloadClock() } );
+      default: return uniform_distribution(generator);
+      }
+    };
+
+    /* iterate through frames and add barcode to each one */
+    for ( uint64_t frame_no = frames.first; frame_no < frames.end; frame_no++ ) {
+      uint64_t barcode_num;
+
+      if ( patched ) {
+        barcode_num = generate_barcode( frame_no );
+
+        /* add it to the frame where it lies */
+        uint8_t * this_frame = patched->data() + frame_no * frame_length;
+        {
+          const Stats::ScopedTimer timer { encode_probe };
+          const MutableFrameView view = MutableFrameView::packed( this_frame, format, width, height );
+          Barcode::writeBarcodes( view, barcode_num );
+          if ( stripes ) {
+            Barcode::writeStripes( view, barcode_num, stripes );
+          }
+        }
+      } else {
+        /* add it to a copy of the frame, made in the ring slot the reader
+           will decode it from, if there is a ring */
+        uint8_t * copy = frame_copy.data();
+        if ( ring ) {
+          copy = ring->acquire();
+        }
+
+        {
+          const Stats::ScopedTimer timer { copy_probe };
+          const Chunk this_frame_chunk = ( *input )( frame_no * frame_length, frame_length );
+          memcpy( copy, this_frame_chunk.buffer(), frame_length );
+        }
+
+        /* after any wait for a free slot, so that through a ring a stamped
+           payload carries the time the reader is handed the frame */
+        barcode_num = generate_barcode( frame_no );
+
+        {
+          const Stats::ScopedTimer timer { encode_probe };
+          const MutableFrameView view = MutableFrameView::packed( copy, format, width, height );
+          Barcode::writeBarcodes( view, barcode_num );
+          if ( stripes ) {
+            Barcode::writeStripes( view, barcode_num, stripes );
+          }
+        }
+
+        /* print out the image */
+        const Stats::ScopedTimer timer { output_probe };
+        if ( ring ) {
+          ring->publish( frame_no );
+        } else if ( recording ) {
+          recording->write( Chunk( frame_copy.data(), frame_length ) );
+        } else {
+          stdout.write( Chunk( frame_copy.data(), frame_length ) );
+        }
+      }
+
+      const Stats::ScopedTimer timer { log_probe };
+      cerr << frame_no << "," << barcode_num << "\n";
+    }
+
+    if ( recording ) {
+      recording->close();
+      cerr << "# Recorded " << recording->bytes_written() << " bytes to " << direct_output_filename
+           << ( recording->direct() ? " with O_DIRECT" : " through the page cache" )
+           << "; longest write " << recording->max_write_ns() / 1000000 << " ms, stalled "
+           << recording->total_stall_ns() / 1000000 << " ms, at most "
+           << recording->max_queue_depth() << " buffers queued.\n";
+    }
+
+    if ( ring ) {
+      ring->close();
+      const FrameRing::Counters counters = ring->counters();
+      cerr << "# Sent " << counters.frames << " frames through the ring " << ring_name << " ("
+           << ring->slot_count() << " slots); at most " << counters.peak_occupancy << " full, writer stalled "
+           << counters.writer_stalls << " times, reader waited " << counters.reader_waits << " times.\n";
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
   }
-  
+
   return EXIT_SUCCESS;
 }
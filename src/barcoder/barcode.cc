@@ -1,98 +1,416 @@
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <limits>
+#include <stdexcept>
+#include <string>
+#include <time.h>
+#include <immintrin.h>
 #include "barcode.hh"
 
 static RGBPixel White = {0xFF, 0xFF, 0xFF, 0x0};
 static RGBPixel Black = {0x0, 0x0, 0x0, 0x0};
+static uint8_t WhiteLuma = 235; /* video-range white and black, as BT.601 and BT.709 encoders produce */
+static uint8_t BlackLuma = 16;
+static uint8_t NeutralChroma = 128;
 static unsigned int barcode_grid_size = 8; /* blocks in each row and column */
 static unsigned int barcode_block_len = 16; /* height and width of each block (in pixels) */
+static unsigned int barcode_len = barcode_grid_size * barcode_block_len; /* height and width of a barcode */
+static const unsigned int stripe_block_len = 8; /* height and width of each block of a stripe (in pixels) */
+static const unsigned int stripe_width = Barcode::stripe_bits * stripe_block_len;
 
-void Barcode::writeBarcodes(XImage& image, const uint64_t barcode_num)
+static void checkBarcodePos(const unsigned int width, const unsigned int height,
+                            const unsigned int xpos, const unsigned int ypos)
 {
-    /* write upper left (UL) barcode */
-    writeBarcodeToPos(image,
-                      barcode_num,
-                      0,
-                      0);
+    if (xpos + barcode_len > width or ypos + barcode_len > height) {
+        throw std::out_of_range("attempted access to pixel outside image");
+    }
+}
 
-    /* write lower right (LR) barcode */
-    writeBarcodeToPos(image,
-                      barcode_num,
-                      image.width() - barcode_grid_size*barcode_block_len - 256, // move to the left 256px
-                      image.height() - barcode_grid_size*barcode_block_len);
+static bool bitSet(const uint64_t barcode_num, const unsigned int i, const unsigned int j,
+                   const unsigned int columns = barcode_grid_size)
+{
+    return barcode_num & (((uint64_t)1) << (j*columns + i));
 }
 
-void Barcode::writeBarcodeToPos(XImage& image, const uint64_t barcode_num,
-                                 const unsigned int xpos,
-                                 const unsigned int ypos)
+std::vector<Barcode::Region> Barcode::regions(const unsigned int width, const unsigned int height)
 {
+    if (width < barcode_len + 256 or height < barcode_len) {
+        throw std::out_of_range("frame too small to hold barcodes");
+    }
+
+    return { { 0, 0, barcode_len, barcode_len }, /* upper left (UL) */
+             { width - barcode_len - 256, // move to the left 256px
+               height - barcode_len, barcode_len, barcode_len } }; /* lower right (LR) */
+}
+
+/* draw a grid of black (bit set) and white blocks, bit 0 in the top left
+   corner, filling each row of blocks before the next */
+static void writeGrid(const MutableFrameView & frame,
+                      const uint64_t barcode_num,
+                      const unsigned int xpos,
+                      const unsigned int ypos,
+                      const unsigned int columns,
+                      const unsigned int rows,
+                      const unsigned int block_len)
+{
+    for (unsigned int i = 0; i < columns; i++) {
+        for (unsigned int j = 0; j < rows; j++) {
+            const unsigned int x_offset = block_len * i + xpos;
+            const unsigned int y_offset = block_len * j + ypos;
+
+            const bool pixel_set = bitSet(barcode_num, i, j, columns);
+
+            /* draw barcode block, touching only the rows it covers */
+            for (unsigned int y = y_offset; y < y_offset + block_len; y++) {
+                uint8_t* row = frame.planes[0] + y * frame.strides[0];
+                if (frame.format == PixelFormat::BGRX) {
+                    RGBPixel* pixels = reinterpret_cast<RGBPixel*>(row);
+                    std::fill(pixels + x_offset, pixels + x_offset + block_len,
+                              pixel_set ? Black : White);
+                } else {
+                    memset(row + x_offset, pixel_set ? BlackLuma : WhiteLuma, block_len);
+                }
+            }
+        }
+    }
+
+    if (frame.format == PixelFormat::BGRX) {
+        return;
+    }
+
+    /* blank the chroma under the barcode, so it stays black and white */
+    const unsigned int grid_width = columns * block_len, grid_height = rows * block_len;
+    /* every chroma sample that covers a grid pixel, even at an odd xpos */
+    const unsigned int chroma_x = xpos / 2, chroma_width = (xpos + grid_width + 1) / 2 - chroma_x;
+    for (unsigned int y = ypos / 2; y < (ypos + grid_height + 1) / 2; y++) {
+        if (frame.format == PixelFormat::I420) {
+            memset(frame.planes[1] + y * frame.strides[1] + chroma_x, NeutralChroma, chroma_width);
+            memset(frame.planes[2] + y * frame.strides[2] + chroma_x, NeutralChroma, chroma_width);
+        } else {
+            memset(frame.planes[1] + y * frame.strides[1] + chroma_x * 2, NeutralChroma, chroma_width * 2);
+        }
+    }
+}
+
+static void writeBarcodeToPos(const MutableFrameView & frame,
+                              const uint64_t barcode_num,
+                              const unsigned int xpos,
+                              const unsigned int ypos)
+{
+    writeGrid(frame, barcode_num, xpos, ypos, barcode_grid_size, barcode_grid_size, barcode_block_len);
+}
+
+/* the brightness of one pixel: the mean of b, g and r for BGRX, luma for YUV */
+static double pixelValue(const FrameView & frame, const uint8_t* row, const unsigned int x)
+{
+    if (frame.format == PixelFormat::BGRX) {
+        const RGBPixel & p = reinterpret_cast<const RGBPixel*>(row)[x];
+        return (p.blue + p.green + p.red) / 3.0;
+    }
+
+    /* black and white are fully determined by luma */
+    return row[x];
+}
+
+/* read average value of barcode block */
+static double blockAverage(const FrameView & frame, const unsigned int x_offset, const unsigned int y_offset)
+{
+    double average = 0;
+    for (unsigned int y = y_offset; y < y_offset + barcode_block_len; y++) {
+        const uint8_t* row = frame.planes[0] + y * frame.strides[0];
+        for (unsigned int x = x_offset; x < x_offset + barcode_block_len; x++) {
+            average += pixelValue(frame, row, x);
+        }
+    }
+    return average / (barcode_block_len * barcode_block_len);
+}
+
+/* average of an evenly spaced samples x samples grid over the middle
+   half of the block, away from edges blurred by scaling or compression */
+static double sampledAverage(const FrameView & frame, const unsigned int x_offset, const unsigned int y_offset,
+                             const unsigned int samples)
+{
+    double average = 0;
+    for (unsigned int j = 0; j < samples; j++) {
+        const unsigned int y = y_offset + barcode_block_len / 4 + barcode_block_len * (2 * j + 1) / (4 * samples);
+        const uint8_t* row = frame.planes[0] + y * frame.strides[0];
+        for (unsigned int i = 0; i < samples; i++) {
+            average += pixelValue(frame, row, x_offset + barcode_block_len / 4
+                                              + barcode_block_len * (2 * i + 1) / (4 * samples));
+        }
+    }
+    return average / (samples * samples);
+}
+
+static uint64_t readBarcodeFromPos(const FrameView & frame,
+                                   const unsigned int xpos,
+                                   const unsigned int ypos,
+                                   const Barcode::DecodeOptions & options = {},
+                                   Barcode::DecodeStats * stats = nullptr)
+{
+    static_assert( sizeof(uint8_t) == 1, "uint8_t size must be 1 byte" );
+    static_assert( sizeof(RGBPixel().red) == 1, "component size must be 1 byte" );
+    static_assert( sizeof(RGBPixel().green) == 1, "component size must be 1 byte" );
+    static_assert( sizeof(RGBPixel().blue) == 1, "component size must be 1 byte" );
+
+    uint64_t frame_num = 0;
+
     for (unsigned int i = 0; i < barcode_grid_size; i++) {
-        for (unsigned int j = 0; j < barcode_grid_size; j++) {            
+        for (unsigned int j = 0; j < barcode_grid_size; j++) {
             const unsigned int x_offset = barcode_block_len * i + xpos;
             const unsigned int y_offset = barcode_block_len * j + ypos;
 
-            const bool pixel_set = barcode_num & (((uint64_t)1) << (j*barcode_grid_size + i));
-            const RGBPixel pixel = pixel_set ? Black : White;
-
-            /* draw barcode block */
-            for (unsigned int y = y_offset; y < y_offset + barcode_block_len; y++) { 
-                for (unsigned int x = x_offset; x < x_offset + barcode_block_len; x++) {
-                    image.pixel(x, y) = pixel;
+            double average;
+            if (options.samples == 0) {
+                average = blockAverage(frame, x_offset, y_offset);
+            } else {
+                /* trust the samples only when they are clearly dark or light */
+                average = sampledAverage(frame, x_offset, y_offset, options.samples);
+                const bool escalate = std::abs(average - 128) < options.margin;
+                if (escalate) {
+                    average = blockAverage(frame, x_offset, y_offset);
+                }
+                if (stats) {
+                    stats->sampled_bits++;
+                    stats->escalated_bits += escalate;
                 }
             }
 
+            const bool bit_set = average < 128;
+            frame_num |= bit_set ? (((uint64_t)1) << (j*barcode_grid_size + i)) : 0;
         }
     }
+
+    return frame_num;
+}
+
+void Barcode::writeBarcodes(RGBPixel* frame, const unsigned int width, const unsigned int height,
+                            const uint64_t barcode_num)
+{
+    writeBarcodes(MutableFrameView::packed(&frame->blue, PixelFormat::BGRX, width, height), barcode_num);
+}
+
+void Barcode::writeBarcodes(const MutableFrameView & frame, const uint64_t barcode_num)
+{
+    for (const Region & region : regions(frame.width, frame.height)) {
+        ::writeBarcodeToPos(frame, barcode_num, region.x, region.y);
+    }
+}
+
+void Barcode::writeBarcodeToPos(const MutableFrameView & frame, const uint64_t barcode_num,
+                                 const unsigned int xpos,
+                                 const unsigned int ypos)
+{
+    checkBarcodePos(frame.width, frame.height, xpos, ypos);
+    ::writeBarcodeToPos(frame, barcode_num, xpos, ypos);
+}
+
+std::pair<uint64_t, uint64_t> Barcode::readBarcodes(const RGBPixel* frame,
+                                                    const unsigned int width, const unsigned int height)
+{
+    return readBarcodes(FrameView::packed(&frame->blue, PixelFormat::BGRX, width, height));
 }
 
-std::pair<uint64_t, uint64_t> Barcode::readBarcodes(const XImage& image)
+std::pair<uint64_t, uint64_t> Barcode::readBarcodes(const FrameView & frame, const DecodeOptions & options,
+                                                    DecodeStats * stats)
 {
+    if (options.samples > barcode_block_len / 2) {
+        throw std::out_of_range("at most " + std::to_string(barcode_block_len / 2)
+                                + " samples across each block");
+    }
+
+    const std::vector<Region> barcode_regions = regions(frame.width, frame.height);
 
     /* read upper left (UL) barcode */
-    uint64_t upper_left = readBarcodeFromPos(image,
-                                             0,
-                                             0);
-    
+    uint64_t upper_left = ::readBarcodeFromPos(frame, barcode_regions[0].x, barcode_regions[0].y,
+                                               options, stats);
+
     /* read lower right (LR) barcode */
-    uint64_t lower_right = readBarcodeFromPos(image,
-                                              image.width() - barcode_grid_size*barcode_block_len - 256, // move to the left 256px
-                                              image.height() - barcode_grid_size*barcode_block_len);
+    uint64_t lower_right = ::readBarcodeFromPos(frame, barcode_regions[1].x, barcode_regions[1].y,
+                                                options, stats);
 
     return std::make_pair(upper_left, lower_right);
 }
 
-uint64_t Barcode::readBarcodeFromPos(const XImage& image,
+uint64_t Barcode::readBarcodeFromPos(const FrameView & frame,
                                       const unsigned int xpos,
                                       const unsigned int ypos)
 {
-    uint64_t frame_num = 0;
+    checkBarcodePos(frame.width, frame.height, xpos, ypos);
+    return ::readBarcodeFromPos(frame, xpos, ypos);
+}
 
-    for (unsigned int i = 0; i < barcode_grid_size; i++) {
-        for (unsigned int j = 0; j < barcode_grid_size; j++) {            
-            const unsigned int x_offset = barcode_block_len * i + xpos;
-            const unsigned int y_offset = barcode_block_len * j + ypos;
-            
-        
-            /* read average value of barcode block */
-            double average = 0;
-            for (unsigned int y = y_offset; y < y_offset + barcode_block_len; y++) { 
-                for (unsigned int x = x_offset; x < x_offset + barcode_block_len; x++) {
-                    const RGBPixel & p = image.pixel(x, y);
-                    average += (p.blue + p.green + p.red) / 3.0;
+/* the first stripe at the top and the last at the bottom, the rest
+   evenly spaced between */
+static unsigned int stripeRow(const unsigned int k, const unsigned int height, const unsigned int stripes)
+{
+    return stripes == 1 ? 0 : k * (height - stripe_block_len) / (stripes - 1);
+}
+
+std::vector<Barcode::Region> Barcode::stripeRegions(const unsigned int width, const unsigned int height,
+                                                    const unsigned int stripes)
+{
+    if (stripes == 0 or stripes > height / stripe_block_len) {
+        throw std::out_of_range("cannot fit " + std::to_string(stripes) + " stripes in the frame");
+    }
+    if (width < barcode_len + stripe_width) {
+        throw std::out_of_range("frame too small to hold stripes");
+    }
+
+    /* against the right edge, in the margin the LR barcode leaves */
+    std::vector<Region> stripe_regions;
+    for (unsigned int k = 0; k < stripes; k++) {
+        stripe_regions.push_back({ width - stripe_width, stripeRow(k, height, stripes),
+                                   stripe_width, stripe_block_len });
+    }
+    return stripe_regions;
+}
+
+void Barcode::writeStripes(const MutableFrameView & frame, const uint64_t barcode_num,
+                           const unsigned int stripes)
+{
+    for (const Region & region : stripeRegions(frame.width, frame.height, stripes)) {
+        writeGrid(frame, barcode_num, region.x, region.y, stripe_bits, 1, stripe_block_len);
+    }
+}
+
+/* a block is set if its pixels average darker than mid-grey: for BGRX
+   the sum of b+g+r over the block, for YUV the sum of luma */
+static const unsigned int stripe_block_pixels = stripe_block_len * stripe_block_len;
+static const uint64_t stripe_bgrx_threshold = 128 * 3 * stripe_block_pixels;
+static const uint64_t stripe_luma_threshold = 128 * stripe_block_pixels;
+
+static uint32_t readStripeScalar(const FrameView & frame, const Barcode::Region & region)
+{
+    uint64_t sums[Barcode::stripe_bits] = {};
+
+    for (unsigned int y = region.y; y < region.y + stripe_block_len; y++) {
+        const uint8_t* row = frame.planes[0] + y * frame.strides[0];
+        for (unsigned int i = 0; i < Barcode::stripe_bits; i++) {
+            const unsigned int x_offset = region.x + i * stripe_block_len;
+            if (frame.format == PixelFormat::BGRX) {
+                const RGBPixel* pixels = reinterpret_cast<const RGBPixel*>(row);
+                for (unsigned int x = x_offset; x < x_offset + stripe_block_len; x++) {
+                    sums[i] += pixels[x].blue + pixels[x].green + pixels[x].red;
+                }
+            } else {
+                for (unsigned int x = x_offset; x < x_offset + stripe_block_len; x++) {
+                    sums[i] += row[x];
                 }
             }
-            average /= (barcode_block_len * barcode_block_len);
+        }
+    }
 
-            static_assert( sizeof(uint8_t) == 1, "uint8_t size must be 1 byte" );
-            static_assert( sizeof(RGBPixel().red) == 1, "component size must be 1 byte" );
-            static_assert( sizeof(RGBPixel().green) == 1, "component size must be 1 byte" );
-            static_assert( sizeof(RGBPixel().blue) == 1, "component size must be 1 byte" );
+    const uint64_t threshold = frame.format == PixelFormat::BGRX ? stripe_bgrx_threshold
+                                                                 : stripe_luma_threshold;
+    uint32_t stripe = 0;
+    for (unsigned int i = 0; i < Barcode::stripe_bits; i++) {
+        stripe |= sums[i] < threshold ? (uint32_t(1) << i) : 0;
+    }
+    return stripe;
+}
 
-            const bool bit_set = average < 128;
-            frame_num |= bit_set ? (((uint64_t)1) << (j*barcode_grid_size + i)) : 0;
+/* the same, summing with PSADBW: one BGRX block row (8 pixels) fills a
+   register, with the X bytes masked off, and one register of luma spans
+   the rows of four blocks, one block per 64-bit lane */
+__attribute__((target("avx2")))
+static uint32_t readStripeAVX2(const FrameView & frame, const Barcode::Region & region)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t stripe = 0;
+
+    if (frame.format == PixelFormat::BGRX) {
+        const __m256i colour = _mm256_set1_epi32(0x00FFFFFF);
+        for (unsigned int i = 0; i < Barcode::stripe_bits; i++) {
+            __m256i sum = zero;
+            for (unsigned int y = region.y; y < region.y + stripe_block_len; y++) {
+                const uint8_t* block = frame.planes[0] + y * frame.strides[0]
+                                     + (region.x + i * stripe_block_len) * sizeof(RGBPixel);
+                const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+                sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_and_si256(pixels, colour), zero));
+            }
+            const uint64_t total = _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1)
+                                 + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+            stripe |= total < stripe_bgrx_threshold ? (uint32_t(1) << i) : 0;
         }
+        return stripe;
     }
 
-    return frame_num;
+    for (unsigned int i = 0; i < Barcode::stripe_bits; i += 4) {
+        __m256i sum = zero;
+        for (unsigned int y = region.y; y < region.y + stripe_block_len; y++) {
+            const uint8_t* blocks = frame.planes[0] + y * frame.strides[0] + region.x + i * stripe_block_len;
+            const __m256i luma = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blocks));
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(luma, zero));
+        }
+        const __m256i set = _mm256_cmpgt_epi64(_mm256_set1_epi64x(stripe_luma_threshold), sum);
+        stripe |= uint32_t(_mm256_movemask_pd(_mm256_castsi256_pd(set))) << i;
+    }
+    return stripe;
+}
+
+std::vector<uint32_t> Barcode::readStripes(const FrameView & frame, const unsigned int stripes)
+{
+    static const bool use_avx2 = __builtin_cpu_supports("avx2");
+
+    std::vector<uint32_t> values;
+    for (const Region & region : stripeRegions(frame.width, frame.height, stripes)) {
+        values.push_back(use_avx2 ? readStripeAVX2(frame, region) : readStripeScalar(frame, region));
+    }
+    return values;
+}
+
+std::vector<std::pair<unsigned int, unsigned int>>
+Barcode::findTears(const std::vector<uint32_t> & stripes, const unsigned int height)
+{
+    std::vector<std::pair<unsigned int, unsigned int>> tears;
+    for (unsigned int k = 1; k < stripes.size(); k++) {
+        if (stripes[k] != stripes[k - 1]) {
+            /* a stripe reads as whichever update covers most of its
+               rows, so the change may lie inside either stripe */
+            tears.emplace_back(stripeRow(k - 1, height, stripes.size()) + 1,
+                               stripeRow(k, height, stripes.size()) + stripe_block_len - 1);
+        }
+    }
+    return tears;
+}
+
+/* CRC-8 (polynomial x^8 + x^2 + x + 1) of the upper 56 bits, low byte first;
+   starting from 0xFF keeps all-white and all-black barcodes from passing */
+static uint8_t payloadCRC(const uint64_t barcode_num)
+{
+    uint8_t crc = 0xFF;
+    for (unsigned int byte = 1; byte < 8; byte++) {
+        crc ^= (barcode_num >> (8 * byte)) & 0xFF;
+        for (unsigned int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+uint64_t Barcode::encodePayload(const Payload & payload)
+{
+    const uint64_t fields = (uint64_t(payload.sequence & 0xFFFFFF) << 8)
+                          | (uint64_t(payload.timestamp) << 32);
+    return fields | payloadCRC(fields);
+}
+
+std::optional<Barcode::Payload> Barcode::decodePayload(const uint64_t barcode_num)
+{
+    if ((barcode_num & 0xFF) != payloadCRC(barcode_num)) {
+        return {};
+    }
+
+    return Payload { uint32_t((barcode_num >> 8) & 0xFFFFFF), uint32_t(barcode_num >> 32) };
+}
+
+uint32_t Barcode::payloadClock()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec) / payload_tick_ns;
 }
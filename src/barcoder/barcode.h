@@ -0,0 +1,110 @@
+/* -*-mode:c; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef CAPTAIN_EO_BARCODE_H
+#define CAPTAIN_EO_BARCODE_H
+
+/* libbarcode: stamp and read captain-eo barcodes in frames that the
+   caller already holds in memory, e.g. inside a capture or encoder loop,
+   with no copy and no X connection.
+
+   A frame is described by up to three plane pointers with their strides,
+   so rows may be padded and planes need not be contiguous. Nothing is
+   retained after a call returns, and any number of threads may call in
+   at once. Every function returns BARCODE_OK or a negative status;
+   barcode_status_string() names it. Installed as <captain-eo/barcode.h>;
+   pkg-config libbarcode gives the flags. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bumped whenever a declaration here changes incompatibly */
+#define BARCODE_API_VERSION 2
+
+typedef enum
+{
+  BARCODE_FORMAT_BGRX = 0, /* 4 bytes per pixel: blue, green, red, unused */
+  BARCODE_FORMAT_I420 = 1, /* Y plane, then U and V planes at half resolution */
+  BARCODE_FORMAT_NV12 = 2  /* Y plane, then interleaved U and V at half resolution */
+} barcode_format;
+
+typedef enum
+{
+  BARCODE_OK = 0,
+  BARCODE_ERROR_INVALID = -1,   /* a null pointer, unknown format or short stride */
+  BARCODE_ERROR_TOO_SMALL = -2, /* the frame cannot hold the barcodes */
+  BARCODE_ERROR_INTERNAL = -3
+} barcode_status;
+
+typedef struct
+{
+  barcode_format format;
+  unsigned int width, height;
+  uint8_t * planes[ 3 ]; /* for BGRX, only planes[ 0 ]; for NV12, planes[ 0 ] and [ 1 ] */
+  size_t strides[ 3 ];   /* bytes from one row of a plane to the next */
+} barcode_frame;
+
+/* the same, for frames that are only read */
+typedef struct
+{
+  barcode_format format;
+  unsigned int width, height;
+  const uint8_t * planes[ 3 ];
+  size_t strides[ 3 ];
+} barcode_const_frame;
+
+/* a read-only description of the same frame */
+static inline barcode_const_frame barcode_frame_as_const( const barcode_frame * frame )
+{
+  barcode_const_frame out = { frame->format, frame->width, frame->height,
+                              { frame->planes[ 0 ], frame->planes[ 1 ], frame->planes[ 2 ] },
+                              { frame->strides[ 0 ], frame->strides[ 1 ], frame->strides[ 2 ] } };
+  return out;
+}
+
+/* as barcode-read --samples/--margin: samples = 0 decides every bit
+   from its whole block; otherwise from samples x samples pixels in its
+   middle, reading the whole block only when they average within margin
+   of the threshold */
+typedef struct
+{
+  unsigned int samples;
+  unsigned int margin;
+} barcode_decode_options;
+
+int barcode_api_version( void );
+const char * barcode_status_string( int status );
+
+/* describe a frame packed as in a raw file starting at data */
+int barcode_frame_packed( barcode_frame * frame, uint8_t * data, barcode_format format,
+                          unsigned int width, unsigned int height );
+
+/* stamp value into the frame's two barcodes (for YUV, into luma, with
+   neutral chroma beneath) */
+int barcode_write( const barcode_frame * frame, uint64_t value );
+
+/* read the upper-left and lower-right barcodes; options may be null */
+int barcode_read( const barcode_const_frame * frame, const barcode_decode_options * options,
+                  uint64_t * upper_left, uint64_t * lower_right );
+
+/* the same for count frames; every frame is checked before any is
+   touched, so a failed call changes nothing */
+int barcode_write_batch( const barcode_frame * frames, const uint64_t * values, size_t count );
+int barcode_read_batch( const barcode_const_frame * frames, size_t count,
+                        const barcode_decode_options * options,
+                        uint64_t * upper_left, uint64_t * lower_right );
+
+/* the self-describing value of barcode-write --payload stamped: a 24-bit
+   sequence number, a timestamp in ticks of 100 us and a CRC-8 */
+uint64_t barcode_encode_payload( uint32_t sequence, uint32_t timestamp );
+/* BARCODE_ERROR_INVALID if the CRC does not match */
+int barcode_decode_payload( uint64_t value, uint32_t * sequence, uint32_t * timestamp );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAPTAIN_EO_BARCODE_H */
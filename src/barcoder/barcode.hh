@@ -1,12 +1,87 @@
 #pragma once
 
 #include <cstdint>
-#include "display.hh"
+#include <optional>
+#include <utility>
+#include <vector>
+#include "frame_view.hh"
+
+/* the XImage overloads are defined in barcode_ximage.cc, which only the
+   tools link; the rest has no X dependency (see barcode.h) */
+class XImage;
 
 namespace Barcode {
+    /* a rectangle of the frame covered by one barcode */
+    struct Region { unsigned int x, y, width, height; };
+
+    /* where the barcodes go in a frame of the given size */
+    std::vector<Region> regions(const unsigned int width, const unsigned int height);
+
     void writeBarcodes(XImage& image, uint64_t barcode_num); 
+    /* stamp a frame in place, e.g. inside a writable mapping of a raw file */
+    void writeBarcodes(RGBPixel* frame, const unsigned int width, const unsigned int height, uint64_t barcode_num);
+    /* for planar YUV, stamps the Y plane and leaves neutral chroma under the barcodes */
+    void writeBarcodes(const MutableFrameView & frame, uint64_t barcode_num);
     void writeBarcodeToPos(XImage& image, uint64_t barcode_num, const unsigned int xpos, const unsigned int ypos); 
+    void writeBarcodeToPos(const MutableFrameView & frame, uint64_t barcode_num,
+                           const unsigned int xpos, const unsigned int ypos);
 
     std::pair<uint64_t, uint64_t> readBarcodes(const XImage& image);
+    /* read a frame where it lies; only the barcode regions are touched */
+    std::pair<uint64_t, uint64_t> readBarcodes(const RGBPixel* frame, const unsigned int width, const unsigned int height);
+    /* how to decide each bit: from every pixel of its block (samples = 0),
+       or from a samples x samples grid in the middle of the block, falling
+       back to every pixel when the samples average within margin of the
+       threshold (128), as they do on noisy or blurred captures */
+    struct DecodeOptions {
+        unsigned int samples = 0;
+        unsigned int margin = 64;
+    };
+
+    /* bits decided by sampling, and of those, how many were read in full */
+    struct DecodeStats {
+        uint64_t sampled_bits = 0;
+        uint64_t escalated_bits = 0;
+    };
+
+    /* for planar YUV, only the Y plane is read */
+    std::pair<uint64_t, uint64_t> readBarcodes(const FrameView & frame, const DecodeOptions & options = {},
+                                               DecodeStats * stats = nullptr);
     uint64_t readBarcodeFromPos(const XImage& image, const unsigned int xpos, const unsigned int ypos); 
+    uint64_t readBarcodeFromPos(const FrameView & frame, const unsigned int xpos, const unsigned int ypos);
+
+    /* stripes: narrow barcodes of stripe_bits blocks of 8x8 pixels, each
+       holding the low bits of the frame's barcode, stamped at N rows from
+       the top of the frame to the bottom along its right edge. A frame
+       torn between two updates shows different values above and below
+       the tear, and a stripe crossed by the tear decodes as neither. */
+    static constexpr unsigned int stripe_bits = 32;
+
+    std::vector<Region> stripeRegions(const unsigned int width, const unsigned int height,
+                                      const unsigned int stripes);
+    void writeStripes(const MutableFrameView & frame, uint64_t barcode_num, const unsigned int stripes);
+    /* one value per stripe, top to bottom, read with AVX2 when the CPU has it */
+    std::vector<uint32_t> readStripes(const FrameView & frame, const unsigned int stripes);
+    /* for each pair of adjacent stripes that disagree, the band of rows
+       [first, last] where the frame changed */
+    std::vector<std::pair<unsigned int, unsigned int>> findTears(const std::vector<uint32_t> & stripes,
+                                                                 const unsigned int height);
+
+    /* a self-describing barcode value, instead of a random number:
+       bits 0-7 hold a CRC-8 of bits 8-63, bits 8-31 a frame sequence
+       number and bits 32-63 the sender's CLOCK_MONOTONIC when the frame
+       was stamped, in ticks of payload_tick_ns (wrapping every ~5 days) */
+    struct Payload {
+        uint32_t sequence;  /* only the low 24 bits are kept */
+        uint32_t timestamp;
+    };
+
+    static constexpr uint64_t payload_tick_ns = 100000;
+
+    uint64_t encodePayload(const Payload & payload);
+    /* empty if the CRC does not match */
+    std::optional<Payload> decodePayload(const uint64_t barcode_num);
+
+    /* the current time in payload ticks */
+    uint32_t payloadClock();
 }
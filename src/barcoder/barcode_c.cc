@@ -0,0 +1,218 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* the C API of libbarcode (see barcode.h), over the Barcode namespace;
+   no exception crosses it */
+
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "barcode.h"
+#include "barcode.hh"
+
+using namespace std;
+
+static bool to_pixel_format( const barcode_format format, PixelFormat & out )
+{
+  switch ( format ) {
+  case BARCODE_FORMAT_BGRX: out = PixelFormat::BGRX; return true;
+  case BARCODE_FORMAT_I420: out = PixelFormat::I420; return true;
+  case BARCODE_FORMAT_NV12: out = PixelFormat::NV12; return true;
+  }
+  return false;
+}
+
+/* check the caller's description of a frame and convert it */
+template <typename Frame, typename View>
+static int to_view( const Frame * frame, View & view )
+{
+  if ( not frame or not frame->width or not frame->height
+       or not to_pixel_format( frame->format, view.format ) ) {
+    return BARCODE_ERROR_INVALID;
+  }
+
+  view.width = frame->width;
+  view.height = frame->height;
+  for ( unsigned int plane = 0; plane < 3; plane++ ) {
+    view.planes[ plane ] = frame->planes[ plane ];
+    view.strides[ plane ] = frame->strides[ plane ];
+  }
+
+  /* the bytes each plane's rows must hold */
+  const size_t chroma_width = view.chroma_width();
+  size_t row_lengths[ 3 ] = { 0, 0, 0 };
+  switch ( view.format ) {
+  case PixelFormat::BGRX: row_lengths[ 0 ] = size_t( 4 ) * view.width; break;
+  case PixelFormat::I420: row_lengths[ 0 ] = view.width; row_lengths[ 1 ] = row_lengths[ 2 ] = chroma_width; break;
+  case PixelFormat::NV12: row_lengths[ 0 ] = view.width; row_lengths[ 1 ] = 2 * chroma_width; break;
+  }
+
+  for ( unsigned int plane = 0; plane < 3; plane++ ) {
+    if ( row_lengths[ plane ]
+         and ( not view.planes[ plane ] or view.strides[ plane ] < row_lengths[ plane ] ) ) {
+      return BARCODE_ERROR_INVALID;
+    }
+  }
+
+  return BARCODE_OK;
+}
+
+static int to_options( const barcode_decode_options * options, Barcode::DecodeOptions & out )
+{
+  if ( options ) {
+    out.samples = options->samples;
+    out.margin = options->margin;
+  }
+  /* samples within half a block (see Barcode::readBarcodes) */
+  return out.samples > 8 ? BARCODE_ERROR_INVALID : BARCODE_OK;
+}
+
+/* regions() throws if the barcodes don't fit */
+template <typename View>
+static int check_size( const View & view )
+{
+  try {
+    Barcode::regions( view.width, view.height );
+  } catch ( const out_of_range & ) {
+    return BARCODE_ERROR_TOO_SMALL;
+  }
+  return BARCODE_OK;
+}
+
+template <typename Function>
+static int guarded( Function && function )
+{
+  try {
+    return function();
+  } catch ( const out_of_range & ) {
+    return BARCODE_ERROR_TOO_SMALL;
+  } catch ( ... ) {
+    return BARCODE_ERROR_INTERNAL;
+  }
+}
+
+extern "C" {
+
+int barcode_api_version( void )
+{
+  return BARCODE_API_VERSION;
+}
+
+const char * barcode_status_string( const int status )
+{
+  switch ( status ) {
+  case BARCODE_OK: return "success";
+  case BARCODE_ERROR_INVALID: return "invalid argument";
+  case BARCODE_ERROR_TOO_SMALL: return "frame too small to hold barcodes";
+  case BARCODE_ERROR_INTERNAL: return "internal error";
+  }
+  return "unknown status";
+}
+
+int barcode_frame_packed( barcode_frame * frame, uint8_t * data, const barcode_format format,
+                          const unsigned int width, const unsigned int height )
+{
+  PixelFormat pixel_format;
+  if ( not frame or not data or not to_pixel_format( format, pixel_format ) ) {
+    return BARCODE_ERROR_INVALID;
+  }
+
+  const MutableFrameView view = MutableFrameView::packed( data, pixel_format, width, height );
+  frame->format = format;
+  frame->width = width;
+  frame->height = height;
+  for ( unsigned int plane = 0; plane < 3; plane++ ) {
+    frame->planes[ plane ] = view.planes[ plane ];
+    frame->strides[ plane ] = view.strides[ plane ];
+  }
+  return BARCODE_OK;
+}
+
+int barcode_write( const barcode_frame * frame, const uint64_t value )
+{
+  return barcode_write_batch( frame, &value, 1 );
+}
+
+int barcode_read( const barcode_const_frame * frame, const barcode_decode_options * options,
+                  uint64_t * upper_left, uint64_t * lower_right )
+{
+  return barcode_read_batch( frame, 1, options, upper_left, lower_right );
+}
+
+int barcode_write_batch( const barcode_frame * frames, const uint64_t * values, const size_t count )
+{
+  if ( count and ( not frames or not values ) ) {
+    return BARCODE_ERROR_INVALID;
+  }
+
+  /* the views too are allocated inside guarded(), since count is the caller's */
+  return guarded( [&] {
+      vector<MutableFrameView> views( count );
+      for ( size_t i = 0; i < count; i++ ) {
+        if ( const int status = to_view( frames + i, views[ i ] ); status != BARCODE_OK ) {
+          return status;
+        }
+        if ( const int status = check_size( views[ i ] ); status != BARCODE_OK ) {
+          return status;
+        }
+      }
+
+      for ( size_t i = 0; i < count; i++ ) {
+        Barcode::writeBarcodes( views[ i ], values[ i ] );
+      }
+      return int( BARCODE_OK );
+    } );
+}
+
+int barcode_read_batch( const barcode_const_frame * frames, const size_t count,
+                        const barcode_decode_options * options,
+                        uint64_t * upper_left, uint64_t * lower_right )
+{
+  if ( count and ( not frames or not upper_left or not lower_right ) ) {
+    return BARCODE_ERROR_INVALID;
+  }
+
+  Barcode::DecodeOptions decode_options;
+  if ( const int status = to_options( options, decode_options ); status != BARCODE_OK ) {
+    return status;
+  }
+
+  return guarded( [&] {
+      vector<FrameView> views( count );
+      for ( size_t i = 0; i < count; i++ ) {
+        if ( const int status = to_view( frames + i, views[ i ] ); status != BARCODE_OK ) {
+          return status;
+        }
+        if ( const int status = check_size( views[ i ] ); status != BARCODE_OK ) {
+          return status;
+        }
+      }
+
+      for ( size_t i = 0; i < count; i++ ) {
+        tie( upper_left[ i ], lower_right[ i ] ) = Barcode::readBarcodes( views[ i ], decode_options );
+      }
+      return int( BARCODE_OK );
+    } );
+}
+
+uint64_t barcode_encode_payload( const uint32_t sequence, const uint32_t timestamp )
+{
+  return Barcode::encodePayload( { sequence, timestamp } );
+}
+
+int barcode_decode_payload( const uint64_t value, uint32_t * sequence, uint32_t * timestamp )
+{
+  const optional<Barcode::Payload> payload = Barcode::decodePayload( value );
+  if ( not payload ) {
+    return BARCODE_ERROR_INVALID;
+  }
+  if ( sequence ) {
+    *sequence = payload->sequence;
+  }
+  if ( timestamp ) {
+    *timestamp = payload->timestamp;
+  }
+  return BARCODE_OK;
+}
+
+}
@@ -0,0 +1,36 @@
+#include "barcode.hh"
+#include "display.hh"
+
+static MutableFrameView bgrxView(XImage& image)
+{
+    return MutableFrameView::packed(image.data_unsafe(), PixelFormat::BGRX, image.width(), image.height());
+}
+
+static FrameView bgrxView(const XImage& image)
+{
+    return FrameView::packed(image.data(), PixelFormat::BGRX, image.width(), image.height());
+}
+
+void Barcode::writeBarcodes(XImage& image, const uint64_t barcode_num)
+{
+    writeBarcodes(bgrxView(image), barcode_num);
+}
+
+void Barcode::writeBarcodeToPos(XImage& image, const uint64_t barcode_num,
+                                 const unsigned int xpos,
+                                 const unsigned int ypos)
+{
+    writeBarcodeToPos(bgrxView(image), barcode_num, xpos, ypos);
+}
+
+std::pair<uint64_t, uint64_t> Barcode::readBarcodes(const XImage& image)
+{
+    return readBarcodes(bgrxView(image));
+}
+
+uint64_t Barcode::readBarcodeFromPos(const XImage& image,
+                                      const unsigned int xpos,
+                                      const unsigned int ypos)
+{
+    return readBarcodeFromPos(bgrxView(image), xpos, ypos);
+}
@@ -0,0 +1,186 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <endian.h>
+#include <immintrin.h>
+
+#include "fingerprint.hh"
+#include "barcode.hh"
+
+using namespace std;
+
+static const string file_magic = "CEOFPIDX";
+static const size_t header_length = 32;
+
+/* samples across each cell */
+static const unsigned int samples_across = 8;
+static const unsigned int grid_across = fingerprint_cells_across * samples_across;
+
+array<bool, fingerprint_length> barcode_cells( const unsigned int width, const unsigned int height )
+{
+  array<bool, fingerprint_length> mask {};
+  for ( const auto & region : Barcode::regions( width, height ) ) {
+    for ( unsigned int cy = 0; cy < fingerprint_cells_across; cy++ ) {
+      for ( unsigned int cx = 0; cx < fingerprint_cells_across; cx++ ) {
+        const uint64_t x0 = uint64_t( cx ) * width / fingerprint_cells_across;
+        const uint64_t x1 = uint64_t( cx + 1 ) * width / fingerprint_cells_across;
+        const uint64_t y0 = uint64_t( cy ) * height / fingerprint_cells_across;
+        const uint64_t y1 = uint64_t( cy + 1 ) * height / fingerprint_cells_across;
+        if ( region.x < x1 and region.x + region.width > x0 and region.y < y1 and region.y + region.height > y0 ) {
+          mask[ cy * fingerprint_cells_across + cx ] = true;
+        }
+      }
+    }
+  }
+  return mask;
+}
+
+Fingerprint take_fingerprint( const FrameView & frame, const array<bool, fingerprint_length> & mask )
+{
+  /* the middle of each of grid_across equal parts of a row or column */
+  array<unsigned int, grid_across> xs, ys;
+  for ( unsigned int i = 0; i < grid_across; i++ ) {
+    xs[ i ] = ( uint64_t( 2 * i + 1 ) * frame.width ) / ( 2 * grid_across );
+    ys[ i ] = ( uint64_t( 2 * i + 1 ) * frame.height ) / ( 2 * grid_across );
+  }
+
+  array<unsigned int, fingerprint_length> sums {};
+  for ( unsigned int gy = 0; gy < grid_across; gy++ ) {
+    const uint8_t * row = frame.planes[ 0 ] + ys[ gy ] * frame.strides[ 0 ];
+    unsigned int * cell_sums = sums.data() + ( gy / samples_across ) * fingerprint_cells_across;
+    if ( frame.format == PixelFormat::BGRX ) {
+      for ( unsigned int gx = 0; gx < grid_across; gx++ ) {
+        const uint8_t * pixel = row + 4 * xs[ gx ];
+        cell_sums[ gx / samples_across ] += ( 29 * pixel[ 0 ] + 150 * pixel[ 1 ] + 77 * pixel[ 2 ] ) >> 8;
+      }
+    } else {
+      for ( unsigned int gx = 0; gx < grid_across; gx++ ) {
+        cell_sums[ gx / samples_across ] += row[ xs[ gx ] ];
+      }
+    }
+  }
+
+  /* stretch what is left after the barcodes to the full range */
+  unsigned int low = 255 * samples_across * samples_across, high = 0;
+  for ( unsigned int cell = 0; cell < fingerprint_length; cell++ ) {
+    if ( not mask[ cell ] ) {
+      low = min( low, sums[ cell ] );
+      high = max( high, sums[ cell ] );
+    }
+  }
+
+  Fingerprint fingerprint {};
+  for ( unsigned int cell = 0; cell < fingerprint_length; cell++ ) {
+    if ( not mask[ cell ] and high > low ) {
+      fingerprint[ cell ] = ( sums[ cell ] - low ) * 255 / ( high - low );
+    }
+  }
+  return fingerprint;
+}
+
+static unsigned int distance_scalar( const uint8_t * a, const uint8_t * b )
+{
+  unsigned int distance = 0;
+  for ( unsigned int i = 0; i < fingerprint_length; i++ ) {
+    distance += a[ i ] > b[ i ] ? a[ i ] - b[ i ] : b[ i ] - a[ i ];
+  }
+  return distance;
+}
+
+/* PSADBW sums the absolute differences of 8 bytes at a time */
+__attribute__((target("avx2")))
+static unsigned int distance_avx2( const uint8_t * a, const uint8_t * b )
+{
+  __m256i sums = _mm256_setzero_si256();
+  for ( unsigned int i = 0; i < fingerprint_length; i += 32 ) {
+    const __m256i va = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( a + i ) );
+    const __m256i vb = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( b + i ) );
+    sums = _mm256_add_epi64( sums, _mm256_sad_epu8( va, vb ) );
+  }
+  const __m128i halves = _mm_add_epi64( _mm256_castsi256_si128( sums ), _mm256_extracti128_si256( sums, 1 ) );
+  return _mm_cvtsi128_si64( halves ) + _mm_extract_epi64( halves, 1 );
+}
+
+unsigned int fingerprint_distance( const uint8_t * a, const uint8_t * b )
+{
+  static const bool use_avx2 = __builtin_cpu_supports( "avx2" );
+  return use_avx2 ? distance_avx2( a, b ) : distance_scalar( a, b );
+}
+
+static void put_le32( string & str, const uint32_t value )
+{
+  const uint32_t le = htole32( value );
+  str.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+}
+
+string FingerprintIndex::header( const unsigned int width, const unsigned int height, const uint64_t frame_count )
+{
+  string ret = file_magic;
+  put_le32( ret, width );
+  put_le32( ret, height );
+  put_le32( ret, fingerprint_cells_across );
+  put_le32( ret, 0 );
+  const uint64_t le = htole64( frame_count );
+  ret.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+  return ret;
+}
+
+FingerprintIndex::FingerprintIndex( const string & filename )
+  : file_( filename ),
+    width_(),
+    height_(),
+    frame_count_(),
+    mask_()
+{
+  if ( file_.size() < header_length or file_( 0, file_magic.size() ).to_string() != file_magic ) {
+    throw runtime_error( filename + ": not a fingerprint index" );
+  }
+
+  width_ = file_( 8, 4 ).le32();
+  height_ = file_( 12, 4 ).le32();
+  if ( file_( 16, 4 ).le32() != fingerprint_cells_across ) {
+    throw runtime_error( filename + ": fingerprints of another size" );
+  }
+  frame_count_ = file_( 24, 8 ).le64();
+
+  if ( file_.size() != header_length + frame_count_ * ( sizeof( uint64_t ) + fingerprint_length ) ) {
+    throw runtime_error( filename + ": truncated fingerprint index" );
+  }
+
+  mask_ = barcode_cells( width_, height_ );
+
+  /* the first frame with each barcode, should one repeat */
+  const Chunk barcodes = file_( header_length, frame_count_ * sizeof( uint64_t ) );
+  frame_of_barcode_.reserve( frame_count_ );
+  for ( uint64_t frame_no = 0; frame_no < frame_count_; frame_no++ ) {
+    frame_of_barcode_.emplace( barcodes( frame_no * sizeof( uint64_t ), sizeof( uint64_t ) ).le64(), frame_no );
+  }
+}
+
+const uint8_t * FingerprintIndex::fingerprint( const uint64_t frame_no ) const
+{
+  return file_( header_length + frame_count_ * sizeof( uint64_t ) + frame_no * fingerprint_length,
+                fingerprint_length ).buffer();
+}
+
+uint64_t FingerprintIndex::find_barcode( const uint64_t barcode ) const
+{
+  const auto found = frame_of_barcode_.find( barcode );
+  return found == frame_of_barcode_.end() ? frame_count_ : found->second;
+}
+
+FingerprintIndex::Match FingerprintIndex::nearest( const Fingerprint & fingerprint,
+                                                   const uint64_t first, const uint64_t end ) const
+{
+  Match best { frame_count_, numeric_limits<unsigned int>::max() };
+  for ( uint64_t frame_no = first; frame_no < min( end, frame_count_ ); frame_no++ ) {
+    const unsigned int distance = fingerprint_distance( fingerprint.data(), this->fingerprint( frame_no ) );
+    if ( distance < best.distance ) {
+      best = { frame_no, distance };
+    }
+  }
+  return best;
+}
@@ -0,0 +1,81 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FINGERPRINT_HH
+#define FINGERPRINT_HH
+
+/* content fingerprints of the frames of a video, for naming the source
+   frame of a captured frame whose barcodes did not survive (see
+   barcode-index and barcode-read --index)
+
+   A fingerprint is a 16x16 thumbnail of the frame's luma. Each cell is
+   the mean of 8x8 samples spread across its part of the frame, so it is
+   cheap to take and indifferent to scaling and to compression noise;
+   the thumbnail is then stretched to the full range, which cancels
+   differences in brightness and contrast. Cells under the barcodes,
+   which change every frame, are left at zero. Two fingerprints are as
+   far apart as the sum of their cells' absolute differences.
+
+   file:   header | barcodes | fingerprints
+   header: "CEOFPIDX", then le32 width, height and cells across (16),
+           then le32 0 and le64 frame count
+   barcodes: the le64 upper-left barcode of each frame
+   fingerprints: 256 bytes for each frame */
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "file.hh"
+#include "frame_view.hh"
+
+static constexpr unsigned int fingerprint_cells_across = 16;
+static constexpr unsigned int fingerprint_length = fingerprint_cells_across * fingerprint_cells_across;
+
+typedef std::array<uint8_t, fingerprint_length> Fingerprint;
+
+/* which cells lie under the barcodes of a width x height frame */
+std::array<bool, fingerprint_length> barcode_cells( const unsigned int width, const unsigned int height );
+
+/* mask is from barcode_cells() for the frame the index was made from */
+Fingerprint take_fingerprint( const FrameView & frame, const std::array<bool, fingerprint_length> & mask );
+
+/* sum of absolute differences, with AVX2 when the CPU has it */
+unsigned int fingerprint_distance( const uint8_t * a, const uint8_t * b );
+
+class FingerprintIndex
+{
+private:
+  File file_;
+  unsigned int width_, height_;
+  uint64_t frame_count_;
+  std::array<bool, fingerprint_length> mask_;
+  std::unordered_map<uint64_t, uint64_t> frame_of_barcode_ {};
+
+  const uint8_t * fingerprint( const uint64_t frame_no ) const;
+
+public:
+  FingerprintIndex( const std::string & filename );
+
+  static std::string header( const unsigned int width, const unsigned int height, const uint64_t frame_count );
+
+  unsigned int width() const { return width_; }
+  unsigned int height() const { return height_; }
+  uint64_t frame_count() const { return frame_count_; }
+
+  /* the frame stamped with this barcode, or frame_count() if none */
+  uint64_t find_barcode( const uint64_t barcode ) const;
+
+  Fingerprint take( const FrameView & frame ) const { return take_fingerprint( frame, mask_ ); }
+
+  struct Match
+  {
+    uint64_t frame_no;
+    unsigned int distance;
+  };
+
+  /* the nearest of frames [first, end) */
+  Match nearest( const Fingerprint & fingerprint, const uint64_t first, const uint64_t end ) const;
+};
+
+#endif /* FINGERPRINT_HH */
@@ -0,0 +1,358 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "frame_source.hh"
+#include "barcode.hh"
+#include "exception.hh"
+
+using namespace std;
+
+RawFrameSource::RawFrameSource( const string & filename, const PixelFormat format,
+                                const unsigned int width, const unsigned int height,
+                                const MMap_Region::Options & options, const size_t window_length )
+  : file_( filename, options, window_length ),
+    format_( format ),
+    width_( width ),
+    height_( height ),
+    frame_length_( frame_length( format, width, height ) )
+{
+  if ( file_.size() % frame_length_ ) {
+    throw runtime_error( "file size is not multiple of frame size" );
+  }
+}
+
+void RawFrameSource::restrict_to( const uint64_t first, const uint64_t count )
+{
+  /* a window already maps only what is read */
+  if ( not file_.windowed() ) {
+    file_.narrow( first * frame_length_, count * frame_length_ );
+  }
+}
+
+FrameView RawFrameSource::frame( const uint64_t frame_no )
+{
+  return FrameView::packed( file_( frame_no * frame_length_, frame_length_ ).buffer(), format_, width_, height_ );
+}
+
+TiledFrameSource::TiledFrameSource( const string & filename, const unsigned int width, const unsigned int height,
+                                    const unsigned int threads )
+  : reader_( filename ),
+    buffer_( size_t( width ) * height ),
+    threads_( threads )
+{
+  if ( reader_.layout().width() != width or reader_.layout().height() != height ) {
+    throw runtime_error( filename + ": tiled video is " + to_string( reader_.layout().width() )
+                         + "x" + to_string( reader_.layout().height() ) );
+  }
+
+  for ( const auto & region : Barcode::regions( width, height ) ) {
+    for ( const unsigned int tile : reader_.layout().tiles_covering( region.x, region.y,
+                                                                     region.width, region.height ) ) {
+      if ( find( barcode_tiles_.begin(), barcode_tiles_.end(), tile ) == barcode_tiles_.end() ) {
+        barcode_tiles_.push_back( tile );
+      }
+    }
+  }
+}
+
+FrameView TiledFrameSource::frame( const uint64_t frame_no )
+{
+  reader_.decode_tiles( frame_no, barcode_tiles_, &buffer_.front().blue, threads_ );
+  return FrameView::packed( &buffer_.front().blue, PixelFormat::BGRX,
+                            reader_.layout().width(), reader_.layout().height() );
+}
+
+StripFrameSource::StripFrameSource( const string & filename, const PixelFormat format,
+                                    const unsigned int width, const unsigned int height )
+  : file_( filename ),
+    layout_( StripLayout::read_header( file_ ) ),
+    buffer_( size_t( width ) * height * layout_.bytes_per_pixel() )
+{
+  if ( layout_.width() != width or layout_.height() != height or layout_.format() != format ) {
+    throw runtime_error( filename + ": strip file is of " + to_string( layout_.width() ) + "x"
+                         + to_string( layout_.height() ) + " " + pixel_format_name( layout_.format() )
+                         + " frames" );
+  }
+
+  if ( ( file_.size() - layout_.header_length() ) % layout_.frame_length() ) {
+    throw runtime_error( "strip file size is not a whole number of frames" );
+  }
+}
+
+uint64_t StripFrameSource::frame_count() const
+{
+  return ( file_.size() - layout_.header_length() ) / layout_.frame_length();
+}
+
+FrameView StripFrameSource::frame( const uint64_t frame_no )
+{
+  const size_t stride = size_t( layout_.width() ) * layout_.bytes_per_pixel();
+  const MutableFrameView view { layout_.format(), layout_.width(), layout_.height(),
+                                { buffer_.data(), nullptr, nullptr }, { stride, 0, 0 } };
+
+  layout_.restore( file_( layout_.header_length() + frame_no * layout_.frame_length(), layout_.frame_length() ),
+                   view );
+
+  return { view.format, view.width, view.height, { buffer_.data(), nullptr, nullptr }, { stride, 0, 0 } };
+}
+
+/* reads are whole blocks of this size, at offsets that are multiples of it */
+static const size_t io_alignment = 4096;
+
+static size_t align_down( const size_t value ) { return value / io_alignment * io_alignment; }
+static size_t align_up( const size_t value ) { return align_down( value + io_alignment - 1 ); }
+
+UringFrameSource::UringFrameSource( const string & filename, const PixelFormat format,
+                                    const unsigned int width, const unsigned int height,
+                                    const UringOptions & options )
+  : fd_( SystemCall( filename, open( filename.c_str(), O_RDONLY | O_CLOEXEC | ( options.direct ? O_DIRECT : 0 ) ) ) ),
+    format_( format ),
+    width_( width ),
+    height_( height ),
+    frame_length_( ::frame_length( format, width, height ) ),
+    frame_count_( fd_.size() / frame_length_ ),
+    slot_length_( align_up( frame_length_ ) + 2 * io_alignment ),
+    slots_( max( 1u, options.queue_depth ) ),
+    buffer_( slot_length_ * slots_.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1 ),
+    ring_( slots_.size() * max<size_t>( 1, options.regions.size() ) ),
+    end_( frame_count_ )
+{
+  if ( fd_.size() % frame_length_ ) {
+    throw runtime_error( "file size is not multiple of frame size" );
+  }
+
+  /* the rows of the first plane under each region, merged where they meet */
+  const size_t stride = format == PixelFormat::BGRX ? size_t( width ) * 4 : width;
+  for ( const auto & region : options.regions ) {
+    extents_.emplace_back( region.y * stride, ( region.y + region.height ) * stride );
+  }
+  if ( extents_.empty() ) {
+    extents_.emplace_back( 0, frame_length_ );
+  }
+  sort( extents_.begin(), extents_.end() );
+  vector<pair<size_t, size_t>> merged;
+  for ( const auto & extent : extents_ ) {
+    if ( not merged.empty() and extent.first <= merged.back().second ) {
+      merged.back().second = max( merged.back().second, extent.second );
+    } else {
+      merged.push_back( extent );
+    }
+  }
+  extents_ = move( merged );
+
+  ring_.register_buffer( buffer_.addr(), buffer_.length() );
+}
+
+UringFrameSource::~UringFrameSource()
+{
+  /* the kernel may still be writing into the buffer */
+  try {
+    while ( any_of( slots_.begin(), slots_.end(), []( const Slot & slot ) { return slot.outstanding; } ) ) {
+      complete_one();
+    }
+  } catch ( const exception & e ) {
+    print_exception( "UringFrameSource", e );
+  }
+}
+
+/* where a frame starts in its slot, so that the aligned blocks around it fit */
+uint8_t * UringFrameSource::slot_frame( const uint64_t frame_no ) const
+{
+  const uint64_t frame_start = frame_no * frame_length_;
+  return buffer_.addr() + ( frame_no % slots_.size() ) * slot_length_ + ( frame_start - align_down( frame_start ) );
+}
+
+void UringFrameSource::queue_frame( const uint64_t frame_no )
+{
+  const size_t slot = frame_no % slots_.size();
+  slots_[ slot ] = { frame_no, unsigned( extents_.size() ) };
+
+  const uint64_t frame_start = frame_no * frame_length_;
+  uint8_t * const frame = slot_frame( frame_no );
+
+  for ( size_t i = 0; i < extents_.size(); i++ ) {
+    const uint64_t first = align_down( frame_start + extents_[ i ].first );
+    const uint64_t last = align_up( frame_start + extents_[ i ].second );
+    if ( not ring_.read( fd_.fd_num(), frame - ( frame_start - first ), last - first, first,
+                         slot * extents_.size() + i ) ) {
+      throw runtime_error( "UringFrameSource: submission queue full" );
+    }
+  }
+}
+
+void UringFrameSource::complete_one()
+{
+  IoUring::Completion completion;
+  while ( not ring_.reap( completion ) ) {
+    ring_.submit( 1 );
+  }
+
+  Slot & slot = slots_[ completion.user_data / extents_.size() ];
+  const pair<size_t, size_t> & extent = extents_[ completion.user_data % extents_.size() ];
+  slot.outstanding--;
+
+  if ( completion.result < 0 ) {
+    throw unix_error( "io_uring read", -completion.result );
+  }
+
+  /* a short read (the file shrank, or was read to its very end) must
+     still cover the rows asked for */
+  const uint64_t frame_start = slot.frame_no * frame_length_;
+  const uint64_t needed = frame_start + extent.second - align_down( frame_start + extent.first );
+  if ( uint64_t( completion.result ) < needed ) {
+    throw runtime_error( "UringFrameSource: short read of frame " + to_string( slot.frame_no ) );
+  }
+}
+
+void UringFrameSource::restrict_to( const uint64_t first, const uint64_t count )
+{
+  if ( next_to_queue_ != next_expected_ ) {
+    throw runtime_error( "UringFrameSource: restricted after reading began" );
+  }
+
+  next_to_queue_ = next_expected_ = first;
+  end_ = min( first + count, frame_count_ );
+}
+
+FrameView UringFrameSource::frame( const uint64_t frame_no )
+{
+  if ( frame_no >= end_ ) {
+    throw out_of_range( "frame " + to_string( frame_no ) + " is past the end" );
+  }
+
+  if ( frame_no != next_expected_ ) {
+    /* out of order: let everything in flight land, then start over here */
+    while ( any_of( slots_.begin(), slots_.end(), []( const Slot & slot ) { return slot.outstanding; } ) ) {
+      complete_one();
+    }
+    next_to_queue_ = frame_no;
+  }
+
+  /* keep the queue full; the slots of frames before this one are free */
+  while ( next_to_queue_ < min( frame_no + slots_.size(), end_ ) ) {
+    queue_frame( next_to_queue_++ );
+  }
+  ring_.submit();
+
+  while ( slots_[ frame_no % slots_.size() ].outstanding ) {
+    complete_one();
+  }
+
+  next_expected_ = frame_no + 1;
+  return FrameView::packed( slot_frame( frame_no ), format_, width_, height_ );
+}
+
+FrameRange FrameRange::parse_shard( const string & in )
+{
+  FrameRange range;
+  const size_t slash = in.find( '/' );
+  size_t index_end = 0, shards_end = 0;
+  try {
+    if ( slash != string::npos ) {
+      range.shard = stoul( in.substr( 0, slash ), &index_end );
+      range.shards = stoul( in.substr( slash + 1 ), &shards_end );
+    }
+  } catch ( const logic_error & ) {
+    range.shards = 0;
+  }
+
+  if ( slash == string::npos or index_end != slash or shards_end != in.size() - slash - 1
+       or range.shards == 0 or range.shard >= range.shards ) {
+    throw runtime_error( "invalid shard (expected I/N, with 0 <= I < N): " + in );
+  }
+
+  return range;
+}
+
+FrameRange::Resolved FrameRange::resolve( const uint64_t total ) const
+{
+  if ( shards ) {
+    /* unsigned __int128 would be needed past 2^32 frames of 2^32 shards */
+    return { total * shard / shards, total * ( shard + 1 ) / shards, total, shard, shards };
+  }
+
+  if ( start > total or ( count and *count > total - start ) ) {
+    throw out_of_range( "frames " + to_string( start ) + " to "
+                        + ( count ? to_string( start + *count ) : string( "the end" ) )
+                        + " are not all in a capture of " + to_string( total ) + " frames" );
+  }
+
+  return { start, count ? start + *count : total, total, 0, 0 };
+}
+
+string FrameRange::Resolved::describe() const
+{
+  string ret = "# Range: first=" + to_string( first ) + " count=" + to_string( count() )
+    + " total=" + to_string( total );
+  if ( shards ) {
+    ret += " shard=" + to_string( shard ) + "/" + to_string( shards );
+  }
+  return ret;
+}
+
+optional<FrameRange::Resolved> FrameRange::Resolved::parse( const string & line )
+{
+  unsigned long long first, count, total;
+  unsigned int shard = 0, shards = 0;
+  int consumed = 0;
+  if ( sscanf( line.c_str(), "# Range: first=%llu count=%llu total=%llu%n",
+               &first, &count, &total, &consumed ) != 3 ) {
+    return {};
+  }
+
+  const string rest = line.substr( consumed );
+  if ( not rest.empty() and sscanf( rest.c_str(), " shard=%u/%u", &shard, &shards ) != 2 ) {
+    return {};
+  }
+
+  if ( first + count > total ) {
+    return {};
+  }
+
+  return Resolved { first, first + count, total, shard, shards };
+}
+
+unique_ptr<FrameSource> open_frame_source( const string & filename, const PixelFormat format,
+                                           const unsigned int width, const unsigned int height,
+                                           const MMap_Region::Options & options,
+                                           const size_t window_length )
+{
+  FileDescriptor sniff { SystemCall( filename, open( filename.c_str(), O_RDONLY ) ) };
+  const string prefix = sniff.size() ? sniff.read( 8 ) : string();
+
+  if ( TiledVideoReader::is_tiled_video( prefix ) ) {
+    if ( format != PixelFormat::BGRX ) {
+      throw runtime_error( filename + ": tiled videos hold BGRX frames" );
+    }
+    return make_unique<TiledFrameSource>( filename, width, height );
+  }
+
+  if ( StripLayout::is_strip_file( prefix ) ) {
+    return make_unique<StripFrameSource>( filename, format, width, height );
+  }
+
+  return make_unique<RawFrameSource>( filename, format, width, height, options, window_length );
+}
+
+unique_ptr<FrameSource> open_frame_source( const string & filename, const PixelFormat format,
+                                           const unsigned int width, const unsigned int height,
+                                           const UringOptions & options )
+{
+  FileDescriptor sniff { SystemCall( filename, open( filename.c_str(), O_RDONLY ) ) };
+  const string prefix = sniff.size() ? sniff.read( 8 ) : string();
+
+  if ( TiledVideoReader::is_tiled_video( prefix ) or StripLayout::is_strip_file( prefix ) ) {
+    return open_frame_source( filename, format, width, height );
+  }
+
+  if ( not IoUring::available() ) {
+    throw runtime_error( "io_uring is not available (see /proc/sys/kernel/io_uring_disabled)" );
+  }
+
+  return make_unique<UringFrameSource>( filename, format, width, height, options );
+}
@@ -0,0 +1,186 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FRAME_SOURCE_HH
+#define FRAME_SOURCE_HH
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "file.hh"
+#include "io_uring.hh"
+#include "tiled_video.hh"
+#include "frame_view.hh"
+#include "strip_file.hh"
+
+/* frames for the barcode tools to decode, whatever the container */
+
+class FrameSource
+{
+public:
+  virtual ~FrameSource() {}
+
+  virtual uint64_t frame_count() const = 0;
+
+  /* only frames [first, first + count) will be read; a source may map
+     or fetch less, and refuse frames past the end */
+  virtual void restrict_to( const uint64_t, const uint64_t ) {}
+
+  /* a frame in which at least the barcode regions are filled in;
+     valid until the next call */
+  virtual FrameView frame( const uint64_t frame_no ) = 0;
+};
+
+/* headerless frames, read where they lie in a mapping */
+class RawFrameSource : public FrameSource
+{
+private:
+  File file_;
+  PixelFormat format_;
+  unsigned int width_, height_;
+  size_t frame_length_;
+
+public:
+  RawFrameSource( const std::string & filename, const PixelFormat format,
+                  const unsigned int width, const unsigned int height,
+                  const MMap_Region::Options & options = {}, const size_t window_length = 0 );
+
+  uint64_t frame_count() const override { return file_.size() / frame_length_; }
+  void restrict_to( const uint64_t first, const uint64_t count ) override;
+  FrameView frame( const uint64_t frame_no ) override;
+};
+
+/* a tiled video, of which only the tiles under the barcodes are decoded */
+class TiledFrameSource : public FrameSource
+{
+private:
+  TiledVideoReader reader_;
+  std::vector<unsigned int> barcode_tiles_ {};
+  std::vector<RGBPixel> buffer_;
+  unsigned int threads_;
+
+public:
+  TiledFrameSource( const std::string & filename, const unsigned int width, const unsigned int height,
+                    const unsigned int threads = 1 );
+
+  uint64_t frame_count() const override { return reader_.frame_count(); }
+  FrameView frame( const uint64_t frame_no ) override;
+};
+
+/* a strip file (see strip_file.hh), with each frame's regions put back
+   in place on an otherwise blank first plane; the other planes of a YUV
+   frame are left out */
+class StripFrameSource : public FrameSource
+{
+private:
+  File file_;
+  StripLayout layout_;
+  std::vector<uint8_t> buffer_;
+
+public:
+  StripFrameSource( const std::string & filename, const PixelFormat format,
+                    const unsigned int width, const unsigned int height );
+
+  uint64_t frame_count() const override;
+  FrameView frame( const uint64_t frame_no ) override;
+};
+
+/* headerless frames read ahead with io_uring into registered buffers,
+   queue_depth frames at a time, and handed out in order
+
+   Only the rows holding the regions are read (all of each frame if
+   there are none), in whole 4 KiB blocks so that O_DIRECT can bypass
+   the page cache. Reading frames out of order works, but drains the
+   queue each time. */
+struct UringOptions
+{
+  unsigned int queue_depth = 16;
+  bool direct = false;
+  std::vector<Barcode::Region> regions {};
+};
+
+class UringFrameSource : public FrameSource
+{
+private:
+  struct Slot
+  {
+    uint64_t frame_no { 0 };
+    unsigned int outstanding { 0 };
+  };
+
+  FileDescriptor fd_;
+  PixelFormat format_;
+  unsigned int width_, height_;
+  size_t frame_length_;
+  uint64_t frame_count_;
+
+  /* byte ranges of a frame to read */
+  std::vector<std::pair<size_t, size_t>> extents_ {};
+
+  size_t slot_length_;
+  std::vector<Slot> slots_;
+  MMap_Region buffer_;
+  IoUring ring_;
+
+  uint64_t next_to_queue_ { 0 }, next_expected_ { 0 };
+  uint64_t end_;
+
+  uint8_t * slot_frame( const uint64_t frame_no ) const;
+  void queue_frame( const uint64_t frame_no );
+  void complete_one();
+
+public:
+  UringFrameSource( const std::string & filename, const PixelFormat format,
+                    const unsigned int width, const unsigned int height,
+                    const UringOptions & options );
+  ~UringFrameSource();
+
+  uint64_t frame_count() const override { return frame_count_; }
+  void restrict_to( const uint64_t first, const uint64_t count ) override;
+  FrameView frame( const uint64_t frame_no ) override;
+};
+
+/* which frames of a capture a tool works on: count frames from start
+   (to the end if no count), or shard index of shards, the shards being
+   runs of consecutive frames, as equal as can be, that together cover
+   the capture once. Tools log the resolved range, which is how
+   barcode-merge stitches sharded logs back together. */
+struct FrameRange
+{
+  uint64_t start = 0;
+  std::optional<uint64_t> count {};
+  unsigned int shard = 0, shards = 0; /* shards = 0: not sharded */
+
+  /* "I/N", with I counting from 0 */
+  static FrameRange parse_shard( const std::string & in );
+
+  struct Resolved
+  {
+    uint64_t first, end, total;
+    unsigned int shard, shards;
+
+    uint64_t count() const { return end - first; }
+
+    /* "# Range: first=F count=C total=T[ shard=I/N]" */
+    std::string describe() const;
+    static std::optional<Resolved> parse( const std::string & line );
+  };
+
+  /* within a capture of total frames; throws if the range runs past it */
+  Resolved resolve( const uint64_t total ) const;
+};
+
+/* pick the source that matches the file's contents */
+std::unique_ptr<FrameSource> open_frame_source( const std::string & filename, const PixelFormat format,
+                                                const unsigned int width, const unsigned int height,
+                                                const MMap_Region::Options & options = {},
+                                                const size_t window_length = 0 );
+
+/* the same, but with io_uring for headerless frames (tiled videos and
+   strip files, which are small, are still mapped) */
+std::unique_ptr<FrameSource> open_frame_source( const std::string & filename, const PixelFormat format,
+                                                const unsigned int width, const unsigned int height,
+                                                const UringOptions & options );
+
+#endif /* FRAME_SOURCE_HH */
@@ -0,0 +1,145 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cstring>
+#include <endian.h>
+
+#include "strip_file.hh"
+#include "exception.hh"
+
+using namespace std;
+
+static const string file_magic = "CEOSTRIP";
+
+static void put_le32( string & str, const uint32_t value )
+{
+  const uint32_t le = htole32( value );
+  str.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+}
+
+StripLayout::StripLayout( const PixelFormat format, const unsigned int width, const unsigned int height,
+                          const vector<Barcode::Region> & regions )
+  : format_( format ), width_( width ), height_( height ), regions_( regions )
+{
+  if ( regions_.empty() ) {
+    throw Invalid( "strip file with no regions" );
+  }
+
+  /* in 64 bits, so that a corrupt header can't wrap around */
+  for ( const auto & region : regions_ ) {
+    if ( region.width == 0 or region.height == 0
+         or uint64_t( region.x ) + region.width > width_ or uint64_t( region.y ) + region.height > height_ ) {
+      throw Invalid( "strip region outside the frame" );
+    }
+  }
+}
+
+StripLayout StripLayout::for_barcodes( const PixelFormat format, const unsigned int width, const unsigned int height,
+                                       const unsigned int margin, const unsigned int stripes )
+{
+  vector<Barcode::Region> regions = Barcode::regions( width, height );
+  if ( stripes ) {
+    const vector<Barcode::Region> stripe_regions = Barcode::stripeRegions( width, height, stripes );
+    regions.insert( regions.end(), stripe_regions.begin(), stripe_regions.end() );
+  }
+
+  for ( auto & region : regions ) {
+    const unsigned int left = min( region.x, margin ), top = min( region.y, margin );
+    const unsigned int right = min( width - region.x - region.width, margin );
+    const unsigned int bottom = min( height - region.y - region.height, margin );
+    region = { region.x - left, region.y - top, region.width + left + right, region.height + top + bottom };
+  }
+
+  return { format, width, height, regions };
+}
+
+bool StripLayout::is_strip_file( const Chunk & prefix )
+{
+  return prefix.size() >= file_magic.size()
+    and prefix( 0, file_magic.size() ).to_string() == file_magic;
+}
+
+StripLayout StripLayout::read_header( const File & file )
+{
+  const size_t fixed_length = file_magic.size() + 16;
+  if ( file.size() < fixed_length or not is_strip_file( file( 0, fixed_length ) ) ) {
+    throw Invalid( "not a strip file" );
+  }
+
+  const Chunk header = file( file_magic.size(), 16 );
+  const uint32_t format = header( 8, 4 ).le32();
+  const uint32_t region_count = header( 12, 4 ).le32();
+  if ( format > static_cast<uint32_t>( PixelFormat::NV12 ) ) {
+    throw Unsupported( "strip file with pixel format " + to_string( format ) );
+  }
+  if ( file.size() < fixed_length + 16 * uint64_t( region_count ) ) {
+    throw Invalid( "strip file header is truncated" );
+  }
+
+  vector<Barcode::Region> regions;
+  for ( uint32_t i = 0; i < region_count; i++ ) {
+    const Chunk region = file( fixed_length + 16 * i, 16 );
+    regions.push_back( { unsigned( region( 0, 4 ).le32() ), unsigned( region( 4, 4 ).le32() ),
+                         unsigned( region( 8, 4 ).le32() ), unsigned( region( 12, 4 ).le32() ) } );
+  }
+
+  return { static_cast<PixelFormat>( format ), unsigned( header( 0, 4 ).le32() ),
+           unsigned( header( 4, 4 ).le32() ), regions };
+}
+
+size_t StripLayout::header_length() const
+{
+  return file_magic.size() + 16 + 16 * regions_.size();
+}
+
+size_t StripLayout::frame_length() const
+{
+  size_t length = 0;
+  for ( const auto & region : regions_ ) {
+    length += size_t( region.width ) * region.height * bytes_per_pixel();
+  }
+  return length;
+}
+
+string StripLayout::header() const
+{
+  string header = file_magic;
+  put_le32( header, width_ );
+  put_le32( header, height_ );
+  put_le32( header, static_cast<uint32_t>( format_ ) );
+  put_le32( header, regions_.size() );
+  for ( const auto & region : regions_ ) {
+    put_le32( header, region.x );
+    put_le32( header, region.y );
+    put_le32( header, region.width );
+    put_le32( header, region.height );
+  }
+  return header;
+}
+
+void StripLayout::extract( const FrameView & frame, string & out ) const
+{
+  for ( const auto & region : regions_ ) {
+    for ( unsigned int y = region.y; y < region.y + region.height; y++ ) {
+      out.append( reinterpret_cast<const char *>( frame.planes[ 0 ] + y * frame.strides[ 0 ]
+                                                  + region.x * bytes_per_pixel() ),
+                  region.width * bytes_per_pixel() );
+    }
+  }
+}
+
+void StripLayout::restore( const Chunk & strip, const MutableFrameView & frame ) const
+{
+  if ( strip.size() != frame_length() ) {
+    throw Invalid( "strip frame has the wrong length" );
+  }
+
+  const uint8_t * source = strip.buffer();
+  for ( const auto & region : regions_ ) {
+    const size_t row_length = region.width * bytes_per_pixel();
+    for ( unsigned int y = region.y; y < region.y + region.height; y++ ) {
+      memcpy( frame.planes[ 0 ] + y * frame.strides[ 0 ] + region.x * bytes_per_pixel(), source, row_length );
+      source += row_length;
+    }
+  }
+}
@@ -0,0 +1,63 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef STRIP_FILE_HH
+#define STRIP_FILE_HH
+
+/* the barcode regions of each frame of a capture, cut out into a file
+   of their own (see barcode-extract)
+
+   file:   header | frame 0 | frame 1 | ...
+   header: "CEOSTRIP", then le32 width, height, pixel format (0 BGRX,
+           1 I420, 2 NV12) and region count, then le32 x, y, width and
+           height of each region
+   frame:  the rows of each region in turn, from the first plane only
+           (4 bytes per pixel for BGRX, 1 byte of luma for YUV), which is
+           all the barcode reader looks at */
+
+#include <string>
+#include <vector>
+
+#include "barcode.hh"
+#include "chunk.hh"
+#include "file.hh"
+#include "frame_view.hh"
+
+class StripLayout
+{
+private:
+  PixelFormat format_;
+  unsigned int width_, height_;
+  std::vector<Barcode::Region> regions_;
+
+public:
+  StripLayout( const PixelFormat format, const unsigned int width, const unsigned int height,
+               const std::vector<Barcode::Region> & regions );
+
+  /* the barcode regions (and stripes, if any) of a frame, each grown by
+     margin pixels on every side but kept inside the frame */
+  static StripLayout for_barcodes( const PixelFormat format, const unsigned int width, const unsigned int height,
+                                   const unsigned int margin, const unsigned int stripes = 0 );
+
+  static bool is_strip_file( const Chunk & prefix );
+  static StripLayout read_header( const File & file );
+
+  PixelFormat format() const { return format_; }
+  unsigned int width() const { return width_; }
+  unsigned int height() const { return height_; }
+  const std::vector<Barcode::Region> & regions() const { return regions_; }
+
+  unsigned int bytes_per_pixel() const { return format_ == PixelFormat::BGRX ? 4 : 1; }
+  size_t header_length() const;
+  size_t frame_length() const;
+
+  std::string header() const;
+
+  /* append a frame's regions to out */
+  void extract( const FrameView & frame, std::string & out ) const;
+
+  /* copy a frame's regions back where they came from in the first plane
+     of frame, which must be width x height */
+  void restore( const Chunk & strip, const MutableFrameView & frame ) const;
+};
+
+#endif /* STRIP_FILE_HH */
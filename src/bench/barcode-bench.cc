@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include <getopt.h>
+#include <sys/utsname.h>
+
+#include "barcode.hh"
+#include "colorspace.hh"
+#include "display.hh"
+#include "file.hh"
+
+using namespace std;
+
+unsigned int paranoid_atoi( const string & in )
+{
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [options]\n\n"
+       << "\t--output FILE      write the JSON report to FILE instead of stdout\n"
+       << "\t--filter TEXT      only run benchmarks whose name contains TEXT\n"
+       << "\t--iterations N     time at most N iterations of each benchmark (default 1000)\n"
+       << "\t--min-time MS      keep iterating for at least MS milliseconds (default 500)\n"
+       << "\t--tmpdir DIR       where to put scratch files (default $TMPDIR or /tmp)\n\n"
+       << "\tA human-readable summary is written to stderr.\n\n";
+}
+
+struct Resolution
+{
+  string name;
+  unsigned int width, height;
+};
+
+struct Settings
+{
+  unsigned int max_iterations { 1000 };
+  chrono::milliseconds min_time { 500 };
+  string filter {};
+};
+
+struct Result
+{
+  string name {};
+  Resolution resolution {};
+  size_t bytes_per_iteration {};
+  vector<uint64_t> samples {}; /* ns per iteration, sorted */
+
+  uint64_t percentile( const double p ) const
+  {
+    return samples.at( min( samples.size() - 1, size_t( p / 100.0 * samples.size() ) ) );
+  }
+
+  double mean() const
+  {
+    double total = 0;
+    for ( const uint64_t sample : samples ) {
+      total += sample;
+    }
+    return total / samples.size();
+  }
+
+  double gigabytes_per_second() const { return bytes_per_iteration / mean(); }
+};
+
+/* a scratch file that is removed when it goes out of scope */
+class ScratchFile
+{
+private:
+  string name_;
+  FileDescriptor fd_;
+
+  static FileDescriptor make( string & name )
+  {
+    vector<char> buffer( name.begin(), name.end() );
+    buffer.push_back( 0 );
+    FileDescriptor fd { SystemCall( "mkstemp", mkstemp( buffer.data() ) ) };
+    name = buffer.data();
+    return fd;
+  }
+
+public:
+  ScratchFile( const string & directory )
+    : name_( directory + "/barcode-bench.XXXXXX" ), fd_( make( name_ ) )
+  {}
+
+  ~ScratchFile() { unlink( name_.c_str() ); }
+
+  const string & name() const { return name_; }
+  FileDescriptor & fd() { return fd_; }
+
+  /* disallow copying */
+  ScratchFile( const ScratchFile & other ) = delete;
+  ScratchFile & operator=( const ScratchFile & other ) = delete;
+};
+
+/* run setup() untimed and then iteration() timed, until both the time
+   budget and a minimum sample count are met or max_iterations is hit */
+Result measure( const Settings & settings, const string & name, const Resolution & resolution,
+                const size_t bytes_per_iteration,
+                const function<void()> & iteration,
+                const function<void()> & setup = [] {} )
+{
+  static const unsigned int warmup_iterations = 3, min_samples = 10;
+
+  for ( unsigned int i = 0; i < warmup_iterations; i++ ) {
+    setup();
+    iteration();
+  }
+
+  Result result;
+  result.name = name;
+  result.resolution = resolution;
+  result.bytes_per_iteration = bytes_per_iteration;
+
+  const auto start = chrono::steady_clock::now();
+  while ( result.samples.size() < settings.max_iterations
+          and ( result.samples.size() < min_samples
+                or chrono::steady_clock::now() - start < settings.min_time ) ) {
+    setup();
+    const auto before = chrono::steady_clock::now();
+    iteration();
+    const auto after = chrono::steady_clock::now();
+    result.samples.push_back( chrono::duration_cast<chrono::nanoseconds>( after - before ).count() );
+  }
+
+  sort( result.samples.begin(), result.samples.end() );
+  return result;
+}
+
+/* keep the optimizer from discarding a computed value */
+volatile uint64_t sink;
+
+vector<Result> run_benchmarks( const Settings & settings, const string & tmpdir )
+{
+  const vector<Resolution> resolutions = { { "720p", 1280, 720 },
+                                           { "1080p", 1920, 1080 },
+                                           { "2160p", 3840, 2160 } };
+  vector<Result> results;
+  mt19937 prng( 0 );
+
+  for ( const Resolution & resolution : resolutions ) {
+    const unsigned int width = resolution.width, height = resolution.height;
+    const size_t frame_bytes = frame_length( PixelFormat::BGRX, width, height );
+
+    /* a synthetic frame of noise with barcodes in it */
+    vector<uint8_t> frame( frame_bytes );
+    generate( frame.begin(), frame.end(), [&] { return uint8_t( prng() ); } );
+    RGBPixel * pixels = reinterpret_cast<RGBPixel *>( frame.data() );
+    Barcode::writeBarcodes( pixels, width, height, 0x0123456789abcdef );
+
+    size_t barcode_bytes = 0;
+    for ( const Barcode::Region & region : Barcode::regions( width, height ) ) {
+      barcode_bytes += region.width * region.height * sizeof( RGBPixel );
+    }
+
+    auto wanted = [&]( const string & name ) {
+      return ( name + "/" + resolution.name ).find( settings.filter ) != string::npos;
+    };
+
+    auto run = [&]( const string & name, const size_t bytes, const function<void()> & iteration,
+                    const function<void()> & setup = [] {} ) {
+      if ( wanted( name ) ) {
+        results.push_back( measure( settings, name, resolution, bytes, iteration, setup ) );
+      }
+    };
+
+    run( "readBarcodes", barcode_bytes, [&] {
+        sink = Barcode::readBarcodes( pixels, width, height ).first;
+      } );
+
+    const FrameView pixels_view = FrameView::packed( &pixels->blue, PixelFormat::BGRX, width, height );
+    run( "readBarcodes/sampled", barcode_bytes, [&] {
+        sink = Barcode::readBarcodes( pixels_view, { 2, 64 } ).first;
+      } );
+
+    uint64_t barcode = 0;
+    run( "writeBarcodes", barcode_bytes, [&] {
+        Barcode::writeBarcodes( pixels, width, height, barcode++ );
+      } );
+
+    run( "XImage", frame_bytes, [&] {
+        XImage image { Chunk( frame ), width, height };
+        sink = image.data()[ 0 ];
+      } );
+
+    vector<uint8_t> yuv( frame_length( PixelFormat::I420, width, height ) );
+    const FrameView bgrx_view = FrameView::packed( frame.data(), PixelFormat::BGRX, width, height );
+    const MutableFrameView yuv_view = MutableFrameView::packed( yuv.data(), PixelFormat::I420, width, height );
+    run( "convert_frame", frame_bytes, [&] {
+        convert_frame( bgrx_view, yuv_view );
+      } );
+
+    if ( wanted( "File" ) or wanted( "FileDescriptor::write" ) ) {
+      ScratchFile scratch { tmpdir };
+
+      run( "FileDescriptor::write", frame_bytes,
+           [&] { scratch.fd().write( Chunk( frame ) ); },
+           [&] { SystemCall( "lseek", lseek( scratch.fd().fd_num(), 0, SEEK_SET ) ); } );
+
+      /* map the (page-cached) file and touch every page */
+      run( "File", frame_bytes, [&] {
+          const File file { scratch.name() };
+          const Chunk contents = file.chunk();
+          uint64_t total = 0;
+          for ( size_t offset = 0; offset < contents.size(); offset += 4096 ) {
+            total += contents.buffer()[ offset ];
+          }
+          sink = total;
+        } );
+    }
+  }
+
+  return results;
+}
+
+string json_escape( const string & str )
+{
+  string ret;
+  for ( const char c : str ) {
+    if ( c == '"' or c == '\\' ) {
+      ret += '\\';
+    }
+    ret += c;
+  }
+  return ret;
+}
+
+void write_json( ostream & out, const vector<Result> & results )
+{
+  utsname system;
+  SystemCall( "uname", uname( &system ) );
+
+  out << "{\n"
+      << "  \"build\": {\n"
+      << "    \"compiler\": \"" << json_escape( __VERSION__ ) << "\",\n"
+      << "    \"host\": \"" << json_escape( system.nodename ) << "\",\n"
+      << "    \"kernel\": \"" << json_escape( system.release ) << "\",\n"
+      << "    \"avx2\": " << ( color_kernel_available( ColorKernel::AVX2 ) ? "true" : "false" ) << "\n"
+      << "  },\n"
+      << "  \"results\": [";
+
+  for ( size_t i = 0; i < results.size(); i++ ) {
+    const Result & r = results[ i ];
+    out << ( i ? "," : "" ) << "\n    {"
+        << " \"name\": \"" << json_escape( r.name ) << "\","
+        << " \"resolution\": \"" << r.resolution.name << "\","
+        << " \"width\": " << r.resolution.width << ","
+        << " \"height\": " << r.resolution.height << ","
+        << " \"iterations\": " << r.samples.size() << ","
+        << " \"bytes\": " << r.bytes_per_iteration << ","
+        << fixed << setprecision( 1 )
+        << " \"ns_per_frame\": " << r.mean() << ","
+        << " \"min_ns\": " << r.samples.front() << ","
+        << " \"p50_ns\": " << r.percentile( 50 ) << ","
+        << " \"p90_ns\": " << r.percentile( 90 ) << ","
+        << " \"p99_ns\": " << r.percentile( 99 ) << ","
+        << " \"max_ns\": " << r.samples.back() << ","
+        << setprecision( 3 )
+        << " \"gb_per_s\": " << r.gigabytes_per_second()
+        << " }";
+  }
+
+  out << "\n  ]\n}\n";
+}
+
+void write_summary( ostream & out, const vector<Result> & results )
+{
+  out << left << setw( 24 ) << "# benchmark" << setw( 8 ) << "size"
+      << right << setw( 14 ) << "ns/frame" << setw( 12 ) << "p50" << setw( 12 ) << "p99"
+      << setw( 10 ) << "GB/s" << "\n";
+
+  for ( const Result & r : results ) {
+    out << left << setw( 24 ) << r.name << setw( 8 ) << r.resolution.name
+        << right << fixed << setprecision( 0 ) << setw( 14 ) << r.mean()
+        << setw( 12 ) << r.percentile( 50 ) << setw( 12 ) << r.percentile( 99 )
+        << setprecision( 2 ) << setw( 10 ) << r.gigabytes_per_second() << "\n";
+  }
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    Settings settings;
+    string output_filename;
+    string tmpdir = getenv( "TMPDIR" ) ? getenv( "TMPDIR" ) : "/tmp";
+
+    const option command_line_options[] = {
+      { "output",     required_argument, nullptr, 'o' },
+      { "filter",     required_argument, nullptr, 'f' },
+      { "iterations", required_argument, nullptr, 'n' },
+      { "min-time",   required_argument, nullptr, 't' },
+      { "tmpdir",     required_argument, nullptr, 'd' },
+      { nullptr,      0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "o:f:n:t:d:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'o': output_filename = optarg; break;
+      case 'f': settings.filter = optarg; break;
+      case 'n': settings.max_iterations = max( 1u, paranoid_atoi( optarg ) ); break;
+      case 't': settings.min_time = chrono::milliseconds( paranoid_atoi( optarg ) ); break;
+      case 'd': tmpdir = optarg; break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( optind != argc ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    const vector<Result> results = run_benchmarks( settings, tmpdir );
+
+    write_summary( cerr, results );
+
+    if ( output_filename.empty() ) {
+      write_json( cout, results );
+    } else {
+      ofstream output { output_filename };
+      write_json( output, results );
+      if ( not output.good() ) {
+        throw runtime_error( "could not write " + output_filename );
+      }
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,3 +1,6 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
@@ -6,10 +9,18 @@
 #include <xcb/present.h>
 
 #include "display.hh"
+#include "changed_span.hh"
 #include "chunk.hh"
+#include "stats.hh"
 
 using namespace std;
 
+static Stats::Probe image_copy_probe { "display.image_copy" };
+static Stats::Probe put_image_probe { "display.put_image" };
+static Stats::Probe present_probe { "display.present" };
+static Stats::Probe check_probe { "display.check" };
+static Stats::Probe put_bytes_probe { "display.put_bytes", Stats::Unit::Bytes };
+
 template <typename T>
 inline T * notnull( const string & context, T * const x )
 {
@@ -22,36 +33,111 @@ struct free_deleter
   void operator() ( T * x ) const { free( x ); }
 };
 
-void XCBObject::check_noreply( const string & context, const xcb_void_cookie_t & cookie )
+static atomic<XCBObject::ErrorChecking> error_checking_mode {
+  getenv( "CAPTAIN_EO_XCB_BATCHED" ) ? XCBObject::ErrorChecking::Batched : XCBObject::ErrorChecking::Strict };
+
+static const size_t max_pending_checks = 256;
+
+void XCBObject::set_error_checking( const ErrorChecking mode )
+{
+  error_checking_mode = mode;
+}
+
+XCBObject::ErrorChecking XCBObject::error_checking()
 {
-  unique_ptr<xcb_generic_error_t, free_deleter> error { xcb_request_check( connection_.get(), cookie ) };
+  return error_checking_mode;
+}
+
+static void check_cookie( xcb_connection_t * connection, const char * context, const xcb_void_cookie_t & cookie )
+{
+  unique_ptr<xcb_generic_error_t, free_deleter> error { xcb_request_check( connection, cookie ) };
   if ( error ) {
-    throw runtime_error( context + ": returned error " + to_string( error->error_code ) );
+    throw runtime_error( string( context ) + ": returned error " + to_string( error->error_code ) );
+  }
+}
+
+void XCBObject::check_noreply( const char * context, const xcb_void_cookie_t & cookie )
+{
+  if ( error_checking() == ErrorChecking::Strict ) {
+    check_cookie( connection_.get(), context, cookie );
+    return;
+  }
+
+  pending_->cookies.emplace_back( context, cookie );
+  if ( pending_->cookies.size() >= max_pending_checks ) {
+    check_pending();
+  }
+}
+
+void XCBObject::check_pending()
+{
+  const Stats::ScopedTimer timer { check_probe };
+
+  /* take the whole batch first, so that an error leaves none behind */
+  vector<pair<const char *, xcb_void_cookie_t>> cookies;
+  swap( cookies, pending_->cookies );
+
+  for ( size_t i = 0; i < cookies.size(); i++ ) {
+    try {
+      check_cookie( connection_.get(), cookies[ i ].first, cookies[ i ].second );
+    } catch ( ... ) {
+      for ( size_t j = i + 1; j < cookies.size(); j++ ) {
+        xcb_discard_reply( connection_.get(), cookies[ j ].second.sequence );
+      }
+      throw;
+    }
+  }
+}
+
+XCBObject::PendingChecks::~PendingChecks()
+{
+  for ( const auto & cookie : cookies ) {
+    xcb_discard_reply( connection.get(), cookie.second.sequence );
   }
 }
 
 const xcb_screen_t * XCBObject::default_screen() const
 {
-  return notnull( "xcb_setup_roots_iterator",
-		  xcb_setup_roots_iterator( notnull( "xcb_get_setup",
-						     xcb_get_setup( connection_.get() ) ) ).data );  
+  xcb_screen_iterator_t screen = xcb_setup_roots_iterator( notnull( "xcb_get_setup",
+								    xcb_get_setup( connection_.get() ) ) );
+  for ( int i = 0; i < screen_number_ and screen.rem; i++ ) {
+    xcb_screen_next( &screen );
+  }
+
+  return notnull( "xcb_setup_roots_iterator", screen.data );
 }
 
 XCBObject::XCBObject()
-  : connection_( notnull( "xcb_connect", xcb_connect( nullptr, nullptr ) ),
-		 [] ( xcb_connection_t * connection ) { xcb_disconnect( connection ); } )
+  : XCBObject( "" )
 {}
 
+XCBObject::XCBObject( const string & display_name )
+  : screen_number_( 0 ),
+    connection_( notnull( "xcb_connect", xcb_connect( display_name.empty() ? nullptr : display_name.c_str(),
+						      &screen_number_ ) ),
+		 [] ( xcb_connection_t * connection ) { xcb_disconnect( connection ); } ),
+    pending_( make_shared<PendingChecks>( connection_ ) )
+{
+  if ( xcb_connection_has_error( connection_.get() ) ) {
+    throw runtime_error( "xcb_connect: could not connect to display "
+			 + ( display_name.empty() ? string( "$DISPLAY" ) : display_name ) );
+  }
+}
+
 XCBObject::XCBObject( XCBObject & original )
-  : connection_( original.connection() )
+  : screen_number_( original.screen_number_ ),
+    connection_( original.connection() ),
+    pending_( original.pending_ )
 {}
 
 
 XCBObject::XCBObject( XCBObject && original )
-  : connection_( move( original.connection_ ) )
+  : screen_number_( original.screen_number_ ),
+    connection_( move( original.connection_ ) ),
+    pending_( move( original.pending_ ) )
 {}
 
-XWindow::XWindow( const unsigned int width, const unsigned int height )
+void XWindow::create( const unsigned int width, const unsigned int height )
 {
   const auto screen = default_screen();
 
@@ -80,39 +166,28 @@ XWindow::XWindow( const unsigned int width, const unsigned int height )
 						   XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY ) );
 }
 
+XWindow::XWindow( const unsigned int width, const unsigned int height )
+{
+  create( width, height );
+}
+
 XWindow::XWindow( const unsigned int width, const unsigned int height, 
                   const std::string &name ) 
 {
-  const auto screen = default_screen();
-
-  check_noreply( "xcb_create_window_checked",
-     xcb_create_window_checked( connection().get(),
-              XCB_COPY_FROM_PARENT,
-              window_,
-              screen->root,
-              0, 0, /* top-left corner of the window */
-              width, height,
-              0, /* border size */
-              XCB_WINDOW_CLASS_INPUT_OUTPUT,
-              screen->root_visual,
-              0, nullptr ) ); /* value_mask, value_list */
-
-  check_noreply( "xcb_present_select_input_checked",
-     xcb_present_select_input_checked( connection().get(),
-               complete_event_,
-               window_,
-               XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY ) );
-
-  check_noreply( "xcb_present_select_input_checked",
-     xcb_present_select_input_checked( connection().get(),
-               idle_event_,
-               window_,
-               XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY ) );
-
+  create( width, height );
   set_name(name);
   map();
 }
 
+XWindow::XWindow( const string & display_name, const unsigned int width, const unsigned int height,
+                  const string & name )
+  : XCBObject( display_name )
+{
+  create( width, height );
+  set_name( name );
+  map();
+}
+
 
 void XWindow::map() {
   check_noreply( "xcb_map_window_checked",
@@ -228,19 +303,26 @@ XPixmap::~XPixmap()
 
 void XWindow::present( const XPixmap & pixmap, const unsigned int divisor, const unsigned int remainder )
 {
+  const Stats::ScopedTimer timer { present_probe };
+
   while ( not complete_ ) {
     event_loop();
   }
 
-  check_noreply( "xcb_present_pixmap_checked",
-		 xcb_present_pixmap_checked( connection().get(),
+  /* in batched mode, an error comes back in the event stream
+     instead, since the wait below would otherwise never end */
+  const auto present_pixmap = error_checking() == ErrorChecking::Strict
+    ? xcb_present_pixmap_checked : xcb_present_pixmap;
+
+  check_noreply( "xcb_present_pixmap",
+		 present_pixmap( connection().get(),
 					     window_,
 					     pixmap.xcb_pixmap(),
 					     0, /* serial */
 					     0, /* valid */
 					     0, /* update */
 					     0, 0, /* offsets */
-					     0, /* target_crtc */
+					     target_crtc_, /* target_crtc */
 					     0, /* wait_fence */
 					     0, /* idle_fence */
 					     0, /* options */
@@ -256,14 +338,23 @@ void XWindow::present( const XPixmap & pixmap, const unsigned int divisor, const
   while ( not idle_ ) {
     event_loop();
   }
+
+  /* the server has handled everything sent before the present, so
+     checking it is free */
+  check_pending();
 }
 
 void XWindow::event_loop()
 {
-  xcb_generic_event_t * event = notnull( "xcb_wait_for_event",
-					 xcb_wait_for_event( connection().get() ) );
-  if ( event->response_type == XCB_GE_GENERIC ) {
-    const uint16_t event_type = reinterpret_cast<xcb_ge_generic_event_t *>( event )->event_type;
+  unique_ptr<xcb_generic_event_t, free_deleter> event { notnull( "xcb_wait_for_event",
+								xcb_wait_for_event( connection().get() ) ) };
+  if ( event->response_type == 0 ) {
+    const auto error = reinterpret_cast<const xcb_generic_error_t *>( event.get() );
+    throw runtime_error( "X request " + to_string( error->sequence ) + " (opcode "
+			 + to_string( error->major_code ) + "." + to_string( error->minor_code )
+			 + "): returned error " + to_string( error->error_code ) );
+  } else if ( event->response_type == XCB_GE_GENERIC ) {
+    const uint16_t event_type = reinterpret_cast<xcb_ge_generic_event_t *>( event.get() )->event_type;
     if ( event_type == (complete_event_ & 0xffff) ) {
       complete_ = true;
     } else if ( event_type == (idle_event_ & 0xffff) ) {
@@ -276,40 +367,123 @@ void XWindow::event_loop()
   }
 }
 
+XImage::XImage( const unsigned int width, const unsigned int height )
+  : width_( width ),
+    height_( height ),
+    buffer_( FramePool::global().acquire( size_t( width_ ) * height_ * sizeof( RGBPixel ) ) )
+{
+  /* a recycled buffer holds the last image's pixels */
+  memset( buffer_.data(), 0, buffer_.size() );
+}
+
 XImage::XImage( XPixmap & pixmap )
-  : width_( pixmap.size().first ),
-    height_( pixmap.size().second ),
-    image_( width_ * height_ )
+  : XImage( pixmap.size().first, pixmap.size().second )
 {}
 
 XImage::XImage( const Chunk & image, const unsigned int width, const unsigned int height )
   : width_( width ),
     height_( height ),
-    image_()
+    buffer_()
 {
-  if ( image.size() != width * height * sizeof( RGBPixel ) ) {
+  if ( image.size() != size_t( width ) * height * sizeof( RGBPixel ) ) {
     throw runtime_error( "XImage: invalid chunk size" );
   }
 
-  image_.resize( width * height );
-  memcpy( image_.data(), image.buffer(), image.size() );
+  const Stats::ScopedTimer timer { image_copy_probe };
+  buffer_ = FramePool::global().acquire( image.size() );
+  memcpy( buffer_.data(), image.buffer(), image.size() );
 }
 
-void XPixmap::put( const XImage & image, const GraphicsContext & gc )
+void XPixmap::put_rectangle( const XImage & image, const GraphicsContext & gc,
+                             const unsigned int x, const unsigned int y,
+                             const unsigned int width, const unsigned int height )
 {
+  const size_t image_stride = image.width() * sizeof( RGBPixel );
+  const size_t rectangle_stride = width * sizeof( RGBPixel );
+  const uint8_t * rectangle = image.data() + y * image_stride + x * sizeof( RGBPixel );
+
+  /* a rectangle narrower than the image is sent as rows of its own width */
+  if ( width != image.width() ) {
+    staging_.resize( rectangle_stride * height );
+    for ( unsigned int row = 0; row < height; row++ ) {
+      memcpy( staging_.data() + row * rectangle_stride, rectangle + row * image_stride, rectangle_stride );
+    }
+    rectangle = staging_.data();
+  }
+
   check_noreply( "xcb_put_image_checked",
 		 xcb_put_image_checked( connection().get(),
 					XCB_IMAGE_FORMAT_Z_PIXMAP,
 					xcb_pixmap(),
 					gc.xcb_gc(),
-					image.width(),
-					image.height(),
-					0,
-					0,
+					width,
+					height,
+					x,
+					y,
 					0,
 					24,
-					image.width() * image.height() * sizeof( RGBPixel ),
-					image.data() ) );
+					rectangle_stride * height,
+					rectangle ) );
+
+  if ( Stats::enabled() ) {
+    Stats::record( put_bytes_probe, rectangle_stride * height );
+  }
+
+  if ( track_damage_ ) {
+    for ( unsigned int row = 0; row < height; row++ ) {
+      memcpy( shadow_.data() + ( y + row ) * image_stride + x * sizeof( RGBPixel ),
+              rectangle + row * rectangle_stride, rectangle_stride );
+    }
+  }
+}
+
+void XPixmap::put( const XImage & image, const GraphicsContext & gc )
+{
+  const Stats::ScopedTimer timer { put_image_probe };
+
+  const size_t image_stride = image.width() * sizeof( RGBPixel );
+  const size_t image_length = image_stride * image.height();
+
+  if ( not track_damage_ or shadow_.size() != image_length ) {
+    if ( track_damage_ ) {
+      shadow_ = FramePool::global().acquire( image_length );
+    }
+    put_rectangle( image, gc, 0, 0, image.width(), image.height() );
+    return;
+  }
+
+  /* send each run of changed rows as one rectangle, as wide as the
+     widest change in it */
+  unsigned int band_start = 0, band_rows = 0;
+  size_t band_left = 0, band_right = 0;
+
+  for ( unsigned int row = 0; row <= image.height(); row++ ) {
+    const auto span = row < image.height()
+      ? changed_span( shadow_.data() + row * image_stride, image.data() + row * image_stride, image.width() )
+      : make_pair( size_t( 0 ), size_t( 0 ) );
+
+    if ( span.first != span.second ) {
+      if ( band_rows == 0 ) {
+        band_start = row;
+        band_left = span.first;
+        band_right = span.second;
+      }
+      band_left = min( band_left, span.first );
+      band_right = max( band_right, span.second );
+      band_rows++;
+    } else if ( band_rows ) {
+      put_rectangle( image, gc, band_left, band_start, band_right - band_left, band_rows );
+      band_rows = 0;
+    }
+  }
+}
+
+void XPixmap::set_damage_tracking( const bool track_damage )
+{
+  track_damage_ = track_damage;
+  if ( not track_damage_ ) {
+    shadow_ = {};
+  }
 }
 
 const RGBPixel & XImage::pixel( const unsigned int column, const unsigned int row ) const
@@ -318,7 +492,7 @@ const RGBPixel & XImage::pixel( const unsigned int column, const unsigned int ro
     throw out_of_range( "attempted access to pixel outside image" );
   }
 
-  return image_.at( row * width() + column );
+  return pixels()[ row * width() + column ];
 }
 
 RGBPixel & XImage::pixel( const unsigned int column, const unsigned int row ) 
@@ -327,7 +501,7 @@ RGBPixel & XImage::pixel( const unsigned int column, const unsigned int row )
     throw out_of_range( "attempted access to pixel outside image" );
   }
 
-  return image_.at( row * width() + column );
+  return pixels()[ row * width() + column ];
 }
 
 GraphicsContext::GraphicsContext( XPixmap & pixmap )
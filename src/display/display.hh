@@ -4,26 +4,65 @@
 #include <xcb/xcb.h>
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "chunk.hh"
-
+#include "frame_pool.hh"
+#include "frame_view.hh"
+
+/* Requests that have no reply are sent "checked", and their errors
+   collected in one of two ways. In strict mode (the default), each one
+   waits for the server to confirm it, which costs a round trip per
+   request. In batched mode, the cookies are queued and checked together:
+   after each present, once 256 are waiting, or on check_pending(). By
+   then the server has usually answered something later, and the checks
+   cost no round trips at all; otherwise, one for the whole batch. An
+   error is reported by whichever of these calls finds it, so it may
+   surface well after the request that caused it. Set
+   CAPTAIN_EO_XCB_BATCHED in the environment to start in batched mode. */
 class XCBObject
 {
 public:
   typedef std::shared_ptr<xcb_connection_t> connection_type;
+  enum class ErrorChecking { Strict, Batched };
+
   XCBObject();
+  /* connect to a display like ":1.1" (an empty name means $DISPLAY); the
+     screen named there becomes the default screen */
+  XCBObject( const std::string & display_name );
   XCBObject( XCBObject & original );
   XCBObject( XCBObject && original );
   virtual ~XCBObject() {}
 
   xcb_connection_t * xcb_connection() { return connection_.get(); }
 
+  static void set_error_checking( const ErrorChecking mode );
+  static ErrorChecking error_checking();
+
+  /* check every request still waiting to be checked on this connection */
+  void check_pending();
+
 private:
+  /* requests sent but not yet checked, shared by all objects on a connection */
+  struct PendingChecks
+  {
+    connection_type connection;
+    std::vector<std::pair<const char *, xcb_void_cookie_t>> cookies {};
+
+    PendingChecks( const connection_type & connection ) : connection( connection ) {}
+    ~PendingChecks();
+
+    PendingChecks( const PendingChecks & other ) = delete;
+    PendingChecks & operator=( const PendingChecks & other ) = delete;
+  };
+
+  int screen_number_;
   connection_type connection_;
+  std::shared_ptr<PendingChecks> pending_;
 
 protected:
-  void check_noreply( const std::string & context, const xcb_void_cookie_t & cookie );
+  void check_noreply( const char * context, const xcb_void_cookie_t & cookie );
   const xcb_screen_t * default_screen() const;
   const connection_type & connection() const { return connection_; }
 };
@@ -37,12 +76,17 @@ private:
   uint32_t complete_event_ = xcb_generate_id( connection().get() );
   uint32_t idle_event_ = xcb_generate_id( connection().get() );
   bool complete_ = true, idle_ = true;
+  uint32_t target_crtc_ = 0;
 
+  void create( const unsigned int width, const unsigned int height );
   void event_loop();
 
 public:
   XWindow( const unsigned int width, const unsigned int height );
   XWindow( const unsigned int width, const unsigned int height, const std::string &name);
+  /* a named, mapped window on its own connection to the given display */
+  XWindow( const std::string & display_name, const unsigned int width, const unsigned int height,
+           const std::string & name );
 
   ~XWindow();
 
@@ -52,6 +96,9 @@ public:
   /* map the window on the screen */
   void map();
 
+  /* present on a particular CRTC (0, the default, lets the server pick) */
+  void set_target_crtc( const uint32_t crtc ) { target_crtc_ = crtc; }
+
   /* present a pixmap */
   void present( const XPixmap & pixmap, const unsigned int divisor, const unsigned int remainder );
 
@@ -93,6 +140,15 @@ private:
   xcb_visualtype_t * visual_;
   std::pair<unsigned int, unsigned int> size_;
 
+  /* what the pixmap holds, for finding what the next image changes */
+  bool track_damage_ = true;
+  FramePool::Buffer shadow_ {};
+  std::vector<uint8_t> staging_ {};
+
+  void put_rectangle( const XImage & image, const GraphicsContext & gc,
+                      const unsigned int x, const unsigned int y,
+                      const unsigned int width, const unsigned int height );
+
 public:
   XPixmap( XWindow & window );
   ~XPixmap();
@@ -106,35 +162,39 @@ public:
   /* get the pixmap's size */
   std::pair<unsigned int, unsigned int> size() const { return size_; }
 
-  /* put an image on the pixmap */
+  /* put an image on the pixmap; unless damage tracking is off, only the
+     rectangles of rows that differ from the last image put are sent */
   void put( const XImage & image, const GraphicsContext & gc );
 
+  /* on by default; turning it off drops the copy kept for comparing */
+  void set_damage_tracking( const bool track_damage );
+
   /* prevent copying */
   XPixmap( const XPixmap & other ) = delete;
   XPixmap & operator=( const XPixmap & other ) = delete;
 };
 
-struct RGBPixel
-{
-  uint8_t blue, green, red, xxx;
-};
-
+/* pixels borrowed from FramePool::global(), returned when the image is destroyed */
 class XImage
 {
 private:
   unsigned int width_, height_;
-  std::vector<RGBPixel> image_;
+  FramePool::Buffer buffer_;
+
+  RGBPixel * pixels() const { return reinterpret_cast<RGBPixel *>( buffer_.data() ); }
 
 public:
+  /* zeroed, for drawing on */
+  XImage( const unsigned int width, const unsigned int height );
   XImage( XPixmap & pixmap );
   XImage( const Chunk & image, const unsigned int width, const unsigned int height );
 
   const RGBPixel & pixel( const unsigned int column, const unsigned int row ) const;
   RGBPixel & pixel( const unsigned int column, const unsigned int row );
-  const uint8_t * data() const { return &image_.at( 0 ).blue; }
-  uint8_t * data_unsafe() { return &image_.at( 0 ).blue; }
+  const uint8_t * data() const { return buffer_.data(); }
+  uint8_t * data_unsafe() { return buffer_.data(); }
 
-  Chunk chunk() const { return Chunk( data(), image_.size() * sizeof( RGBPixel ) ); }
+  Chunk chunk() const { return Chunk( data(), size_t( width_ ) * height_ * sizeof( RGBPixel ) ); }
 
   unsigned int width() const { return width_; }
   unsigned int height() const { return height_; }
@@ -0,0 +1,65 @@
+#include <stdexcept>
+
+#include "display_backend.hh"
+#include "offscreen_display.hh"
+
+using namespace std;
+
+static unsigned int parse_number( const string & in, const string & what )
+{
+  size_t end = 0;
+  unsigned long ret = 0;
+  try {
+    ret = stoul( in, &end );
+  } catch ( const exception & ) {
+    end = 0;
+  }
+  if ( in.empty() or end != in.size() or ret > 0xffffffff or in[ 0 ] == '-' or in[ 0 ] == '+' ) {
+    throw runtime_error( "invalid " + what + ": " + in );
+  }
+  return ret;
+}
+
+unique_ptr<DisplayBackend> open_display( const string & spec, const unsigned int width, const unsigned int height,
+                                         const string & title )
+{
+  const string offscreen = "offscreen";
+  if ( spec.compare( 0, offscreen.size(), offscreen ) == 0
+       and ( spec.size() == offscreen.size() or spec[ offscreen.size() ] == ':' ) ) {
+    OffscreenDisplay::Options options;
+    if ( spec.size() > offscreen.size() ) {
+      const string rest = spec.substr( offscreen.size() + 1 );
+      const size_t colon = rest.find( ':' );
+      options.refresh_hz = parse_number( rest.substr( 0, colon ), "refresh rate" );
+      if ( colon != string::npos ) {
+        options.dump_filename = rest.substr( colon + 1 );
+      }
+    }
+    return make_unique<OffscreenDisplay>( width, height, options );
+  }
+
+  const size_t at = spec.find( '@' );
+  const uint32_t crtc = at == string::npos ? 0 : parse_number( spec.substr( at + 1 ), "CRTC" );
+  return make_unique<XCBDisplay>( spec.substr( 0, at ), width, height, title, crtc );
+}
+
+XCBDisplay::XCBDisplay( const string & display_name, const unsigned int width, const unsigned int height,
+                        const string & title, const uint32_t crtc )
+  : display_name_( display_name ),
+    crtc_( crtc ),
+    window_( display_name, width, height, title ),
+    pixmap_( window_ ),
+    gc_( pixmap_ )
+{
+  window_.set_target_crtc( crtc );
+}
+
+void XCBDisplay::present( const unsigned int divisor, const unsigned int remainder )
+{
+  window_.present( pixmap_, divisor, remainder );
+}
+
+string XCBDisplay::description() const
+{
+  return ( display_name_.empty() ? "$DISPLAY" : display_name_ ) + ( crtc_ ? "@" + to_string( crtc_ ) : "" );
+}
@@ -0,0 +1,64 @@
+#ifndef DISPLAY_BACKEND_HH
+#define DISPLAY_BACKEND_HH
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "display.hh"
+
+/* somewhere to show frames: a window on an X server, or an offscreen
+   surface (see offscreen_display.hh) for running and timing the same
+   loops with no server at all */
+class DisplayBackend
+{
+public:
+  virtual ~DisplayBackend() {}
+
+  virtual std::pair<unsigned int, unsigned int> size() const = 0;
+
+  /* copy an image into the buffer being drawn */
+  virtual void put( const XImage & image ) = 0;
+
+  /* show that buffer at the next vblank whose count is remainder modulo
+     divisor (the very next one if divisor is 0), once the previous
+     present has been shown */
+  virtual void present( const unsigned int divisor, const unsigned int remainder ) = 0;
+
+  virtual void flush() = 0;
+
+  /* for logs, e.g. ":1.1@63" or "offscreen:60" */
+  virtual std::string description() const = 0;
+};
+
+/* "offscreen[:HZ[:FILE]]" for an OffscreenDisplay, otherwise an X display
+   name (empty for $DISPLAY) with an optional "@CRTC" to present on */
+std::unique_ptr<DisplayBackend> open_display( const std::string & spec,
+                                              const unsigned int width, const unsigned int height,
+                                              const std::string & title );
+
+/* a named, mapped window with a pixmap to draw into */
+class XCBDisplay : public DisplayBackend
+{
+private:
+  std::string display_name_;
+  uint32_t crtc_;
+  XWindow window_;
+  XPixmap pixmap_;
+  GraphicsContext gc_;
+
+public:
+  XCBDisplay( const std::string & display_name, const unsigned int width, const unsigned int height,
+              const std::string & title, const uint32_t crtc = 0 );
+
+  std::pair<unsigned int, unsigned int> size() const override { return pixmap_.size(); }
+  void put( const XImage & image ) override { pixmap_.put( image, gc_ ); }
+  void present( const unsigned int divisor, const unsigned int remainder ) override;
+  void flush() override { window_.flush(); }
+  std::string description() const override;
+
+  XWindow & window() { return window_; }
+  XPixmap & pixmap() { return pixmap_; }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "offscreen_display.hh"
+#include "exception.hh"
+#include "stats.hh"
+
+using namespace std;
+
+static Stats::Probe offscreen_put_probe { "offscreen.put" };
+static Stats::Probe offscreen_present_probe { "offscreen.present" };
+
+static const size_t page_length = 4096;
+
+static uint64_t monotonic_ns()
+{
+  timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return uint64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until( const uint64_t deadline_ns )
+{
+  const timespec deadline { time_t( deadline_ns / 1000000000 ), long( deadline_ns % 1000000000 ) };
+  while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr ) == EINTR ) {}
+}
+
+static int make_buffers( const size_t length )
+{
+  const int fd = SystemCall( "memfd_create", memfd_create( "offscreen-display", MFD_CLOEXEC ) );
+  if ( ftruncate( fd, length ) < 0 ) {
+    const unix_error error( "ftruncate" );
+    close( fd );
+    throw error;
+  }
+  return fd;
+}
+
+/* refuse an empty display before any buffer is made for it */
+static size_t checked_frame_length( const unsigned int width, const unsigned int height )
+{
+  if ( width == 0 or height == 0 ) {
+    throw runtime_error( "OffscreenDisplay: empty display" );
+  }
+  return size_t( width ) * height * sizeof( RGBPixel );
+}
+
+OffscreenDisplay::OffscreenDisplay( const unsigned int width, const unsigned int height, const Options & options )
+  : width_( width ),
+    height_( height ),
+    refresh_hz_( options.refresh_hz ),
+    frame_length_( checked_frame_length( width, height ) ),
+    buffer_stride_( ( frame_length_ + page_length - 1 ) / page_length * page_length ),
+    memory_fd_( make_buffers( 2 * buffer_stride_ ) ),
+    memory_( 2 * buffer_stride_, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd_.fd_num() ),
+    period_ns_( refresh_hz_ ? 1000000000 / refresh_hz_ : 0 ),
+    epoch_ns_( monotonic_ns() )
+{
+  if ( not options.dump_filename.empty() ) {
+    dump_ = make_unique<DirectWriter>( options.dump_filename );
+  }
+}
+
+OffscreenDisplay::OffscreenDisplay( const unsigned int width, const unsigned int height )
+  : OffscreenDisplay( width, height, Options() )
+{}
+
+void OffscreenDisplay::put( const XImage & image )
+{
+  if ( image.width() != width_ or image.height() != height_ ) {
+    throw runtime_error( "OffscreenDisplay: image size does not match the display" );
+  }
+
+  const Stats::ScopedTimer timer { offscreen_put_probe };
+  memcpy( back_buffer(), image.data(), frame_length_ );
+}
+
+void OffscreenDisplay::present( const unsigned int divisor, const unsigned int remainder )
+{
+  const Stats::ScopedTimer timer { offscreen_present_probe };
+
+  /* like XWindow::present(), wait for the last present to complete */
+  if ( flip_ns_ ) {
+    sleep_until( flip_ns_ );
+  }
+
+  if ( period_ns_ ) {
+    /* the first vblank from now that matches */
+    uint64_t target = ( monotonic_ns() - epoch_ns_ ) / period_ns_ + 1;
+    if ( divisor ) {
+      target += ( remainder % divisor + divisor - target % divisor ) % divisor;
+    } else if ( presented_ and target > msc_ + 1 ) {
+      missed_vblanks_ += target - msc_ - 1;
+    }
+    msc_ = target;
+    flip_ns_ = epoch_ns_ + target * period_ns_;
+  } else {
+    msc_++;
+  }
+
+  back_ = 1 - back_;
+  presented_++;
+
+  if ( dump_ ) {
+    dump_->write( Chunk( front_buffer(), frame_length_ ) );
+  }
+}
+
+string OffscreenDisplay::description() const
+{
+  return "offscreen:" + to_string( refresh_hz_ );
+}
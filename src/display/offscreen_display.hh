@@ -0,0 +1,72 @@
+#ifndef OFFSCREEN_DISPLAY_HH
+#define OFFSCREEN_DISPLAY_HH
+
+#include <memory>
+#include <string>
+
+#include "direct_writer.hh"
+#include "display_backend.hh"
+#include "file_descriptor.hh"
+#include "mmap_region.hh"
+
+/* a display with no server: two BGRX buffers in a memfd, flipped on a
+   simulated vblank. put() costs one copy into the back buffer, as the
+   XCB path costs one copy to the server, and present() keeps the same
+   pace as a window's: it first waits for the previous present to reach
+   its vblank. A refresh rate of 0 flips at once, for timing the render
+   and present loop alone. Each presented frame can also be appended to
+   a raw file, written from a background thread (see DirectWriter). */
+class OffscreenDisplay : public DisplayBackend
+{
+public:
+  struct Options
+  {
+    unsigned int refresh_hz { 60 };
+    std::string dump_filename {}; /* empty for none */
+  };
+
+private:
+  unsigned int width_, height_;
+  unsigned int refresh_hz_;
+  size_t frame_length_, buffer_stride_;
+  FileDescriptor memory_fd_;
+  MMap_Region memory_;
+  unsigned int back_ { 0 };
+
+  uint64_t period_ns_, epoch_ns_;
+  uint64_t flip_ns_ { 0 }; /* when the last present reaches the screen */
+  uint64_t msc_ { 0 };     /* the vblank it is shown at */
+  uint64_t presented_ { 0 }, missed_vblanks_ { 0 };
+
+  std::unique_ptr<DirectWriter> dump_ {};
+
+  uint8_t * buffer( const unsigned int index ) const { return memory_.addr() + index * buffer_stride_; }
+
+public:
+  OffscreenDisplay( const unsigned int width, const unsigned int height, const Options & options );
+  OffscreenDisplay( const unsigned int width, const unsigned int height );
+
+  std::pair<unsigned int, unsigned int> size() const override { return { width_, height_ }; }
+  void put( const XImage & image ) override;
+  void present( const unsigned int divisor, const unsigned int remainder ) override;
+  void flush() override {}
+  std::string description() const override;
+
+  /* the buffer being drawn, and the one last presented */
+  uint8_t * back_buffer() const { return buffer( back_ ); }
+  const uint8_t * front_buffer() const { return buffer( 1 - back_ ); }
+
+  /* the memfd holding both buffers, for sharing with another process */
+  const FileDescriptor & memory_fd() const { return memory_fd_; }
+
+  uint64_t presented() const { return presented_; }
+  uint64_t msc() const { return msc_; }
+  /* vblanks that went by with nothing new to show, between presents
+     that asked for the next one */
+  uint64_t missed_vblanks() const { return missed_vblanks_; }
+
+  OffscreenDisplay( const OffscreenDisplay & other ) = delete;
+  OffscreenDisplay & operator=( const OffscreenDisplay & other ) = delete;
+};
+
+#endif
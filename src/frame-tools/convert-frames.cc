@@ -0,0 +1,142 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <getopt.h>
+
+#include "colorspace.hh"
+#include "file.hh"
+
+using namespace std;
+
+unsigned int paranoid_atoi( const string & in )
+{
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [options] WIDTH HEIGHT [INPUT]\n\n"
+       << "\t--from FORMAT     input format: bgra (default), i420 or nv12\n"
+       << "\t--to FORMAT       output format: bgra, i420 (default) or nv12\n"
+       << "\t--matrix MATRIX   bt601 (default) or bt709\n"
+       << "\t--range RANGE     limited (default) or full\n"
+       << "\t--threads N       convert each frame with N threads\n"
+       << "\t--scalar          use the reference implementation\n\n"
+       << "\tReads headerless frames from INPUT (or stdin if INPUT is absent or \"-\")\n"
+       << "\tand writes the converted frames to stdout.\n\n";
+}
+
+/* read one frame from a pipe, returning false at a clean end of input */
+bool read_frame( FileDescriptor & input, vector<uint8_t> & frame )
+{
+  size_t filled = 0;
+
+  while ( filled < frame.size() ) {
+    const string data = input.read( frame.size() - filled );
+    if ( input.eof() ) {
+      if ( filled == 0 ) {
+        return false;
+      }
+      throw runtime_error( "input ended in the middle of a frame" );
+    }
+    memcpy( frame.data() + filled, data.data(), data.size() );
+    filled += data.size();
+  }
+
+  return true;
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    PixelFormat from = PixelFormat::BGRX, to = PixelFormat::I420;
+    ColorSpace color_space;
+    unsigned int threads = 1;
+    ColorKernel kernel = ColorKernel::Auto;
+
+    const option command_line_options[] = {
+      { "from",    required_argument, nullptr, 'f' },
+      { "to",      required_argument, nullptr, 't' },
+      { "matrix",  required_argument, nullptr, 'm' },
+      { "range",   required_argument, nullptr, 'r' },
+      { "threads", required_argument, nullptr, 'j' },
+      { "scalar",  no_argument,       nullptr, 's' },
+      { nullptr,   0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "f:t:m:r:j:s", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'f': from = parse_pixel_format( optarg ); break;
+      case 't': to = parse_pixel_format( optarg ); break;
+      case 'm': color_space.matrix = parse_color_matrix( optarg ); break;
+      case 'r': color_space.range = parse_color_range( optarg ); break;
+      case 'j': threads = paranoid_atoi( optarg ); break;
+      case 's': kernel = ColorKernel::Scalar; break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( argc - optind != 2 and argc - optind != 3 ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    const unsigned int width = paranoid_atoi( argv[ optind ] );
+    const unsigned int height = paranoid_atoi( argv[ optind + 1 ] );
+    const string input_name = argc - optind == 3 ? argv[ optind + 2 ] : "-";
+
+    vector<uint8_t> input_frame( frame_length( from, width, height ) );
+    vector<uint8_t> output_frame( frame_length( to, width, height ) );
+    const MutableFrameView output_view = MutableFrameView::packed( output_frame.data(), to, width, height );
+
+    FileDescriptor stdout { STDOUT_FILENO };
+
+    auto convert_one = [&]( const uint8_t * data ) {
+      convert_frame( FrameView::packed( data, from, width, height ), output_view,
+                     color_space, threads, kernel );
+      stdout.write( Chunk( output_frame ) );
+    };
+
+    if ( input_name == "-" ) {
+      FileDescriptor stdin { STDIN_FILENO };
+      while ( read_frame( stdin, input_frame ) ) {
+        convert_one( input_frame.data() );
+      }
+    } else {
+      MMap_Region::Options map_options;
+      map_options.access = MMap_Region::Access::Sequential;
+      File input { input_name, map_options };
+
+      if ( input.size() % input_frame.size() ) {
+        throw runtime_error( "file size is not multiple of frame size" );
+      }
+
+      for ( uint64_t offset = 0; offset < input.size(); offset += input_frame.size() ) {
+        convert_one( input( offset, input_frame.size() ).buffer() );
+      }
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
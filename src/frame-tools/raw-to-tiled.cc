@@ -0,0 +1,119 @@
+#include <cstdlib>
+#include <iostream>
+
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "file.hh"
+#include "tiled_video.hh"
+
+using namespace std;
+
+unsigned int paranoid_atoi( const string & in )
+{
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [options] INPUT WIDTH HEIGHT OUTPUT\n\n"
+       << "\t--tile WxH       tile size in pixels (default 128x128)\n"
+       << "\t--codec CODEC    lz4, zstd or none (default: lz4 if available)\n"
+       << "\t--level N        compression level (zstd only)\n"
+       << "\t--threads N      compress tiles on N threads\n\n"
+       << "\tConverts headerless BGRX frames to a tiled video. OUTPUT may be - for stdout.\n\n";
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    unsigned int tile_width = 128, tile_height = 128;
+    TileCodec codec = tile_codec_available( TileCodec::LZ4 ) ? TileCodec::LZ4
+      : tile_codec_available( TileCodec::Zstd ) ? TileCodec::Zstd : TileCodec::None;
+    int level = 0;
+    unsigned int threads = 1;
+
+    const option command_line_options[] = {
+      { "tile",    required_argument, nullptr, 't' },
+      { "codec",   required_argument, nullptr, 'c' },
+      { "level",   required_argument, nullptr, 'l' },
+      { "threads", required_argument, nullptr, 'j' },
+      { nullptr,   0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "t:c:l:j:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 't':
+        {
+          const string size = optarg;
+          const size_t x = size.find( 'x' );
+          if ( x == string::npos ) {
+            throw runtime_error( "invalid tile size: " + size );
+          }
+          tile_width = paranoid_atoi( size.substr( 0, x ) );
+          tile_height = paranoid_atoi( size.substr( x + 1 ) );
+        }
+        break;
+      case 'c': codec = parse_tile_codec( optarg ); break;
+      case 'l': level = paranoid_atoi( optarg ); break;
+      case 'j': threads = paranoid_atoi( optarg ); break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( argc - optind != 4 ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    MMap_Region::Options map_options;
+    map_options.access = MMap_Region::Access::Sequential;
+    File input { argv[ optind ], map_options };
+    const unsigned int width = paranoid_atoi( argv[ optind + 1 ] );
+    const unsigned int height = paranoid_atoi( argv[ optind + 2 ] );
+    const string output_filename = argv[ optind + 3 ];
+
+    const size_t frame_length = size_t( width ) * height * 4;
+    if ( input.size() % frame_length ) {
+      throw runtime_error( "file size is not multiple of frame size" );
+    }
+
+    FileDescriptor output { output_filename == "-" ? STDOUT_FILENO
+        : SystemCall( output_filename, open( output_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) };
+
+    TiledVideoWriter writer { move( output ), TileLayout( width, height, tile_width, tile_height ),
+                              codec, level, threads };
+
+    for ( uint64_t offset = 0; offset < input.size(); offset += frame_length ) {
+      writer.write_frame( input( offset, frame_length ) );
+      input.release( offset, frame_length );
+    }
+
+    writer.finish();
+
+    cerr << "Wrote " << writer.frame_count() << " frames (" << tile_codec_name( codec ) << "), "
+         << input.size() << " -> " << writer.bytes_written() << " bytes.\n";
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
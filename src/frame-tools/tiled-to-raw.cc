@@ -0,0 +1,75 @@
+#include <cstdlib>
+#include <iostream>
+
+#include <getopt.h>
+
+#include "tiled_video.hh"
+
+using namespace std;
+
+unsigned int paranoid_atoi( const string & in )
+{
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+void usage( const char * argv0 )
+{
+  cerr << "Usage: " << argv0 << " [--threads N] INPUT\n\n"
+       << "\tWrites the frames of a tiled video to stdout as headerless BGRX frames.\n\n";
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    unsigned int threads = 1;
+
+    const option command_line_options[] = {
+      { "threads", required_argument, nullptr, 'j' },
+      { nullptr,   0,                 nullptr, 0 }
+    };
+
+    while ( true ) {
+      const int opt = getopt_long( argc, argv, "j:", command_line_options, nullptr );
+
+      if ( opt == -1 ) {
+        break;
+      }
+
+      switch ( opt ) {
+      case 'j': threads = paranoid_atoi( optarg ); break;
+      default:
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+      }
+    }
+
+    if ( argc - optind != 1 ) {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+
+    TiledVideoReader input { argv[ optind ] };
+    vector<uint8_t> frame( input.frame_length() );
+
+    FileDescriptor stdout { STDOUT_FILENO };
+
+    for ( uint64_t frame_no = 0; frame_no < input.frame_count(); frame_no++ ) {
+      input.decode_frame( frame_no, frame.data(), threads );
+      stdout.write( Chunk( frame ) );
+    }
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,43 +1,73 @@
 #include <cstdlib>
+#include <iostream>
+#include <string>
 
-#include "display.hh"
+#include "display_backend.hh"
+#include "exception.hh"
+#include "stats.hh"
 
 using namespace std;
 
-int main()
+unsigned int paranoid_atoi( const string & in )
 {
-  /* construct a window */
-  XWindow window( 1280, 720 );
-  window.set_name( "RGB example" );
-
-  /* put the window on the screen */
-  window.map();
-
-  /* on the X server, construct a picture */
-  XPixmap picture( window );
-
-  /* in our program (the X client), construct an image */
-  XImage image( picture );
-  GraphicsContext gc( picture );
-
-  /* draw alternating all-red or all-blue */
-  bool red_or_blue = false;
-  while ( true ) {
-    for ( unsigned int col = 0; col < picture.size().first; col++ ) {
-      for ( unsigned int row = 0; row < picture.size().second; row++ ) {
-	image.pixel( col, row ).red =  red_or_blue ? 255 : 0;
-	image.pixel( col, row ).blue = red_or_blue ? 0   : 255;
+  const unsigned int ret = stoul( in );
+  const string roundtrip = to_string( ret );
+  if ( roundtrip != in ) {
+    throw runtime_error( "invalid unsigned integer: " + in );
+  }
+  return ret;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc > 3 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [DISPLAY [FRAMES]]\n\n"
+         << "\tDISPLAY is an X display (default $DISPLAY) or offscreen[:HZ[:FILE]]\n"
+         << "\tto draw with no X server; FRAMES stops after that many (default: never).\n\n";
+    return EXIT_FAILURE;
+  }
+
+  try {
+    /* with CAPTAIN_EO_STATS set, SIGUSR1 prints the display timings */
+    const StatsReporter stats_reporter;
+
+    const string spec = argc > 1 ? argv[ 1 ] : "";
+    const uint64_t frames = argc > 2 ? paranoid_atoi( argv[ 2 ] ) : 0;
+
+    /* construct a window (or an offscreen surface), with a picture to draw into */
+    unique_ptr<DisplayBackend> display = open_display( spec, 1280, 720, "RGB example" );
+
+    /* in our program (the X client), construct an image */
+    XImage image( display->size().first, display->size().second );
+
+    const uint64_t start = Stats::now_ns();
+
+    /* draw alternating all-red or all-blue */
+    bool red_or_blue = false;
+    for ( uint64_t frame_no = 0; frames == 0 or frame_no < frames; frame_no++ ) {
+      for ( unsigned int col = 0; col < image.width(); col++ ) {
+        for ( unsigned int row = 0; row < image.height(); row++ ) {
+          image.pixel( col, row ).red =  red_or_blue ? 255 : 0;
+          image.pixel( col, row ).blue = red_or_blue ? 0   : 255;
+        }
       }
-    }
 
-    /* paint the image (client-side) onto the picture (server-side) */
-    picture.put( image, gc );
+      /* paint the image (client-side) onto the picture */
+      display->put( image );
+
+      /* show the picture at the next vblank */
+      display->present( 0, 0 );
 
-    /* tell the server to paint the picture onto the window */
-    window.present( picture, 0, 0 );
+      /* next time, paint a different color */
+      red_or_blue = not red_or_blue;
+    }
 
-    /* next time, paint a different color */
-    red_or_blue = not red_or_blue;
+    const uint64_t elapsed = Stats::now_ns() - start;
+    cerr << "# Presented " << frames << " frames on " << display->description() << " in "
+         << elapsed / 1000000 << " ms (" << ( elapsed ? frames * 1000000000 / elapsed : 0 ) << " fps).\n";
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
   }
 
   return EXIT_SUCCESS;
@@ -0,0 +1,136 @@
+/* -*-mode:c; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* stamps and reads frames through libbarcode's C API, with padded rows
+   and separately allocated planes, and checks the error statuses */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "barcode.h"
+
+#define WIDTH 640
+#define HEIGHT 360
+#define PADDING 96
+#define FRAMES 4
+
+#define CHECK( expression ) \
+  do { \
+    if ( !( expression ) ) { \
+      fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expression ); \
+      exit( EXIT_FAILURE ); \
+    } \
+  } while ( 0 )
+
+static uint8_t * noise( size_t length )
+{
+  uint8_t * buffer = malloc( length );
+  CHECK( buffer );
+  for ( size_t i = 0; i < length; i++ ) {
+    buffer[ i ] = rand();
+  }
+  return buffer;
+}
+
+int main( void )
+{
+  CHECK( barcode_api_version() == BARCODE_API_VERSION );
+
+  barcode_frame frames[ FRAMES ];
+  uint64_t values[ FRAMES ], upper_left[ FRAMES ], lower_right[ FRAMES ];
+
+  /* BGRX with padded rows */
+  for ( int i = 0; i < 2; i++ ) {
+    frames[ i ].format = BARCODE_FORMAT_BGRX;
+    frames[ i ].width = WIDTH;
+    frames[ i ].height = HEIGHT;
+    frames[ i ].strides[ 0 ] = WIDTH * 4 + PADDING;
+    frames[ i ].planes[ 0 ] = noise( frames[ i ].strides[ 0 ] * HEIGHT );
+  }
+
+  /* I420, each plane on its own with padded rows */
+  frames[ 2 ].format = BARCODE_FORMAT_I420;
+  frames[ 2 ].width = WIDTH;
+  frames[ 2 ].height = HEIGHT;
+  frames[ 2 ].strides[ 0 ] = WIDTH + PADDING;
+  frames[ 2 ].strides[ 1 ] = frames[ 2 ].strides[ 2 ] = WIDTH / 2 + PADDING;
+  frames[ 2 ].planes[ 0 ] = noise( frames[ 2 ].strides[ 0 ] * HEIGHT );
+  frames[ 2 ].planes[ 1 ] = noise( frames[ 2 ].strides[ 1 ] * HEIGHT / 2 );
+  frames[ 2 ].planes[ 2 ] = noise( frames[ 2 ].strides[ 2 ] * HEIGHT / 2 );
+
+  /* packed NV12 */
+  uint8_t * nv12 = noise( WIDTH * HEIGHT * 3 / 2 );
+  CHECK( barcode_frame_packed( &frames[ 3 ], nv12, BARCODE_FORMAT_NV12, WIDTH, HEIGHT ) == BARCODE_OK );
+
+  for ( int i = 0; i < FRAMES; i++ ) {
+    values[ i ] = barcode_encode_payload( i, 1000 + i );
+  }
+
+  CHECK( barcode_write_batch( frames, values, FRAMES ) == BARCODE_OK );
+  /* reading takes the planes as const */
+  barcode_const_frame readable[ FRAMES ];
+  for ( int i = 0; i < FRAMES; i++ ) {
+    readable[ i ] = barcode_frame_as_const( &frames[ i ] );
+  }
+  CHECK( barcode_read_batch( readable, FRAMES, NULL, upper_left, lower_right ) == BARCODE_OK );
+  for ( int i = 0; i < FRAMES; i++ ) {
+    uint32_t sequence, timestamp;
+    CHECK( upper_left[ i ] == values[ i ] && lower_right[ i ] == values[ i ] );
+    CHECK( barcode_decode_payload( upper_left[ i ], &sequence, &timestamp ) == BARCODE_OK );
+    CHECK( sequence == (uint32_t)i && timestamp == (uint32_t)( 1000 + i ) );
+  }
+
+  /* sampled decode agrees on a clean frame */
+  const barcode_decode_options sampled = { 2, 64 };
+  CHECK( barcode_read( &readable[ 0 ], &sampled, &upper_left[ 0 ], &lower_right[ 0 ] ) == BARCODE_OK );
+  CHECK( upper_left[ 0 ] == values[ 0 ] );
+
+  /* the padding between rows is left alone */
+  uint8_t * padding = frames[ 0 ].planes[ 0 ] + WIDTH * 4;
+  const uint8_t before = padding[ 0 ];
+  CHECK( barcode_write( &frames[ 0 ], 0 ) == BARCODE_OK );
+  CHECK( padding[ 0 ] == before );
+
+  /* at an odd width the lower-right barcode starts on an odd column, and
+     every chroma sample under it is still made neutral */
+  {
+    const uint32_t width = WIDTH + 1, length = 128, x = width - length - 256, y = HEIGHT - length;
+    uint8_t * odd = calloc( (size_t)width * HEIGHT * 2, 1 );
+    CHECK( odd );
+    barcode_frame frame;
+    CHECK( barcode_frame_packed( &frame, odd, BARCODE_FORMAT_I420, width, HEIGHT ) == BARCODE_OK );
+    CHECK( barcode_write( &frame, 1 ) == BARCODE_OK );
+    for ( uint32_t row = y / 2; row < ( y + length + 1 ) / 2; row++ ) {
+      for ( uint32_t column = x / 2; column < ( x + length + 1 ) / 2; column++ ) {
+        CHECK( frame.planes[ 1 ][ row * frame.strides[ 1 ] + column ] == 128 );
+        CHECK( frame.planes[ 2 ][ row * frame.strides[ 2 ] + column ] == 128 );
+      }
+    }
+    free( odd );
+  }
+
+  /* errors leave every frame untouched */
+  barcode_frame bad[ 2 ] = { frames[ 1 ], frames[ 1 ] };
+  bad[ 1 ].strides[ 0 ] = WIDTH * 4 - 1;
+  uint8_t * copy = malloc( frames[ 1 ].strides[ 0 ] * HEIGHT );
+  CHECK( copy );
+  memcpy( copy, frames[ 1 ].planes[ 0 ], frames[ 1 ].strides[ 0 ] * HEIGHT );
+  const uint64_t ones[ 2 ] = { ~0ull, ~0ull };
+  CHECK( barcode_write_batch( bad, ones, 2 ) == BARCODE_ERROR_INVALID );
+  CHECK( memcmp( copy, frames[ 1 ].planes[ 0 ], frames[ 1 ].strides[ 0 ] * HEIGHT ) == 0 );
+
+  barcode_frame tiny = frames[ 1 ];
+  tiny.width = 200;
+  CHECK( barcode_write( &tiny, 1 ) == BARCODE_ERROR_TOO_SMALL );
+  CHECK( barcode_read( NULL, NULL, &upper_left[ 0 ], &lower_right[ 0 ] ) == BARCODE_ERROR_INVALID );
+  const barcode_decode_options too_many = { 9, 64 };
+  CHECK( barcode_read( &readable[ 0 ], &too_many, &upper_left[ 0 ], &lower_right[ 0 ] ) == BARCODE_ERROR_INVALID );
+  CHECK( barcode_decode_payload( values[ 0 ] ^ 1, NULL, NULL ) == BARCODE_ERROR_INVALID );
+
+  /* a count too large to allocate for is an error, not an abort */
+  CHECK( barcode_write_batch( frames, values, SIZE_MAX ) == BARCODE_ERROR_INTERNAL );
+  CHECK( barcode_read_batch( readable, SIZE_MAX, NULL, upper_left, lower_right ) == BARCODE_ERROR_INTERNAL );
+
+  printf( "%d frames stamped and read\n", FRAMES );
+  return EXIT_SUCCESS;
+}
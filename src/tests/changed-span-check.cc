@@ -0,0 +1,129 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* compares both ways of finding where a row changed with a plain
+   pixel-by-pixel walk, on rows of every awkward width */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "changed_span.hh"
+#include "exception.hh"
+#include "frame_view.hh"
+
+using namespace std;
+
+#define CHECK( expression ) \
+  do { \
+    if ( not ( expression ) ) { \
+      throw runtime_error( string( __FILE__ ) + ":" + to_string( __LINE__ ) + ": check failed: " + #expression ); \
+    } \
+  } while ( 0 )
+
+static const size_t per_vector = 8;
+
+static pair<size_t, size_t> walk( const vector<uint8_t> & before, const vector<uint8_t> & after, const size_t pixels )
+{
+  size_t first = pixels, last = 0;
+  for ( size_t i = 0; i < pixels; i++ ) {
+    if ( memcmp( &before[ i * sizeof( RGBPixel ) ], &after[ i * sizeof( RGBPixel ) ], sizeof( RGBPixel ) ) ) {
+      first = min( first, i );
+      last = i + 1;
+    }
+  }
+  return first < last ? make_pair( first, last ) : make_pair( size_t( 0 ), size_t( 0 ) );
+}
+
+/* AVX2 may round out to whole vectors, but not into the tail past them */
+static pair<size_t, size_t> widened( const pair<size_t, size_t> & span, const size_t pixels )
+{
+  if ( span.first == span.second ) {
+    return span;
+  }
+  const size_t tail = pixels / per_vector * per_vector;
+  const size_t first = span.first < tail ? span.first / per_vector * per_vector : span.first;
+  const size_t last = span.second <= tail ? ( span.second + per_vector - 1 ) / per_vector * per_vector : span.second;
+  return { first, last };
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    const bool avx2 = __builtin_cpu_supports( "avx2" );
+    mt19937 generator { 20240601 };
+    uint64_t rows = 0;
+
+    /* rows sized exactly, so that reading past the end would show up
+       under a memory checker */
+    auto check = [&]( const vector<uint8_t> & before, const vector<uint8_t> & after, const size_t pixels ) {
+      const auto expected = walk( before, after, pixels );
+      CHECK( changed_span_scalar( before.data(), after.data(), pixels ) == expected );
+      if ( avx2 ) {
+        CHECK( changed_span_avx2( before.data(), after.data(), pixels ) == widened( expected, pixels ) );
+      }
+      CHECK( changed_span( before.data(), after.data(), pixels ) == ( avx2 ? widened( expected, pixels ) : expected ) );
+      rows++;
+    };
+
+    vector<size_t> widths;
+    for ( size_t width = 1; width <= 40; width++ ) {
+      widths.push_back( width );
+    }
+    for ( const size_t width : { 63, 64, 65, 639, 640, 1279, 1280, 1281, 1921 } ) {
+      widths.push_back( width );
+    }
+
+    for ( const size_t pixels : widths ) {
+      const size_t length = pixels * sizeof( RGBPixel );
+      vector<uint8_t> before( length );
+      for ( auto & byte : before ) {
+        byte = generator();
+      }
+
+      /* no change */
+      check( before, before, pixels );
+
+      /* one byte of the first pixel, the last pixel, and each pixel of the
+         last vector and the tail */
+      for ( size_t pixel = 0; pixel < pixels; pixel++ ) {
+        if ( pixel > 0 and pixel + 2 * per_vector < pixels and pixel % 97 ) {
+          continue;
+        }
+        vector<uint8_t> after = before;
+        after[ pixel * sizeof( RGBPixel ) + generator() % sizeof( RGBPixel ) ] ^= 1 + generator() % 255;
+        check( before, after, pixels );
+      }
+
+      /* random spans and scattered pixels */
+      for ( int trial = 0; trial < 50; trial++ ) {
+        vector<uint8_t> after = before;
+        const size_t changes = 1 + generator() % 4;
+        for ( size_t i = 0; i < changes; i++ ) {
+          after[ generator() % length ] ^= 1 + generator() % 255;
+        }
+        check( before, after, pixels );
+
+        vector<uint8_t> whole( length );
+        for ( auto & byte : whole ) {
+          byte = generator();
+        }
+        check( before, whole, pixels );
+      }
+    }
+
+    cout << "changed spans agreed on " << rows << " rows" << ( avx2 ? "" : " (without AVX2)" ) << "\n";
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
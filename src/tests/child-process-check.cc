@@ -0,0 +1,121 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* runs commands with ChildProcess while other threads are busy, and
+   supervises them through their pidfds */
+
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "child_process.hh"
+#include "exception.hh"
+
+using namespace std;
+
+#define CHECK( expression ) \
+  do { \
+    if ( not ( expression ) ) { \
+      throw runtime_error( string( __FILE__ ) + ":" + to_string( __LINE__ ) + ": check failed: " + #expression ); \
+    } \
+  } while ( 0 )
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    /* workers that allocate all along, as a decoder's would */
+    atomic<bool> done { false };
+    vector<thread> workers;
+    for ( int i = 0; i < 4; i++ ) {
+      workers.emplace_back( [&] {
+          while ( not done ) {
+            vector<string> garbage( 64, string( 100, 'x' ) );
+          }
+        } );
+    }
+
+    /* forking the program is refused, running a command is not */
+    bool refused = false;
+    try {
+      ChildProcess forked { "forked", [] { return 0; } };
+    } catch ( const runtime_error & ) {
+      refused = true;
+    }
+    CHECK( refused );
+
+    ChildProcess quick { "quick", { "sh", "-c", "exit 3" } };
+    ChildProcess slow { "slow", { "sleep", "30" } };
+    CHECK( quick.pidfd() >= 0 and slow.pidfd() >= 0 );
+
+    vector<ChildProcess *> exited = ChildProcess::wait_any( { &quick, &slow } );
+    CHECK( exited.size() == 1 and exited.front() == &quick );
+    CHECK( not quick.died_on_signal() and quick.exit_status() == 3 );
+    CHECK( ChildProcess::wait_any( { &quick, &slow }, 100 ).empty() );
+
+    slow.signal( SIGTERM );
+    exited = ChildProcess::wait_any( { &quick, &slow } );
+    CHECK( exited.size() == 1 and exited.front() == &slow );
+    CHECK( slow.died_on_signal() and slow.exit_status() == SIGTERM );
+
+    /* many at once, from several threads */
+    atomic<unsigned int> succeeded { 0 };
+    vector<thread> spawners;
+    for ( int i = 0; i < 4; i++ ) {
+      spawners.emplace_back( [&] {
+          for ( int j = 0; j < 25; j++ ) {
+            ChildProcess child { "true", { "true" } };
+            child.wait();
+            if ( child.terminated() and child.exit_status() == 0 ) {
+              succeeded++;
+            }
+          }
+        } );
+    }
+    for ( auto & spawner : spawners ) {
+      spawner.join();
+    }
+    CHECK( succeeded == 100 );
+
+    /* a signal caught by the parent is fatal to a child it hits right
+       away, rather than running the parent's handler before the exec */
+    static atomic<unsigned int> caught { 0 };
+    struct sigaction action {};
+    action.sa_handler = []( int ) { caught++; };
+    sigemptyset( &action.sa_mask );
+    SystemCall( "sigaction", sigaction( SIGUSR2, &action, nullptr ) );
+    for ( int i = 0; i < 50; i++ ) {
+      ChildProcess child { "signalled", { "sleep", "30" } };
+      child.signal( SIGUSR2 );
+      child.wait();
+      CHECK( child.died_on_signal() and child.exit_status() == SIGUSR2 );
+    }
+    CHECK( caught == 0 );
+
+    /* a command that can't run throws in the parent */
+    bool missing = false;
+    try {
+      ChildProcess child { "missing", { "/nonexistent/program" } };
+    } catch ( const unix_error & e ) {
+      missing = e.code().value() == ENOENT;
+    }
+    CHECK( missing );
+
+    done = true;
+    for ( auto & worker : workers ) {
+      worker.join();
+    }
+
+    cout << "children ran alongside threads\n";
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
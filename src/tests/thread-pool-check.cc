@@ -0,0 +1,95 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* runs trees of tasks that submit more tasks on a ThreadPool, and checks
+   that wait() sees all of them and hands back their exceptions */
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "thread_pool.hh"
+#include "exception.hh"
+
+using namespace std;
+
+#define CHECK( expression ) \
+  do { \
+    if ( not ( expression ) ) { \
+      throw runtime_error( string( __FILE__ ) + ":" + to_string( __LINE__ ) + ": check failed: " + #expression ); \
+    } \
+  } while ( 0 )
+
+/* a task that, DEPTH levels down, spreads into FANOUT children each */
+static void spread( ThreadPool & pool, atomic<unsigned int> & ran,
+                    const unsigned int depth, const unsigned int fanout )
+{
+  ran++;
+  if ( depth == 0 ) {
+    return;
+  }
+  for ( unsigned int i = 0; i < fanout; i++ ) {
+    pool.submit( [&pool, &ran, depth, fanout] { spread( pool, ran, depth - 1, fanout ); } );
+  }
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    bool refused = false;
+    try {
+      ThreadPool empty { 0 };
+    } catch ( const runtime_error & ) {
+      refused = true;
+    }
+    CHECK( refused );
+
+    ThreadPool pool { 4 };
+
+    /* wait() right after one submit must still cover everything the
+       task goes on to submit: 1 + 4 + 16 + 64 + 256 tasks */
+    for ( int round = 0; round < 200; round++ ) {
+      atomic<unsigned int> ran { 0 };
+      pool.submit( [&] { spread( pool, ran, 4, 4 ); } );
+      pool.wait();
+      CHECK( ran == 341 );
+    }
+
+    /* the first exception comes back from wait(), the other tasks still
+       run, and the pool is usable afterwards */
+    atomic<unsigned int> ran { 0 };
+    for ( int i = 0; i < 100; i++ ) {
+      pool.submit( [&, i] {
+          if ( i % 10 == 3 ) {
+            pool.submit( [] { throw runtime_error( "nested failure" ); } );
+          }
+          ran++;
+        } );
+    }
+    bool rethrown = false;
+    try {
+      pool.wait();
+    } catch ( const runtime_error & e ) {
+      rethrown = string( e.what() ) == "nested failure";
+    }
+    CHECK( rethrown );
+    CHECK( ran == 100 );
+
+    ran = 0;
+    pool.submit( [&] { spread( pool, ran, 2, 8 ); } );
+    pool.wait();
+    CHECK( ran == 73 );
+
+    cout << "thread pool waited for every task\n";
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
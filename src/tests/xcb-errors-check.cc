@@ -0,0 +1,105 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* sends a request the X server must refuse, and checks that each error
+   checking mode reports it where it says it will */
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "display.hh"
+#include "exception.hh"
+
+using namespace std;
+
+#define CHECK( expression ) \
+  do { \
+    if ( not ( expression ) ) { \
+      throw runtime_error( string( __FILE__ ) + ":" + to_string( __LINE__ ) + ": check failed: " + #expression ); \
+    } \
+  } while ( 0 )
+
+/* shares the window's connection, and its pending checks */
+class BadRequests : public XCBObject
+{
+public:
+  BadRequests( XWindow & window ) : XCBObject( window ) {}
+
+  /* put an image on a pixmap that has already been freed */
+  void put_on_freed_pixmap( XWindow & window, const GraphicsContext & gc )
+  {
+    const xcb_pixmap_t pixmap = xcb_generate_id( xcb_connection() );
+    xcb_create_pixmap( xcb_connection(), 24, pixmap, window.xcb_window(), 1, 1 );
+    xcb_free_pixmap( xcb_connection(), pixmap );
+
+    const uint32_t pixel = 0;
+    check_noreply( "xcb_put_image_checked",
+                   xcb_put_image_checked( xcb_connection(), XCB_IMAGE_FORMAT_Z_PIXMAP, pixmap, gc.xcb_gc(),
+                                          1, 1, 0, 0, 0, 24, sizeof( pixel ),
+                                          reinterpret_cast<const uint8_t *>( &pixel ) ) );
+  }
+};
+
+/* true if the call threw an X error */
+template <class Call>
+static bool reports_error( Call && call )
+{
+  try {
+    call();
+  } catch ( const runtime_error & e ) {
+    return string( e.what() ).find( "returned error" ) != string::npos;
+  }
+  return false;
+}
+
+int main( int argc, char *argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort();
+    }
+
+    /* strict is the default, and reports the error from the request itself */
+    CHECK( XCBObject::error_checking() == XCBObject::ErrorChecking::Strict );
+    {
+      XWindow window { "", 64, 64, "xcb-errors-check" };
+      XPixmap pixmap { window };
+      GraphicsContext gc { pixmap };
+      BadRequests bad { window };
+      CHECK( reports_error( [&] { bad.put_on_freed_pixmap( window, gc ); } ) );
+      window.present( pixmap, 0, 0 );
+    }
+
+    XCBObject::set_error_checking( XCBObject::ErrorChecking::Batched );
+
+    /* batched, the next present reports it */
+    {
+      XWindow window { "", 64, 64, "xcb-errors-check" };
+      XPixmap pixmap { window };
+      GraphicsContext gc { pixmap };
+      BadRequests bad { window };
+      bad.put_on_freed_pixmap( window, gc );
+      CHECK( reports_error( [&] { window.present( pixmap, 0, 0 ); } ) );
+      window.present( pixmap, 0, 0 );
+    }
+
+    /* or check_pending(), from any object on the connection */
+    {
+      XWindow window { "", 64, 64, "xcb-errors-check" };
+      XPixmap pixmap { window };
+      GraphicsContext gc { pixmap };
+      BadRequests bad { window };
+      bad.put_on_freed_pixmap( window, gc );
+      CHECK( reports_error( [&] { pixmap.check_pending(); } ) );
+      pixmap.check_pending();
+    }
+
+    cout << "errors were reported in both modes\n";
+  } catch ( const exception & e ) {
+    print_exception( argv[ 0 ], e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cstring>
+
+#include <immintrin.h>
+
+#include "changed_span.hh"
+#include "frame_view.hh"
+
+using namespace std;
+
+/* memcmp answers the common case of no change */
+pair<size_t, size_t> changed_span_scalar( const uint8_t * before, const uint8_t * after, const size_t pixels )
+{
+  const size_t row_bytes = pixels * sizeof( RGBPixel );
+  if ( memcmp( before, after, row_bytes ) == 0 ) {
+    return { 0, 0 };
+  }
+
+  size_t first = 0, last = pixels;
+  while ( memcmp( before + first * sizeof( RGBPixel ), after + first * sizeof( RGBPixel ), sizeof( RGBPixel ) ) == 0 ) {
+    first++;
+  }
+  while ( memcmp( before + ( last - 1 ) * sizeof( RGBPixel ), after + ( last - 1 ) * sizeof( RGBPixel ),
+                  sizeof( RGBPixel ) ) == 0 ) {
+    last--;
+  }
+  return { first, last };
+}
+
+__attribute__(( target( "avx2" ) ))
+static bool vectors_differ( const uint8_t * before, const uint8_t * after, const size_t vector )
+{
+  const __m256i a = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( before ) + vector );
+  const __m256i b = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( after ) + vector );
+  return _mm256_movemask_epi8( _mm256_cmpeq_epi8( a, b ) ) != -1;
+}
+
+/* eight pixels at a time from each end */
+__attribute__(( target( "avx2" ) ))
+pair<size_t, size_t> changed_span_avx2( const uint8_t * before, const uint8_t * after, const size_t pixels )
+{
+  const size_t per_vector = sizeof( __m256i ) / sizeof( RGBPixel );
+  const size_t vectors = pixels / per_vector;
+
+  size_t first = 0;
+  while ( first < vectors and not vectors_differ( before, after, first ) ) {
+    first++;
+  }
+
+  if ( first == vectors ) {
+    /* only the tail, if anything, changed */
+    const size_t tail = vectors * per_vector;
+    const auto span = changed_span_scalar( before + tail * sizeof( RGBPixel ),
+                                           after + tail * sizeof( RGBPixel ), pixels - tail );
+    return span.first == span.second ? span : make_pair( tail + span.first, tail + span.second );
+  }
+
+  size_t last = pixels;
+  while ( last % per_vector
+          and memcmp( before + ( last - 1 ) * sizeof( RGBPixel ), after + ( last - 1 ) * sizeof( RGBPixel ),
+                      sizeof( RGBPixel ) ) == 0 ) {
+    last--;
+  }
+  if ( last % per_vector == 0 ) {
+    while ( not vectors_differ( before, after, last / per_vector - 1 ) ) {
+      last -= per_vector;
+    }
+  }
+
+  /* whole vectors are close enough; the rectangle only needs to cover the change */
+  return { first * per_vector, last };
+}
+
+pair<size_t, size_t> changed_span( const uint8_t * before, const uint8_t * after, const size_t pixels )
+{
+  static const bool use_avx2 = __builtin_cpu_supports( "avx2" );
+  return use_avx2 ? changed_span_avx2( before, after, pixels ) : changed_span_scalar( before, after, pixels );
+}
@@ -0,0 +1,23 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef CHANGED_SPAN_HH
+#define CHANGED_SPAN_HH
+
+/* where a row of RGBPixels changed, for sending only the part of an image
+   that differs from the last one (see XPixmap::put) */
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/* the pixels [first, last) in which two rows differ, or first == last
+   if they don't; with AVX2 when the CPU has it, in which case the span
+   may be widened to whole runs of eight pixels */
+std::pair<size_t, size_t> changed_span( const uint8_t * before, const uint8_t * after, const size_t pixels );
+
+/* the two implementations, for comparing; the span from the scalar one
+   is exact, and changed_span_avx2 must only be called if the CPU has AVX2 */
+std::pair<size_t, size_t> changed_span_scalar( const uint8_t * before, const uint8_t * after, const size_t pixels );
+std::pair<size_t, size_t> changed_span_avx2( const uint8_t * before, const uint8_t * after, const size_t pixels );
+
+#endif /* CHANGED_SPAN_HH */
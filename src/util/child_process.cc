@@ -3,12 +3,19 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <sys/syscall.h>
 #include <string>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/sched.h>
 
 #include "child_process.hh"
 #include "exception.hh"
@@ -19,7 +26,54 @@ using namespace std;
 
 template <typename T> void zero( T & x ) { memset( &x, 0, sizeof( x ) ); }
 
-int do_clone( const bool new_namespace )
+/* the program to exec: as given if it holds a slash, else the first match in $PATH */
+static string find_program( const string & program )
+{
+    if ( program.find( '/' ) != string::npos ) {
+        return program;
+    }
+
+    const char * path = getenv( "PATH" );
+    string directories = path ? path : "/usr/local/bin:/usr/bin:/bin";
+    size_t start = 0;
+    while ( start <= directories.size() ) {
+        size_t end = directories.find( ':', start );
+        if ( end == string::npos ) {
+            end = directories.size();
+        }
+        const string directory = end > start ? directories.substr( start, end - start ) : ".";
+        const string candidate = directory + "/" + program;
+        if ( access( candidate.c_str(), X_OK ) == 0 ) {
+            return candidate;
+        }
+        start = end + 1;
+    }
+
+    throw unix_error( program, ENOENT );
+}
+
+/* clone3() with a pidfd, falling back to clone() on kernels before 5.3;
+   returns 0 in the child */
+static pid_t clone_with_pidfd( const bool new_namespace, int & pidfd )
+{
+    const uint64_t flags = CLONE_PIDFD | (new_namespace ? CLONE_NEWNET : 0);
+
+    clone_args args;
+    zero( args );
+    args.flags = flags;
+    args.pidfd = reinterpret_cast<uintptr_t>( &pidfd );
+    args.exit_signal = SIGCHLD;
+
+    long pid = syscall( SYS_clone3, &args, sizeof( args ) );
+    if ( pid < 0 and errno == ENOSYS ) {
+        pid = syscall( SYS_clone, flags | SIGCHLD, nullptr, &pidfd, nullptr, nullptr );
+    }
+
+    return SystemCall( "clone3", pid );
+}
+
+/* fork the whole program, which copies only the calling thread */
+static pid_t clone_single_threaded( const bool new_namespace, int & pidfd )
 {
     /* Verify that process is single-threaded before forking */
     {
@@ -27,13 +81,112 @@ int do_clone( const bool new_namespace )
         SystemCall( "stat", stat( "/proc/self/task", &my_stat ) );
 
         if ( my_stat.st_nlink != 3 ) {
-            throw runtime_error( "ChildProcess constructed in multi-threaded program" );
+            throw runtime_error( "ChildProcess constructed in multi-threaded program"
+                                 " (run a command instead)" );
         }
     }
 
-    return SystemCall( "clone", syscall( SYS_clone,
-                                         SIGCHLD | (new_namespace ? CLONE_NEWNET : 0),
-                                         nullptr, nullptr, nullptr, nullptr ) );
+    return clone_with_pidfd( new_namespace, pidfd );
+}
+
+ChildProcess::Spawned ChildProcess::fork( const bool new_namespace )
+{
+    int pidfd = -1;
+    const pid_t pid = clone_single_threaded( new_namespace, pidfd );
+    return { pid, pid == 0 ? -1 : pidfd };
+}
+
+/* exec the command in a new child; everything it needs is prepared here,
+   so that the child (a copy of just the calling thread) makes only
+   async-signal-safe calls. Like posix_spawn, it keeps signals blocked
+   across the clone, and the child puts caught signals back to their
+   default action before unblocking them, so none can run one of the
+   parent's handlers in the half-made child. */
+ChildProcess::Spawned ChildProcess::spawn( const vector<string> & command, const bool new_namespace )
+{
+    if ( command.empty() ) {
+        throw runtime_error( "ChildProcess: empty command" );
+    }
+
+    const string program = find_program( command.front() );
+    vector<char *> argv;
+    for ( const auto & argument : command ) {
+        argv.push_back( const_cast<char *>( argument.c_str() ) );
+    }
+    argv.push_back( nullptr );
+    char ** const envp = environ;
+
+    sigset_t empty_mask;
+    sigemptyset( &empty_mask );
+
+    /* the child reports a failed exec down this pipe; a successful exec closes it */
+    int report[ 2 ];
+    SystemCall( "pipe2", pipe2( report, O_CLOEXEC ) );
+
+    sigset_t all_signals, parent_mask;
+    sigfillset( &all_signals );
+    const int mask_error = pthread_sigmask( SIG_SETMASK, &all_signals, &parent_mask );
+    if ( mask_error ) {
+        close( report[ 0 ] );
+        close( report[ 1 ] );
+        throw unix_error( "pthread_sigmask", mask_error );
+    }
+
+    int pidfd = -1;
+    pid_t pid;
+    try {
+        pid = clone_with_pidfd( new_namespace, pidfd );
+    } catch ( ... ) {
+        pthread_sigmask( SIG_SETMASK, &parent_mask, nullptr );
+        close( report[ 0 ] );
+        close( report[ 1 ] );
+        throw;
+    }
+
+    if ( pid == 0 ) { /* child */
+        for ( int sig = 1; sig < _NSIG; sig++ ) {
+            struct sigaction action;
+            if ( sigaction( sig, nullptr, &action ) == 0
+                 and ( action.sa_flags & SA_SIGINFO
+                       or ( action.sa_handler != SIG_DFL and action.sa_handler != SIG_IGN ) ) ) {
+                action.sa_handler = SIG_DFL;
+                action.sa_flags = 0;
+                sigemptyset( &action.sa_mask );
+                sigaction( sig, &action, nullptr );
+            }
+        }
+        sigprocmask( SIG_SETMASK, &empty_mask, nullptr );
+        execve( program.c_str(), argv.data(), envp );
+        const int error = errno;
+        if ( write( report[ 1 ], &error, sizeof( error ) ) ) {}
+        _exit( 127 );
+    }
+
+    pthread_sigmask( SIG_SETMASK, &parent_mask, nullptr );
+    close( report[ 1 ] );
+    int error = 0;
+    ssize_t bytes_read;
+    do {
+        bytes_read = read( report[ 0 ], &error, sizeof( error ) );
+    } while ( bytes_read < 0 and errno == EINTR );
+    close( report[ 0 ] );
+
+    if ( bytes_read == sizeof( error ) ) {
+        siginfo_t infop;
+        zero( infop );
+        waitid( P_PIDFD, pidfd, &infop, WEXITED );
+        close( pidfd );
+        throw unix_error( program, error );
+    }
+
+    return { pid, pidfd };
+}
+
+/* on the pidfd when there is one, so a reused pid can't be mistaken for the child */
+static int wait_child( const pid_t pid, const int pidfd, siginfo_t & infop, const int options )
+{
+    return pidfd >= 0 ? waitid( P_PIDFD, pidfd, &infop, options )
+                      : waitid( P_PID, pid, &infop, options );
 }
 
 /* start up a child process running the supplied lambda */
@@ -41,14 +194,7 @@ int do_clone( const bool new_namespace )
 ChildProcess::ChildProcess( const string & name,
                             function<int()> && child_procedure, const bool new_namespace,
                             const int termination_signal )
-    : name_( name ),
-      pid_( do_clone( new_namespace ) ),
-      running_( true ),
-      terminated_( false ),
-      exit_status_(),
-      died_on_signal_( false ),
-      graceful_termination_signal_( termination_signal ),
-      moved_away_( false )
+    : ChildProcess( name, fork( new_namespace ), termination_signal )
 {
     if ( pid_ == 0 ) { /* child */
         try {
@@ -61,6 +207,25 @@ ChildProcess::ChildProcess( const string & name,
     }
 }
 
+/* start up a child process running a command */
+ChildProcess::ChildProcess( const string & name,
+                            const vector<string> & command, const bool new_namespace,
+                            const int termination_signal )
+    : ChildProcess( name, spawn( command, new_namespace ), termination_signal )
+{}
+
+ChildProcess::ChildProcess( const string & name, const Spawned spawned, const int termination_signal )
+    : name_( name ),
+      pid_( spawned.pid ),
+      pidfd_( spawned.pidfd ),
+      running_( true ),
+      terminated_( false ),
+      exit_status_(),
+      died_on_signal_( false ),
+      graceful_termination_signal_( termination_signal ),
+      moved_away_( false )
+{}
+
 /* is process in a waitable state? */
 bool ChildProcess::waitable( void ) const
 {
@@ -69,8 +234,8 @@ bool ChildProcess::waitable( void ) const
 
     siginfo_t infop;
     zero( infop );
-    SystemCall( "waitid", waitid( P_PID, pid_, &infop,
-                                  WEXITED | WSTOPPED | WCONTINUED | WNOHANG | WNOWAIT ) );
+    SystemCall( "waitid", wait_child( pid_, pidfd_.fd_num(), infop,
+                                      WEXITED | WSTOPPED | WCONTINUED | WNOHANG | WNOWAIT ) );
 
     if ( infop.si_pid == 0 ) {
         return false;
@@ -89,8 +254,8 @@ void ChildProcess::wait( const bool nonblocking )
 
     siginfo_t infop;
     zero( infop );
-    SystemCall( "waitid", waitid( P_PID, pid_, &infop,
-                                  WEXITED | WSTOPPED | WCONTINUED | (nonblocking ? WNOHANG : 0) ) );
+    SystemCall( "waitid", wait_child( pid_, pidfd_.fd_num(), infop,
+                                      WEXITED | WSTOPPED | WCONTINUED | (nonblocking ? WNOHANG : 0) ) );
 
     if ( nonblocking and (infop.si_pid == 0) ) {
         throw runtime_error( "nonblocking wait: process was not waitable" );
@@ -143,8 +308,53 @@ void ChildProcess::signal( const int sig )
     assert( !moved_away_ );
 
     if ( !terminated_ ) {
-        SystemCall( "kill", kill( pid_, sig ) );
+        if ( pidfd_.fd_num() >= 0 ) {
+            SystemCall( "pidfd_send_signal", syscall( SYS_pidfd_send_signal, pidfd_.fd_num(), sig, nullptr, 0 ) );
+        } else {
+            SystemCall( "kill", kill( pid_, sig ) );
+        }
+    }
+}
+
+vector<ChildProcess *> ChildProcess::wait_any( const vector<ChildProcess *> & children, const int timeout_ms )
+{
+    vector<ChildProcess *> waiting;
+    vector<pollfd> pollfds;
+    for ( ChildProcess * child : children ) {
+        assert( !child->moved_away_ );
+        if ( child->terminated_ ) {
+            continue;
+        }
+        if ( child->pidfd() < 0 ) {
+            throw runtime_error( "wait_any: `" + child->name() + "' has no pidfd" );
+        }
+        waiting.push_back( child );
+        pollfds.push_back( { child->pidfd(), POLLIN, 0 } );
     }
+
+    vector<ChildProcess *> ret;
+    if ( waiting.empty() ) {
+        return ret;
+    }
+
+    int ready;
+    do {
+        ready = poll( pollfds.data(), pollfds.size(), timeout_ms );
+    } while ( ready < 0 and errno == EINTR );
+    SystemCall( "poll", ready );
+
+    /* a pidfd becomes readable when its process exits; any stops and
+       continues it reported first are consumed on the way */
+    for ( size_t i = 0; i < waiting.size(); i++ ) {
+        if ( pollfds[ i ].revents & POLLIN ) {
+            while ( !waiting[ i ]->terminated_ ) {
+                waiting[ i ]->wait();
+            }
+            ret.push_back( waiting[ i ] );
+        }
+    }
+
+    return ret;
 }
 
 ChildProcess::~ChildProcess()
@@ -166,6 +376,7 @@ ChildProcess::~ChildProcess()
 ChildProcess::ChildProcess( ChildProcess && other )
     : name_( other.name_ ),
       pid_( other.pid_ ),
+      pidfd_( move( other.pidfd_ ) ),
       running_( other.running_ ),
       terminated_( other.terminated_ ),
       exit_status_( other.exit_status_ ),
@@ -4,17 +4,29 @@
 #define CHILD_PROCESS_HH
 
 #include <functional>
+#include <string>
+#include <vector>
 #include <unistd.h>
 #include <cassert>
 #include <csignal>
 
-/* object-oriented wrapper for handling Unix child processes */
+#include "file_descriptor.hh"
+
+/* object-oriented wrapper for handling Unix child processes
+
+   There are two ways to start one. Running a lambda forks the whole
+   program, which is only safe before any thread has started, and is
+   refused after. Running a command execs it in a child made with clone3()
+   and only async-signal-safe calls, which is safe from any thread at any
+   time. Either way the child has a pidfd, which wait_any() and other
+   event loops can poll instead of relying on SIGCHLD. */
 
 class ChildProcess
 {
 private:
     std::string name_;
     pid_t pid_;
+    FileDescriptor pidfd_; /* -1 in the child itself */
     bool running_, terminated_;
     int exit_status_;
     bool died_on_signal_;
@@ -22,18 +34,35 @@ private:
 
     bool moved_away_;
 
+    struct Spawned { pid_t pid; int pidfd; };
+    static Spawned fork( const bool new_namespace );
+    static Spawned spawn( const std::vector<std::string> & command, const bool new_namespace );
+    ChildProcess( const std::string & name, const Spawned spawned, const int termination_signal );
+
 public:
     ChildProcess( const std::string & name,
                   std::function<int()> && child_procedure, const bool new_namespace = false,
                   const int termination_signal = SIGHUP );
 
+    /* command[ 0 ] is looked up in $PATH unless it holds a slash; throws
+       if it cannot be executed */
+    ChildProcess( const std::string & name,
+                  const std::vector<std::string> & command, const bool new_namespace = false,
+                  const int termination_signal = SIGHUP );
+
     bool waitable( void ) const; /* is process in a waitable state? */
     void wait( const bool nonblocking = false ); /* wait for process to change state */
     void signal( const int sig ); /* send signal */
     void resume( void ); /* send SIGCONT */
 
+    /* wait up to timeout_ms (-1 for ever) for any of the children, which
+       must have pidfds, to terminate; returns those that did */
+    static std::vector<ChildProcess *> wait_any( const std::vector<ChildProcess *> & children,
+                                                 const int timeout_ms = -1 );
+
     const std::string & name( void ) const { assert( not moved_away_ ); return name_; }
     pid_t pid( void ) const { assert( not moved_away_ ); return pid_; }
+    int pidfd( void ) const { assert( not moved_away_ ); return pidfd_.fd_num(); }
     bool running( void ) const { assert( not moved_away_ ); return running_; }
     bool terminated( void ) const { assert( not moved_away_ ); return terminated_; }
 
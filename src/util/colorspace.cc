@@ -0,0 +1,411 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <immintrin.h>
+
+#include "colorspace.hh"
+#include "parallel.hh"
+
+using namespace std;
+
+ColorMatrix parse_color_matrix( const string & name )
+{
+  if ( name == "bt601" ) { return ColorMatrix::BT601; }
+  if ( name == "bt709" ) { return ColorMatrix::BT709; }
+
+  throw runtime_error( "unknown color matrix: " + name );
+}
+
+ColorRange parse_color_range( const string & name )
+{
+  if ( name == "limited" ) { return ColorRange::Limited; }
+  if ( name == "full" ) { return ColorRange::Full; }
+
+  throw runtime_error( "unknown color range: " + name );
+}
+
+bool color_kernel_available( const ColorKernel kernel )
+{
+  switch ( kernel ) {
+  case ColorKernel::Auto:
+  case ColorKernel::Scalar:
+    return true;
+  case ColorKernel::AVX2:
+    return __builtin_cpu_supports( "avx2" );
+  }
+
+  return false;
+}
+
+namespace {
+
+/* BGRX -> YUV: luma in Q14, chroma in Q14 applied to the sum of a 2x2 block */
+struct ForwardCoefficients
+{
+  int32_t yr, yg, yb, y_bias;
+  int32_t ur, ug, ub, vr, vg, vb, c_bias;
+};
+
+/* YUV -> BGRX, in Q13 */
+struct InverseCoefficients
+{
+  int32_t y_offset, ys, rv, gu, gv, bu;
+};
+
+const int32_t inverse_round = 1 << 12;
+
+void luma_weights( const ColorMatrix matrix, double & kr, double & kb )
+{
+  if ( matrix == ColorMatrix::BT601 ) {
+    kr = 0.299;
+    kb = 0.114;
+  } else {
+    kr = 0.2126;
+    kb = 0.0722;
+  }
+}
+
+ForwardCoefficients forward_coefficients( const ColorSpace & color_space )
+{
+  double kr, kb;
+  luma_weights( color_space.matrix, kr, kb );
+  const double kg = 1 - kr - kb;
+  const bool full = color_space.range == ColorRange::Full;
+  const double y_scale = full ? 1.0 : 219.0 / 255.0;
+  const double c_scale = full ? 1.0 : 224.0 / 255.0;
+  const double one = 1 << 14;
+
+  ForwardCoefficients c;
+
+  /* each row of the matrix is rounded so that grays stay exactly gray */
+  c.yr = lround( kr * y_scale * one );
+  c.yb = lround( kb * y_scale * one );
+  c.yg = lround( y_scale * one ) - c.yr - c.yb;
+  c.y_bias = ( ( full ? 0 : 16 ) << 14 ) + ( 1 << 13 );
+
+  c.ur = lround( -kr / ( 2 * ( 1 - kb ) ) * c_scale * one );
+  c.ug = lround( -kg / ( 2 * ( 1 - kb ) ) * c_scale * one );
+  c.ub = -( c.ur + c.ug );
+
+  c.vg = lround( -kg / ( 2 * ( 1 - kr ) ) * c_scale * one );
+  c.vb = lround( -kb / ( 2 * ( 1 - kr ) ) * c_scale * one );
+  c.vr = -( c.vg + c.vb );
+
+  c.c_bias = ( 128 << 16 ) + ( 1 << 15 );
+
+  return c;
+}
+
+InverseCoefficients inverse_coefficients( const ColorSpace & color_space )
+{
+  double kr, kb;
+  luma_weights( color_space.matrix, kr, kb );
+  const double kg = 1 - kr - kb;
+  const bool full = color_space.range == ColorRange::Full;
+  const double y_scale = full ? 1.0 : 255.0 / 219.0;
+  const double c_scale = full ? 1.0 : 255.0 / 224.0;
+  const double one = 1 << 13;
+
+  InverseCoefficients c;
+  c.y_offset = full ? 0 : 16;
+  c.ys = lround( y_scale * one );
+  c.rv = lround( 2 * ( 1 - kr ) * c_scale * one );
+  c.bu = lround( 2 * ( 1 - kb ) * c_scale * one );
+  c.gu = lround( -2 * kb * ( 1 - kb ) / kg * c_scale * one );
+  c.gv = lround( -2 * kr * ( 1 - kr ) / kg * c_scale * one );
+
+  return c;
+}
+
+inline uint8_t clamp8( const int32_t value )
+{
+  return min( max( value, 0 ), 255 );
+}
+
+void put_chroma( const MutableFrameView & frame, const unsigned int row_pair, const unsigned int cx,
+                 const uint8_t u, const uint8_t v )
+{
+  if ( frame.format == PixelFormat::I420 ) {
+    frame.planes[ 1 ][ row_pair * frame.strides[ 1 ] + cx ] = u;
+    frame.planes[ 2 ][ row_pair * frame.strides[ 2 ] + cx ] = v;
+  } else {
+    frame.planes[ 1 ][ row_pair * frame.strides[ 1 ] + 2 * cx ] = u;
+    frame.planes[ 1 ][ row_pair * frame.strides[ 1 ] + 2 * cx + 1 ] = v;
+  }
+}
+
+void get_chroma( const FrameView & frame, const unsigned int row_pair, const unsigned int cx,
+                 int32_t & u, int32_t & v )
+{
+  if ( frame.format == PixelFormat::I420 ) {
+    u = frame.planes[ 1 ][ row_pair * frame.strides[ 1 ] + cx ];
+    v = frame.planes[ 2 ][ row_pair * frame.strides[ 2 ] + cx ];
+  } else {
+    u = frame.planes[ 1 ][ row_pair * frame.strides[ 1 ] + 2 * cx ];
+    v = frame.planes[ 1 ][ row_pair * frame.strides[ 1 ] + 2 * cx + 1 ];
+  }
+}
+
+/* reference implementations: convert one pair of rows, from column x_begin (even) on */
+
+void bgrx_to_yuv_scalar( const FrameView & source, const MutableFrameView & destination,
+                         const ForwardCoefficients & c, const unsigned int row_pair,
+                         const unsigned int x_begin )
+{
+  const unsigned int y0 = 2 * row_pair;
+  const unsigned int y1 = min( y0 + 1, source.height - 1 );
+  const uint8_t * in[ 2 ] = { source.planes[ 0 ] + y0 * source.strides[ 0 ],
+                              source.planes[ 0 ] + y1 * source.strides[ 0 ] };
+
+  for ( unsigned int r = 0; r < ( y1 > y0 ? 2u : 1u ); r++ ) {
+    uint8_t * luma = destination.planes[ 0 ] + ( y0 + r ) * destination.strides[ 0 ];
+    for ( unsigned int x = x_begin; x < source.width; x++ ) {
+      const uint8_t * p = in[ r ] + 4 * x;
+      luma[ x ] = clamp8( ( c.yr * p[ 2 ] + c.yg * p[ 1 ] + c.yb * p[ 0 ] + c.y_bias ) >> 14 );
+    }
+  }
+
+  for ( unsigned int cx = x_begin / 2; cx < destination.chroma_width(); cx++ ) {
+    const unsigned int x0 = 2 * cx;
+    const unsigned int x1 = min( x0 + 1, source.width - 1 );
+
+    int32_t b = 0, g = 0, r = 0;
+    for ( const uint8_t * row : in ) {
+      for ( const unsigned int x : { x0, x1 } ) {
+        b += row[ 4 * x ];
+        g += row[ 4 * x + 1 ];
+        r += row[ 4 * x + 2 ];
+      }
+    }
+
+    put_chroma( destination, row_pair, cx,
+                clamp8( ( c.ur * r + c.ug * g + c.ub * b + c.c_bias ) >> 16 ),
+                clamp8( ( c.vr * r + c.vg * g + c.vb * b + c.c_bias ) >> 16 ) );
+  }
+}
+
+void yuv_to_bgrx_scalar( const FrameView & source, const MutableFrameView & destination,
+                         const InverseCoefficients & c, const unsigned int row_pair,
+                         const unsigned int x_begin )
+{
+  for ( unsigned int y = 2 * row_pair; y < min( 2 * row_pair + 2, source.height ); y++ ) {
+    const uint8_t * luma = source.planes[ 0 ] + y * source.strides[ 0 ];
+    uint8_t * out = destination.planes[ 0 ] + y * destination.strides[ 0 ];
+
+    for ( unsigned int x = x_begin; x < source.width; x++ ) {
+      int32_t u, v;
+      get_chroma( source, row_pair, x / 2, u, v );
+      u -= 128;
+      v -= 128;
+      const int32_t scaled_y = c.ys * ( luma[ x ] - c.y_offset );
+
+      out[ 4 * x ] = clamp8( ( scaled_y + c.bu * u + inverse_round ) >> 13 );
+      out[ 4 * x + 1 ] = clamp8( ( scaled_y + c.gu * u + c.gv * v + inverse_round ) >> 13 );
+      out[ 4 * x + 2 ] = clamp8( ( scaled_y + c.rv * v + inverse_round ) >> 13 );
+      out[ 4 * x + 3 ] = 0;
+    }
+  }
+}
+
+/* AVX2 kernels: same arithmetic, eight pixels per vector; they return
+   the column where the scalar code must take over */
+
+__attribute__(( target( "avx2" ) ))
+inline uint64_t pack_bytes( const __m256i values )
+{
+  const __m256i words = _mm256_packus_epi32( values, values );
+  const __m256i bytes = _mm256_packus_epi16( words, words );
+  return uint64_t( uint32_t( _mm256_cvtsi256_si32( bytes ) ) )
+    | uint64_t( uint32_t( _mm256_extract_epi32( bytes, 4 ) ) ) << 32;
+}
+
+__attribute__(( target( "avx2" ) ))
+unsigned int bgrx_to_yuv_avx2( const FrameView & source, const MutableFrameView & destination,
+                               const ForwardCoefficients & c, const unsigned int row_pair )
+{
+  const unsigned int y0 = 2 * row_pair;
+  const unsigned int y1 = min( y0 + 1, source.height - 1 );
+  const bool two_rows = y1 > y0;
+  const uint8_t * in[ 2 ] = { source.planes[ 0 ] + y0 * source.strides[ 0 ],
+                              source.planes[ 0 ] + y1 * source.strides[ 0 ] };
+  uint8_t * luma[ 2 ] = { destination.planes[ 0 ] + y0 * destination.strides[ 0 ],
+                          destination.planes[ 0 ] + y1 * destination.strides[ 0 ] };
+  const unsigned int end = source.width & ~15u;
+
+  const __m256i byte_mask = _mm256_set1_epi32( 0xFF );
+  const __m256i yr = _mm256_set1_epi32( c.yr ), yg = _mm256_set1_epi32( c.yg ), yb = _mm256_set1_epi32( c.yb );
+  const __m256i y_bias = _mm256_set1_epi32( c.y_bias );
+  const __m256i ur = _mm256_set1_epi32( c.ur ), ug = _mm256_set1_epi32( c.ug ), ub = _mm256_set1_epi32( c.ub );
+  const __m256i vr = _mm256_set1_epi32( c.vr ), vg = _mm256_set1_epi32( c.vg ), vb = _mm256_set1_epi32( c.vb );
+  const __m256i c_bias = _mm256_set1_epi32( c.c_bias );
+
+  for ( unsigned int x = 0; x < end; x += 16 ) {
+    __m256i b_sums[ 2 ], g_sums[ 2 ], r_sums[ 2 ];
+
+    for ( unsigned int half = 0; half < 2; half++ ) {
+      b_sums[ half ] = g_sums[ half ] = r_sums[ half ] = _mm256_setzero_si256();
+
+      for ( unsigned int r = 0; r < 2; r++ ) {
+        const __m256i pixels = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( in[ r ] + 4 * ( x + 8 * half ) ) );
+        const __m256i blue = _mm256_and_si256( pixels, byte_mask );
+        const __m256i green = _mm256_and_si256( _mm256_srli_epi32( pixels, 8 ), byte_mask );
+        const __m256i red = _mm256_and_si256( _mm256_srli_epi32( pixels, 16 ), byte_mask );
+
+        if ( r == 0 or two_rows ) {
+          const __m256i y = _mm256_srai_epi32( _mm256_add_epi32( _mm256_add_epi32( _mm256_mullo_epi32( red, yr ),
+                                                                                   _mm256_mullo_epi32( green, yg ) ),
+                                                                 _mm256_add_epi32( _mm256_mullo_epi32( blue, yb ),
+                                                                                   y_bias ) ), 14 );
+          const uint64_t packed = pack_bytes( y );
+          memcpy( luma[ r ] + x + 8 * half, &packed, sizeof( packed ) );
+        }
+
+        b_sums[ half ] = _mm256_add_epi32( b_sums[ half ], blue );
+        g_sums[ half ] = _mm256_add_epi32( g_sums[ half ], green );
+        r_sums[ half ] = _mm256_add_epi32( r_sums[ half ], red );
+      }
+    }
+
+    /* add horizontal neighbours, then undo hadd's lane interleaving */
+    const __m256i blue = _mm256_permute4x64_epi64( _mm256_hadd_epi32( b_sums[ 0 ], b_sums[ 1 ] ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+    const __m256i green = _mm256_permute4x64_epi64( _mm256_hadd_epi32( g_sums[ 0 ], g_sums[ 1 ] ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+    const __m256i red = _mm256_permute4x64_epi64( _mm256_hadd_epi32( r_sums[ 0 ], r_sums[ 1 ] ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+
+    const __m256i u = _mm256_srai_epi32( _mm256_add_epi32( _mm256_add_epi32( _mm256_mullo_epi32( red, ur ),
+                                                                             _mm256_mullo_epi32( green, ug ) ),
+                                                           _mm256_add_epi32( _mm256_mullo_epi32( blue, ub ),
+                                                                             c_bias ) ), 16 );
+    const __m256i v = _mm256_srai_epi32( _mm256_add_epi32( _mm256_add_epi32( _mm256_mullo_epi32( red, vr ),
+                                                                             _mm256_mullo_epi32( green, vg ) ),
+                                                           _mm256_add_epi32( _mm256_mullo_epi32( blue, vb ),
+                                                                             c_bias ) ), 16 );
+
+    const uint64_t packed_u = pack_bytes( u ), packed_v = pack_bytes( v );
+
+    if ( destination.format == PixelFormat::I420 ) {
+      memcpy( destination.planes[ 1 ] + row_pair * destination.strides[ 1 ] + x / 2, &packed_u, sizeof( packed_u ) );
+      memcpy( destination.planes[ 2 ] + row_pair * destination.strides[ 2 ] + x / 2, &packed_v, sizeof( packed_v ) );
+    } else {
+      const __m128i interleaved = _mm_unpacklo_epi8( _mm_cvtsi64_si128( packed_u ), _mm_cvtsi64_si128( packed_v ) );
+      _mm_storeu_si128( reinterpret_cast<__m128i *>( destination.planes[ 1 ] + row_pair * destination.strides[ 1 ] + x ),
+                        interleaved );
+    }
+  }
+
+  return end;
+}
+
+__attribute__(( target( "avx2" ) ))
+unsigned int yuv_to_bgrx_avx2( const FrameView & source, const MutableFrameView & destination,
+                               const InverseCoefficients & c, const unsigned int row_pair )
+{
+  const unsigned int end = source.width & ~7u;
+
+  const __m256i duplicate = _mm256_setr_epi32( 0, 0, 1, 1, 2, 2, 3, 3 );
+  const __m256i evens = _mm256_setr_epi32( 0, 0, 2, 2, 4, 4, 6, 6 );
+  const __m256i odds = _mm256_setr_epi32( 1, 1, 3, 3, 5, 5, 7, 7 );
+  const __m256i y_offset = _mm256_set1_epi32( c.y_offset );
+  const __m256i chroma_offset = _mm256_set1_epi32( 128 );
+  const __m256i ys = _mm256_set1_epi32( c.ys );
+  const __m256i rv = _mm256_set1_epi32( c.rv ), bu = _mm256_set1_epi32( c.bu );
+  const __m256i gu = _mm256_set1_epi32( c.gu ), gv = _mm256_set1_epi32( c.gv );
+  const __m256i round = _mm256_set1_epi32( inverse_round );
+  const __m256i zero = _mm256_setzero_si256(), max = _mm256_set1_epi32( 255 );
+
+  for ( unsigned int y = 2 * row_pair; y < min( 2 * row_pair + 2, source.height ); y++ ) {
+    const uint8_t * luma = source.planes[ 0 ] + y * source.strides[ 0 ];
+    uint8_t * out = destination.planes[ 0 ] + y * destination.strides[ 0 ];
+
+    for ( unsigned int x = 0; x < end; x += 8 ) {
+      const __m256i luma_values = _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast<const __m128i *>( luma + x ) ) );
+
+      __m256i u, v;
+      if ( source.format == PixelFormat::I420 ) {
+        uint32_t four_u, four_v;
+        memcpy( &four_u, source.planes[ 1 ] + row_pair * source.strides[ 1 ] + x / 2, sizeof( four_u ) );
+        memcpy( &four_v, source.planes[ 2 ] + row_pair * source.strides[ 2 ] + x / 2, sizeof( four_v ) );
+        u = _mm256_permutevar8x32_epi32( _mm256_cvtepu8_epi32( _mm_cvtsi32_si128( four_u ) ), duplicate );
+        v = _mm256_permutevar8x32_epi32( _mm256_cvtepu8_epi32( _mm_cvtsi32_si128( four_v ) ), duplicate );
+      } else {
+        const __m256i uv = _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast<const __m128i *>(
+          source.planes[ 1 ] + row_pair * source.strides[ 1 ] + x ) ) );
+        u = _mm256_permutevar8x32_epi32( uv, evens );
+        v = _mm256_permutevar8x32_epi32( uv, odds );
+      }
+
+      u = _mm256_sub_epi32( u, chroma_offset );
+      v = _mm256_sub_epi32( v, chroma_offset );
+      const __m256i scaled_y = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_sub_epi32( luma_values, y_offset ), ys ), round );
+
+      __m256i blue = _mm256_srai_epi32( _mm256_add_epi32( scaled_y, _mm256_mullo_epi32( u, bu ) ), 13 );
+      __m256i green = _mm256_srai_epi32( _mm256_add_epi32( scaled_y, _mm256_add_epi32( _mm256_mullo_epi32( u, gu ),
+                                                                                        _mm256_mullo_epi32( v, gv ) ) ), 13 );
+      __m256i red = _mm256_srai_epi32( _mm256_add_epi32( scaled_y, _mm256_mullo_epi32( v, rv ) ), 13 );
+
+      blue = _mm256_min_epi32( _mm256_max_epi32( blue, zero ), max );
+      green = _mm256_min_epi32( _mm256_max_epi32( green, zero ), max );
+      red = _mm256_min_epi32( _mm256_max_epi32( red, zero ), max );
+
+      const __m256i pixels = _mm256_or_si256( blue, _mm256_or_si256( _mm256_slli_epi32( green, 8 ),
+                                                                     _mm256_slli_epi32( red, 16 ) ) );
+      _mm256_storeu_si256( reinterpret_cast<__m256i *>( out + 4 * x ), pixels );
+    }
+  }
+
+  return end;
+}
+
+/* row pairs handed to a thread at a time */
+const unsigned int band_height = 8;
+
+}
+
+void convert_frame( const FrameView & source, const MutableFrameView & destination,
+                    const ColorSpace & color_space, const unsigned int threads,
+                    const ColorKernel kernel )
+{
+  if ( source.width != destination.width or source.height != destination.height ) {
+    throw runtime_error( "convert_frame: frames differ in size" );
+  }
+
+  if ( not color_kernel_available( kernel ) ) {
+    throw runtime_error( "convert_frame: kernel not supported by this CPU" );
+  }
+
+  const bool use_avx2 = kernel == ColorKernel::AVX2
+    or ( kernel == ColorKernel::Auto and color_kernel_available( ColorKernel::AVX2 ) );
+
+  const unsigned int row_pairs = ( source.height + 1 ) / 2;
+  const unsigned int bands = ( row_pairs + band_height - 1 ) / band_height;
+
+  auto for_each_row_pair = [&]( auto && convert ) {
+    parallel_for( bands, threads, [&]( const size_t band ) {
+        for ( unsigned int row_pair = band * band_height;
+              row_pair < min<unsigned int>( ( band + 1 ) * band_height, row_pairs );
+              row_pair++ ) {
+          convert( row_pair );
+        }
+      } );
+  };
+
+  if ( source.format == PixelFormat::BGRX and destination.format != PixelFormat::BGRX ) {
+    const ForwardCoefficients c = forward_coefficients( color_space );
+    for_each_row_pair( [&]( const unsigned int row_pair ) {
+        const unsigned int x = use_avx2 ? bgrx_to_yuv_avx2( source, destination, c, row_pair ) : 0;
+        bgrx_to_yuv_scalar( source, destination, c, row_pair, x );
+      } );
+  } else if ( source.format != PixelFormat::BGRX and destination.format == PixelFormat::BGRX ) {
+    const InverseCoefficients c = inverse_coefficients( color_space );
+    for_each_row_pair( [&]( const unsigned int row_pair ) {
+        const unsigned int x = use_avx2 ? yuv_to_bgrx_avx2( source, destination, c, row_pair ) : 0;
+        yuv_to_bgrx_scalar( source, destination, c, row_pair, x );
+      } );
+  } else {
+    throw runtime_error( "convert_frame: unsupported conversion from " + pixel_format_name( source.format )
+                         + " to " + pixel_format_name( destination.format ) );
+  }
+}
@@ -0,0 +1,46 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef COLORSPACE_HH
+#define COLORSPACE_HH
+
+/* conversion between BGRX frames and planar YUV (I420 or NV12)
+
+   Both directions use 32-bit fixed-point arithmetic. The vectorized
+   kernels compute exactly the same values as the scalar reference, so
+   their output is bit-identical. Chroma is the average of each 2x2 block
+   on the way to YUV, and is replicated to each 2x2 block on the way back. */
+
+#include <string>
+
+#include "frame_view.hh"
+
+enum class ColorMatrix { BT601, BT709 };
+enum class ColorRange { Limited, Full };
+
+struct ColorSpace
+{
+  ColorMatrix matrix { ColorMatrix::BT601 };
+  ColorRange range { ColorRange::Limited };
+};
+
+ColorMatrix parse_color_matrix( const std::string & name );
+ColorRange parse_color_range( const std::string & name );
+
+/* which implementation to run */
+enum class ColorKernel
+{
+  Auto,   /* the fastest one this CPU supports */
+  Scalar, /* the reference implementation */
+  AVX2,
+};
+
+bool color_kernel_available( const ColorKernel kernel );
+
+/* convert between BGRX and I420/NV12 frames of the same size, splitting
+   the rows among up to `threads` threads */
+void convert_frame( const FrameView & source, const MutableFrameView & destination,
+                    const ColorSpace & color_space = ColorSpace(),
+                    const unsigned int threads = 1,
+                    const ColorKernel kernel = ColorKernel::Auto );
+
+#endif /* COLORSPACE_HH */
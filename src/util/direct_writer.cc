@@ -0,0 +1,240 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "direct_writer.hh"
+#include "exception.hh"
+#include "stats.hh"
+
+using namespace std;
+
+/* O_DIRECT wants offsets, lengths and addresses aligned to the logical
+   block size; a page covers every device we expect to see */
+static const size_t alignment = 4096;
+
+static Stats::Probe write_probe { "direct_writer.write" };
+static Stats::Probe stall_probe { "direct_writer.stall" };
+static Stats::Probe queue_probe { "direct_writer.queue", Stats::Unit::Count };
+
+static size_t round_up( const size_t length )
+{
+  return ( length + alignment - 1 ) / alignment * alignment;
+}
+
+static int open_output( const string & filename, bool & direct )
+{
+  const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+  if ( direct ) {
+    const int fd = open( filename.c_str(), flags | O_DIRECT, 0644 );
+    if ( fd >= 0 ) {
+      return fd;
+    }
+    if ( errno != EINVAL ) {
+      throw unix_error( filename );
+    }
+    /* the filesystem doesn't do O_DIRECT */
+    direct = false;
+  }
+
+  return SystemCall( filename, open( filename.c_str(), flags, 0644 ) );
+}
+
+static MMap_Region::Options buffer_options()
+{
+  MMap_Region::Options options;
+  options.hugepages = getenv( "CAPTAIN_EO_HUGEPAGES" ) != nullptr;
+  return options;
+}
+
+DirectWriter::DirectWriter( const string & filename, const Options & options )
+  : direct_( options.direct ),
+    fd_( open_output( filename, direct_ ) ),
+    buffer_length_( round_up( max( options.buffer_length, size_t( 1 ) ) ) ),
+    memory_( buffer_length_ * max( options.buffers, 1u ), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0, buffer_options() ),
+    thread_()
+{
+  if ( options.preallocate ) {
+    /* reserve the space without changing the size, so close() needn't
+       trim it; not every filesystem can */
+    if ( fallocate( fd_.fd_num(), FALLOC_FL_KEEP_SIZE, 0, options.preallocate ) < 0
+         and errno != EOPNOTSUPP ) {
+      throw unix_error( "fallocate" );
+    }
+  }
+
+  for ( size_t offset = 0; offset < memory_.length(); offset += buffer_length_ ) {
+    free_.push_back( memory_.addr() + offset );
+  }
+
+  thread_ = thread( &DirectWriter::write_loop, this );
+}
+
+DirectWriter::DirectWriter( const string & filename )
+  : DirectWriter( filename, Options {} )
+{}
+
+DirectWriter::~DirectWriter()
+{
+  try {
+    close();
+  } catch ( const exception & e ) {
+    print_exception( "DirectWriter", e );
+  }
+}
+
+void DirectWriter::rethrow()
+{
+  lock_guard<mutex> guard { lock_ };
+  if ( error_ ) {
+    rethrow_exception( error_ );
+  }
+}
+
+void DirectWriter::take_buffer()
+{
+  unique_lock<mutex> guard { lock_ };
+
+  if ( free_.empty() and not error_ ) {
+    /* the disk is behind: every buffer is waiting to be written */
+    const uint64_t start = Stats::now_ns();
+    changed_.wait( guard, [&] { return not free_.empty() or error_; } );
+    const uint64_t stall = Stats::now_ns() - start;
+    total_stall_ns_ += stall;
+    if ( Stats::enabled() ) {
+      Stats::record( stall_probe, stall );
+    }
+  }
+
+  if ( error_ ) {
+    rethrow_exception( error_ );
+  }
+
+  current_ = free_.back();
+  free_.pop_back();
+  filled_ = 0;
+}
+
+void DirectWriter::hand_off( const size_t length )
+{
+  size_t padded = length;
+  if ( direct_ ) {
+    padded = round_up( length );
+    memset( current_ + length, 0, padded - length );
+  }
+
+  {
+    lock_guard<mutex> guard { lock_ };
+    queued_.emplace_back( current_, padded );
+    max_queue_depth_ = max( max_queue_depth_, queued_.size() );
+    if ( Stats::enabled() ) {
+      Stats::record( queue_probe, queued_.size() );
+    }
+  }
+  changed_.notify_all();
+
+  current_ = nullptr;
+  filled_ = 0;
+}
+
+void DirectWriter::write( const Chunk & chunk )
+{
+  if ( not thread_.joinable() ) {
+    throw runtime_error( "DirectWriter: write after close" );
+  }
+
+  rethrow();
+
+  Chunk remaining = chunk;
+  while ( remaining.size() ) {
+    if ( not current_ ) {
+      take_buffer();
+    }
+
+    const size_t amount = min( remaining.size(), buffer_length_ - filled_ );
+    memcpy( current_ + filled_, remaining.buffer(), amount );
+    filled_ += amount;
+    bytes_accepted_ += amount;
+    remaining = remaining( amount );
+
+    if ( filled_ == buffer_length_ ) {
+      hand_off( filled_ );
+    }
+  }
+}
+
+void DirectWriter::write_loop()
+{
+  while ( true ) {
+    pair<uint8_t *, size_t> buffer;
+    {
+      unique_lock<mutex> guard { lock_ };
+      changed_.wait( guard, [&] { return not queued_.empty() or closing_; } );
+      if ( queued_.empty() ) {
+        return;
+      }
+      buffer = queued_.front();
+      queued_.pop_front();
+    }
+
+    try {
+      const uint64_t start = Stats::now_ns();
+      {
+        const Stats::ScopedTimer timer { write_probe };
+        size_t done = 0;
+        while ( done < buffer.second ) {
+          const ssize_t written = SystemCall( "pwrite",
+            pwrite( fd_.fd_num(), buffer.first + done, buffer.second - done, bytes_written_ + done ) );
+          if ( written == 0 ) {
+            throw internal_error( "pwrite", "returned 0" );
+          }
+          done += written;
+        }
+      }
+      bytes_written_ += buffer.second;
+      max_write_ns_ = max( max_write_ns_, Stats::now_ns() - start );
+    } catch ( ... ) {
+      lock_guard<mutex> guard { lock_ };
+      if ( not error_ ) {
+        error_ = current_exception();
+      }
+    }
+
+    {
+      lock_guard<mutex> guard { lock_ };
+      free_.push_back( buffer.first );
+    }
+    changed_.notify_all();
+  }
+}
+
+void DirectWriter::close()
+{
+  if ( not thread_.joinable() ) {
+    return;
+  }
+
+  if ( current_ and filled_ ) {
+    hand_off( filled_ );
+  }
+
+  {
+    lock_guard<mutex> guard { lock_ };
+    closing_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+
+  rethrow();
+
+  /* drop the padding on the last buffer */
+  if ( direct_ ) {
+    SystemCall( "ftruncate", ftruncate( fd_.fd_num(), bytes_accepted_ ) );
+  }
+}
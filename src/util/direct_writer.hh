@@ -0,0 +1,90 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef DIRECT_WRITER_HH
+#define DIRECT_WRITER_HH
+
+/* a file writer for sustained recording
+
+   write() copies into one of a few large aligned buffers; when a buffer
+   fills, a background thread writes it out with O_DIRECT, so the page
+   cache neither fills up nor stalls the caller on writeback. The caller
+   only waits when every buffer is still queued for the disk. The file
+   can be preallocated with fallocate() to keep the filesystem from
+   fragmenting it. If the filesystem refuses O_DIRECT (tmpfs, say), the
+   writes go through the page cache instead, still on the background
+   thread. */
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chunk.hh"
+#include "file_descriptor.hh"
+#include "mmap_region.hh"
+
+class DirectWriter
+{
+public:
+  struct Options
+  {
+    unsigned int buffers { 3 };
+    size_t buffer_length { 8 << 20 }; /* rounded up to the alignment */
+    bool direct { true };
+    uint64_t preallocate { 0 }; /* bytes to reserve up front */
+  };
+
+private:
+  bool direct_; /* cleared if the filesystem refuses O_DIRECT */
+  FileDescriptor fd_;
+  size_t buffer_length_;
+  MMap_Region memory_;
+
+  std::mutex lock_ {};
+  std::condition_variable changed_ {};
+  std::vector<uint8_t *> free_ {};
+  std::deque<std::pair<uint8_t *, size_t>> queued_ {};
+  bool closing_ { false };
+  std::exception_ptr error_ {};
+
+  uint8_t * current_ { nullptr };
+  size_t filled_ { 0 };
+  uint64_t bytes_written_ { 0 }, bytes_accepted_ { 0 };
+
+  /* the worst seen, for telling whether a recording rate is sustainable */
+  uint64_t max_write_ns_ { 0 }, total_stall_ns_ { 0 };
+  size_t max_queue_depth_ { 0 };
+
+  std::thread thread_;
+
+  void hand_off( const size_t length );
+  void take_buffer();
+  void write_loop();
+  void rethrow();
+
+public:
+  DirectWriter( const std::string & filename, const Options & options );
+  DirectWriter( const std::string & filename );
+  ~DirectWriter();
+
+  void write( const Chunk & chunk );
+
+  /* write out everything, trim the file to what was written, and stop
+     the thread; called by the destructor if need be */
+  void close();
+
+  bool direct() const { return direct_; }
+  uint64_t bytes_written() const { return bytes_accepted_; }
+  uint64_t max_write_ns() const { return max_write_ns_; }
+  uint64_t total_stall_ns() const { return total_stall_ns_; }
+  size_t max_queue_depth() const { return max_queue_depth_; }
+
+  DirectWriter( const DirectWriter & other ) = delete;
+  DirectWriter & operator=( const DirectWriter & other ) = delete;
+};
+
+#endif /* DIRECT_WRITER_HH */
@@ -1,27 +1,245 @@
 /* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
+#include <algorithm>
+#include <cerrno>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
 
 #include "file.hh"
 #include "exception.hh"
 
 using namespace std;
 
-File::File( const string & filename )
-  : File( SystemCall( filename, open( filename.c_str(), O_RDONLY ) ) )
+static int fadvice( const MMap_Region::Access access )
+{
+  switch ( access ) {
+  case MMap_Region::Access::Normal: return POSIX_FADV_NORMAL;
+  case MMap_Region::Access::Sequential: return POSIX_FADV_SEQUENTIAL;
+  case MMap_Region::Access::Random: return POSIX_FADV_RANDOM;
+  case MMap_Region::Access::WillNeed: return POSIX_FADV_WILLNEED;
+  }
+
+  throw LogicError();
+}
+
+File::File( const string & filename, const MMap_Region::Options & options, const size_t window_length )
+  : File( SystemCall( filename, open( filename.c_str(), O_RDONLY ) ), options, window_length )
 { }
 
-File::File( FileDescriptor && fd )
+File::File( FileDescriptor && fd, const MMap_Region::Options & options, const size_t window_length )
   : fd_( move( fd ) ),
     size_( fd_.size() ),
-    mmap_region_( MMap_Region( size_, PROT_READ, MAP_SHARED, fd_.fd_num() ) ),
-    chunk_( mmap_region_.addr(), size_ )
-{ }
+    options_( options ),
+    window_length_( window_length ),
+    mmap_region_(),
+    window_offset_( 0 ),
+    chunk_( nullptr, 0 ),
+    mapped_( false ),
+    map_lock_()
+{
+  /* tune readahead for the whole file, whatever is mapped */
+  if ( options_.access != MMap_Region::Access::Normal ) {
+    const int ret = posix_fadvise( fd_.fd_num(), 0, 0, fadvice( options_.access ) );
+    if ( ret ) {
+      throw unix_error( "posix_fadvise", ret );
+    }
+  }
+
+  if ( windowed() ) {
+    map_window( 0, min( window_length_, size_ ) );
+  }
+}
 
 File::File( File && other )
   : fd_( move( other.fd_ ) ),
     size_( move( other.size_ ) ),
+    options_( other.options_ ),
+    window_length_( other.window_length_ ),
     mmap_region_( move( other.mmap_region_ ) ),
-    chunk_( move( other.chunk_ ) )
+    window_offset_( other.window_offset_ ),
+    chunk_( move( other.chunk_ ) ),
+    mapped_( other.mapped_.load() ),
+    map_lock_()
 { }
+
+void File::map_window( const uint64_t offset, const uint64_t length ) const
+{
+  mmap_region_.reset();
+  window_offset_ = offset;
+
+  /* an empty file (perhaps one about to be written) cannot be mapped */
+  if ( length == 0 ) {
+    chunk_ = Chunk( nullptr, 0 );
+  } else {
+    mmap_region_.emplace( length, PROT_READ, MAP_SHARED, fd_.fd_num(), offset, options_ );
+    chunk_ = Chunk( mmap_region_->addr(), length );
+  }
+
+  mapped_.store( true, memory_order_release );
+}
+
+void File::map_whole() const
+{
+  if ( not mapped_.load( memory_order_acquire ) ) {
+    lock_guard<mutex> guard { map_lock_ };
+    if ( not mapped_.load( memory_order_relaxed ) ) {
+      map_window( 0, size_ );
+    }
+  }
+}
+
+const Chunk & File::chunk( void ) const
+{
+  if ( windowed() ) {
+    throw runtime_error( "File: whole-file chunk unavailable in sliding-window mode" );
+  }
+
+  map_whole();
+
+  if ( window_offset_ != 0 or chunk_.size() != size_ ) {
+    throw runtime_error( "File: whole-file chunk unavailable once narrowed" );
+  }
+
+  return chunk_;
+}
+
+const Chunk File::operator() ( const uint64_t & offset, const uint64_t & length ) const
+{
+  if ( windowed() and ( offset < window_offset_
+                        or offset + length > window_offset_ + chunk_.size() ) ) {
+    if ( offset + length > size_ ) {
+      throw out_of_range( "attempted to read past end of file" );
+    }
+
+    /* sliding forward: everything before the new window has been consumed */
+    if ( offset > window_offset_ ) {
+      release( window_offset_, min( offset, window_offset_ + chunk_.size() ) - window_offset_ );
+    }
+
+    map_window( offset, min( max<uint64_t>( window_length_, length ), size_ - offset ) );
+  } else if ( not windowed() ) {
+    map_whole();
+  }
+
+  return chunk_( offset - window_offset_, length );
+}
+
+void File::narrow( const uint64_t offset, const uint64_t length )
+{
+  if ( windowed() ) {
+    throw runtime_error( "File: cannot narrow in sliding-window mode" );
+  }
+
+  if ( offset > size_ or length > size_ - offset ) {
+    throw out_of_range( "File: narrowed past end of file" );
+  }
+
+  map_window( offset, length );
+}
+
+size_t File::refresh()
+{
+  const size_t new_size = fd_.size();
+
+  if ( new_size < size_ ) {
+    throw runtime_error( "File: file shrank while being read" );
+  }
+
+  if ( new_size > size_ ) {
+    size_ = new_size;
+
+    /* in sliding-window mode the next read past the window maps the new data */
+    if ( not windowed() and mapped_ ) {
+      if ( mmap_region_ ) {
+        mmap_region_->extend( size_ );
+        chunk_ = Chunk( mmap_region_->addr(), size_ );
+      } else {
+        map_window( 0, size_ );
+      }
+    }
+  }
+
+  return size_;
+}
+
+void File::release( const uint64_t offset, const uint64_t length ) const
+{
+  /* unmap whatever part of the range is in the current mapping */
+  const uint64_t mapped_start = max( offset, window_offset_ );
+  const uint64_t mapped_end = min( offset + length, window_offset_ + chunk_.size() );
+  if ( mapped_end > mapped_start ) {
+    mmap_region_->discard( mapped_start - window_offset_, mapped_end - mapped_start );
+  }
+
+  /* and let the kernel evict it from the page cache */
+  const int ret = posix_fadvise( fd_.fd_num(), offset, length, POSIX_FADV_DONTNEED );
+  if ( ret ) {
+    throw unix_error( "posix_fadvise", ret );
+  }
+}
+
+MutableFile::MutableFile( const string & filename )
+  : MutableFile( SystemCall( filename, open( filename.c_str(), O_RDWR ) ) )
+{ }
+
+MutableFile::MutableFile( FileDescriptor && fd )
+  : fd_( move( fd ) ),
+    size_( fd_.size() ),
+    mmap_region_( MMap_Region( size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_.fd_num() ) )
+{ }
+
+MutableFile::MutableFile( MutableFile && other )
+  : fd_( move( other.fd_ ) ),
+    size_( move( other.size_ ) ),
+    mmap_region_( move( other.mmap_region_ ) )
+{ }
+
+string clone_file( const FileDescriptor & source, FileDescriptor & destination )
+{
+  struct stat source_info, destination_info;
+  SystemCall( "fstat", fstat( source.fd_num(), &source_info ) );
+  SystemCall( "fstat", fstat( destination.fd_num(), &destination_info ) );
+  if ( source_info.st_dev == destination_info.st_dev and source_info.st_ino == destination_info.st_ino ) {
+    throw runtime_error( "clone_file: the destination is the source itself" );
+  }
+
+  SystemCall( "ftruncate", ftruncate( destination.fd_num(), 0 ) );
+
+  /* best case: the filesystem shares the extents and copies nothing */
+  if ( ioctl( destination.fd_num(), FICLONE, source.fd_num() ) == 0 ) {
+    return "FICLONE";
+  }
+
+  /* next best: let the kernel copy (and possibly share) the data */
+  const uint64_t size = source.size();
+  loff_t in_offset = 0, out_offset = 0;
+  while ( static_cast<uint64_t>( in_offset ) < size ) {
+    const ssize_t copied = copy_file_range( source.fd_num(), &in_offset,
+                                            destination.fd_num(), &out_offset,
+                                            size - in_offset, 0 );
+    if ( copied < 0 ) {
+      if ( in_offset == 0 and ( errno == EXDEV or errno == ENOSYS or errno == EOPNOTSUPP ) ) {
+        break; /* fall back to a plain copy */
+      }
+      throw unix_error( "copy_file_range" );
+    } else if ( copied == 0 ) {
+      throw runtime_error( "copy_file_range: source ended early" );
+    }
+  }
+
+  if ( static_cast<uint64_t>( in_offset ) == size ) {
+    return "copy_file_range";
+  }
+
+  /* last resort: copy through a read-only mapping of the source */
+  if ( size > 0 ) {
+    MMap_Region source_map( size, PROT_READ, MAP_SHARED, source.fd_num() );
+    destination.write( Chunk( source_map.addr(), size ) );
+  }
+
+  return "read/write";
+}
@@ -5,6 +5,9 @@
 
 /* memory-mapped read-only file wrapper */
 
+#include <atomic>
+#include <mutex>
+#include <optional>
 #include <string>
 
 #include "file_descriptor.hh"
@@ -16,18 +19,49 @@ class File
 private:
   FileDescriptor fd_;
   size_t size_;
-  MMap_Region mmap_region_;
-  Chunk chunk_;
+  MMap_Region::Options options_;
+
+  /* in sliding-window mode only window_length_ bytes are mapped at a time */
+  size_t window_length_;
+  mutable std::optional<MMap_Region> mmap_region_;
+  mutable uint64_t window_offset_;
+  mutable Chunk chunk_;
+
+  /* without a window, the whole file is mapped on first use (by
+     whichever thread gets there first), so that narrow() beforehand
+     maps only its range */
+  mutable std::atomic<bool> mapped_;
+  mutable std::mutex map_lock_;
+
+  void map_window( const uint64_t offset, const uint64_t length ) const;
+  void map_whole() const;
 
 public:
-  File( const std::string & filename );
-  File( FileDescriptor && fd );
+  File( const std::string & filename,
+        const MMap_Region::Options & options = {}, const size_t window_length = 0 );
+  File( FileDescriptor && fd,
+        const MMap_Region::Options & options = {}, const size_t window_length = 0 );
+
+  /* the whole file (not available in sliding-window mode or once narrowed) */
+  const Chunk & chunk( void ) const;
+
+  /* in sliding-window mode, moving past the current window remaps the file
+     and invalidates chunks returned earlier */
+  const Chunk operator() ( const uint64_t & offset, const uint64_t & length ) const;
+
+  /* map only [offset, offset + length) of the file, for a reader that
+     needs no more; reads elsewhere then fail (not in sliding-window mode,
+     which maps only what is read anyway) */
+  void narrow( const uint64_t offset, const uint64_t length );
 
-  const Chunk & chunk( void ) const { return chunk_; }
-  const Chunk operator() ( const uint64_t & offset, const uint64_t & length ) const
-  {
-    return chunk_( offset, length );
-  }
+  /* drop a range that will not be read again from the mapping and the page cache */
+  void release( const uint64_t offset, const uint64_t length ) const;
+
+  bool windowed( void ) const { return window_length_ > 0; }
+
+  /* pick up growth of a file that is still being written, extending the
+     mapping to cover it; returns the new size */
+  size_t refresh();
 
   /* Disallow copying */
   File( const File & other ) = delete;
@@ -39,4 +73,36 @@ public:
   size_t size() const { return size_; }
 };
 
+/* memory-mapped read-write file wrapper (stores go straight to the file) */
+
+class MutableFile
+{
+private:
+  FileDescriptor fd_;
+  size_t size_;
+  MMap_Region mmap_region_;
+
+public:
+  MutableFile( const std::string & filename );
+  MutableFile( FileDescriptor && fd );
+
+  uint8_t * data( void ) { return mmap_region_.addr(); }
+  Chunk chunk( void ) const { return Chunk( mmap_region_.addr(), size_ ); }
+
+  /* Disallow copying */
+  MutableFile( const MutableFile & other ) = delete;
+  MutableFile & operator=( const MutableFile & other ) = delete;
+
+  /* Allow moving */
+  MutableFile( MutableFile && other );
+
+  size_t size() const { return size_; }
+};
+
+/* replace the contents of destination with those of source, sharing
+   extents (FICLONE) when the filesystem supports it; returns the method used.
+   Refuses, before touching either, if both are the same file (e.g. through
+   a hard link or symlink), so open destination without O_TRUNC. */
+std::string clone_file( const FileDescriptor & source, FileDescriptor & destination );
+
 #endif /* FILE_HH */
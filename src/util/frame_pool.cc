@@ -0,0 +1,90 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+#include "frame_pool.hh"
+#include "stats.hh"
+
+using namespace std;
+
+static Stats::Probe hit_probe { "frame_pool.hit", Stats::Unit::Bytes };
+static Stats::Probe miss_probe { "frame_pool.miss", Stats::Unit::Bytes };
+
+FramePool::Buffer::Buffer( FramePool & pool, unique_ptr<MMap_Region> && region )
+  : pool_( &pool ), region_( move( region ) )
+{}
+
+FramePool::Buffer::Buffer( Buffer && other )
+  : pool_( other.pool_ ), region_( move( other.region_ ) )
+{}
+
+FramePool::Buffer & FramePool::Buffer::operator=( Buffer && other )
+{
+  if ( this != &other ) {
+    if ( region_ ) {
+      pool_->release( move( region_ ) );
+    }
+    pool_ = other.pool_;
+    region_ = move( other.region_ );
+  }
+  return *this;
+}
+
+FramePool::Buffer::~Buffer()
+{
+  if ( region_ ) {
+    pool_->release( move( region_ ) );
+  }
+}
+
+FramePool::FramePool( const bool hugepages, const size_t max_idle )
+  : hugepages_( hugepages ), max_idle_( max_idle )
+{}
+
+FramePool::Buffer FramePool::acquire( const size_t length )
+{
+  if ( length == 0 ) {
+    return {};
+  }
+
+  {
+    lock_guard<mutex> guard { lock_ };
+    const auto idle = idle_.find( length );
+    if ( idle != idle_.end() ) {
+      unique_ptr<MMap_Region> region = move( idle->second );
+      idle_.erase( idle );
+      hits_++;
+      if ( Stats::enabled() ) {
+        Stats::record( hit_probe, length );
+      }
+      return { *this, move( region ) };
+    }
+  }
+
+  misses_++;
+  if ( Stats::enabled() ) {
+    Stats::record( miss_probe, length );
+  }
+
+  MMap_Region::Options options;
+  options.hugepages = hugepages_;
+  return { *this, make_unique<MMap_Region>( length, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0, options ) };
+}
+
+void FramePool::release( unique_ptr<MMap_Region> && region )
+{
+  lock_guard<mutex> guard { lock_ };
+  if ( idle_.count( region->length() ) < max_idle_ ) {
+    idle_.emplace( region->length(), move( region ) );
+  }
+  /* otherwise, the mapping goes away with region */
+}
+
+FramePool & FramePool::global()
+{
+  static FramePool & pool = *new FramePool( getenv( "CAPTAIN_EO_HUGEPAGES" ) != nullptr );
+  return pool;
+}
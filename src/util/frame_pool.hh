@@ -0,0 +1,75 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FRAME_POOL_HH
+#define FRAME_POOL_HH
+
+/* recycled frame-sized buffers
+
+   A Buffer is anonymous memory (page-aligned, so aligned for any vector
+   load), optionally backed by transparent hugepages. Its contents are
+   whatever the last user left there; nothing is zeroed. When a Buffer is
+   destroyed, its memory goes back to the pool, and the next acquire() of
+   the same size reuses it instead of mapping (and faulting in) new pages. */
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "mmap_region.hh"
+
+class FramePool
+{
+public:
+  class Buffer
+  {
+  private:
+    FramePool * pool_ { nullptr };
+    std::unique_ptr<MMap_Region> region_ {};
+
+  public:
+    Buffer() {}
+    Buffer( FramePool & pool, std::unique_ptr<MMap_Region> && region );
+    ~Buffer();
+
+    uint8_t * data() const { return region_ ? region_->addr() : nullptr; }
+    size_t size() const { return region_ ? region_->length() : 0; }
+
+    Buffer( Buffer && other );
+    Buffer & operator=( Buffer && other );
+
+    Buffer( const Buffer & other ) = delete;
+    Buffer & operator=( const Buffer & other ) = delete;
+  };
+
+private:
+  bool hugepages_;
+  size_t max_idle_; /* idle buffers kept of each size */
+
+  std::mutex lock_ {};
+  std::multimap<size_t, std::unique_ptr<MMap_Region>> idle_ {};
+
+  std::atomic<uint64_t> hits_ { 0 }, misses_ { 0 };
+
+  void release( std::unique_ptr<MMap_Region> && region );
+
+public:
+  FramePool( const bool hugepages = false, const size_t max_idle = 4 );
+
+  Buffer acquire( const size_t length );
+
+  /* acquisitions served by a recycled buffer, and by a new mapping */
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+  /* the pool XImage borrows from; hugepage-backed if CAPTAIN_EO_HUGEPAGES
+     is set in the environment. It is never destroyed, so buffers may
+     outlive main(). */
+  static FramePool & global();
+
+  FramePool( const FramePool & other ) = delete;
+  FramePool & operator=( const FramePool & other ) = delete;
+};
+
+#endif /* FRAME_POOL_HH */
@@ -0,0 +1,438 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "frame_ring.hh"
+#include "exception.hh"
+#include "stats.hh"
+
+using namespace std;
+
+static const char ring_magic[ 8 ] = { 'C', 'E', 'O', 'F', 'R', 'I', 'N', 'G' };
+static const size_t page_length = 4096;
+
+static Stats::Probe stall_probe { "frame_ring.stall" };
+static Stats::Probe wait_probe { "frame_ring.wait" };
+static Stats::Probe occupancy_probe { "frame_ring.occupancy", Stats::Unit::Count };
+
+/* the header page; the two sides' counters sit on separate cache lines */
+struct FrameRing::Shared
+{
+  char magic[ 8 ] {};
+  uint32_t slot_count { 0 };
+  uint32_t reserved { 0 };
+  uint64_t slot_length { 0 }, slot_stride { 0 };
+
+  /* written by the writer */
+  alignas( 64 ) atomic<uint64_t> published { 0 };
+  atomic<uint32_t> closed { 0 };
+  atomic<uint32_t> writer_waiting { 0 };
+  atomic<uint64_t> peak_occupancy { 0 }, writer_stalls { 0 };
+
+  /* written by the reader */
+  alignas( 64 ) atomic<uint64_t> released { 0 };
+  atomic<uint32_t> reader_waiting { 0 };
+  atomic<uint64_t> reader_waits { 0 };
+
+  /* the frame number in each slot */
+  alignas( 64 ) uint64_t frame_no[ max_slots ] {};
+};
+
+static_assert( atomic<uint64_t>::is_always_lock_free, "ring counters must work across processes" );
+
+/* the slots are reused for every frame, so fault them in once up front */
+static MMap_Region::Options ring_options()
+{
+  MMap_Region::Options options;
+  options.populate = true;
+  return options;
+}
+
+static size_t round_up( const size_t length )
+{
+  return ( length + page_length - 1 ) / page_length * page_length;
+}
+
+string FrameRing::socket_name( const string & name )
+{
+  if ( name.empty() or name.find( '/' ) != string::npos ) {
+    throw runtime_error( "invalid frame ring name: " + name );
+  }
+  /* abstract socket: no file to clean up, gone when the writer closes it */
+  return string( 1, '\0' ) + "captain-eo-frame-ring/" + name;
+}
+
+static sockaddr_un socket_address( const string & path, socklen_t & length )
+{
+  sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+  if ( path.size() > sizeof( address.sun_path ) ) {
+    throw runtime_error( "frame ring name too long" );
+  }
+  memcpy( address.sun_path, path.data(), path.size() );
+  length = offsetof( sockaddr_un, sun_path ) + path.size();
+  return address;
+}
+
+FrameRing::FrameRing( Handles && handles )
+  : memory_fd_( move( handles.memory ) ),
+    ready_( move( handles.ready ) ),
+    freed_( move( handles.freed ) ),
+    peer_( move( handles.peer ) ),
+    memory_( memory_fd_.size(), PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd_.fd_num(), 0, ring_options() ),
+    shared_( reinterpret_cast<Shared *>( memory_.addr() ) )
+{}
+
+uint8_t * FrameRing::slot( const uint64_t sequence ) const
+{
+  return memory_.addr() + round_up( sizeof( Shared ) ) + ( sequence % shared_->slot_count ) * shared_->slot_stride;
+}
+
+bool FrameRing::wait( const FileDescriptor & fd ) const
+{
+  pollfd fds[ 2 ] = { { fd.fd_num(), POLLIN, 0 }, { peer_.fd_num(), POLLIN, 0 } };
+  while ( poll( fds, 2, -1 ) < 0 ) {
+    if ( errno != EINTR ) {
+      throw unix_error( "poll" );
+    }
+  }
+
+  uint64_t kicks;
+  if ( read( fd.fd_num(), &kicks, sizeof( kicks ) ) < 0 and errno != EAGAIN ) {
+    throw unix_error( "read eventfd" );
+  }
+
+  return not fds[ 1 ].revents;
+}
+
+void FrameRing::kick( const FileDescriptor & fd )
+{
+  const uint64_t one = 1;
+  SystemCall( "write eventfd", write( fd.fd_num(), &one, sizeof( one ) ) );
+}
+
+unsigned int FrameRing::slot_count() const
+{
+  return shared_->slot_count;
+}
+
+size_t FrameRing::slot_length() const
+{
+  return shared_->slot_length;
+}
+
+unsigned int FrameRing::occupancy() const
+{
+  return shared_->published.load() - shared_->released.load();
+}
+
+FrameRing::Counters FrameRing::counters() const
+{
+  return { shared_->published.load(), shared_->peak_occupancy.load(),
+           shared_->writer_stalls.load(), shared_->reader_waits.load() };
+}
+
+/* wait up to timeout_ms for a reader running as this user, turning away
+   anyone else who connects */
+static FileDescriptor accept_reader( const FileDescriptor & listener, const string & name,
+                                     const unsigned int timeout_ms )
+{
+  const auto deadline = chrono::steady_clock::now() + chrono::milliseconds( timeout_ms );
+
+  while ( true ) {
+    const auto remaining = chrono::duration_cast<chrono::milliseconds>( deadline - chrono::steady_clock::now() );
+    pollfd fds[ 1 ] = { { listener.fd_num(), POLLIN, 0 } };
+    const int ready = poll( fds, 1, max<int64_t>( remaining.count(), 0 ) );
+    if ( ready < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      throw unix_error( "poll" );
+    }
+    if ( ready == 0 ) {
+      throw runtime_error( "no reader for frame ring " + name );
+    }
+
+    FileDescriptor peer { SystemCall( "accept", accept4( listener.fd_num(), nullptr, nullptr, SOCK_CLOEXEC ) ) };
+
+    ucred credentials;
+    socklen_t credentials_length = sizeof( credentials );
+    SystemCall( "getsockopt", getsockopt( peer.fd_num(), SOL_SOCKET, SO_PEERCRED,
+                                          &credentials, &credentials_length ) );
+    if ( credentials.uid == geteuid() ) {
+      return peer;
+    }
+  }
+}
+
+FrameRing::Handles FrameRingWriter::create( const string & name, const size_t slot_length,
+                                            const unsigned int slots, const unsigned int timeout_ms )
+{
+  if ( slots == 0 or slots > max_slots or slot_length == 0 ) {
+    throw runtime_error( "a frame ring holds 1 to " + to_string( max_slots ) + " slots" );
+  }
+
+  /* claim the name first, so a second writer fails before doing anything */
+  FileDescriptor listener { SystemCall( "socket", socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 ) ) };
+  socklen_t address_length;
+  const sockaddr_un address = socket_address( socket_name( name ), address_length );
+  if ( bind( listener.fd_num(), reinterpret_cast<const sockaddr *>( &address ), address_length ) < 0 ) {
+    if ( errno == EADDRINUSE ) {
+      throw runtime_error( "frame ring " + name + " already has a writer" );
+    }
+    throw unix_error( "bind" );
+  }
+  SystemCall( "listen", listen( listener.fd_num(), 1 ) );
+
+  const size_t slot_stride = round_up( slot_length );
+  FileDescriptor memory { SystemCall( "memfd_create",
+    memfd_create( ( "frame-ring:" + name ).c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING ) ) };
+  SystemCall( "ftruncate", ftruncate( memory.fd_num(), round_up( sizeof( Shared ) ) + slots * slot_stride ) );
+  SystemCall( "fcntl", fcntl( memory.fd_num(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL ) );
+
+  /* fill in the header before anyone else can see it */
+  {
+    const MMap_Region header { sizeof( Shared ), PROT_READ | PROT_WRITE, MAP_SHARED, memory.fd_num() };
+    Shared * shared = new ( header.addr() ) Shared {};
+    memcpy( shared->magic, ring_magic, sizeof( ring_magic ) );
+    shared->slot_count = slots;
+    shared->slot_length = slot_length;
+    shared->slot_stride = slot_stride;
+  }
+
+  FileDescriptor ready { SystemCall( "eventfd", eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) ) };
+  FileDescriptor freed { SystemCall( "eventfd", eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) ) };
+
+  /* wait for the reader, and pass it everything it needs */
+  FileDescriptor peer = accept_reader( listener, name, timeout_ms );
+
+  const int fds[ 3 ] = { memory.fd_num(), ready.fd_num(), freed.fd_num() };
+  char control[ CMSG_SPACE( sizeof( fds ) ) ] {};
+  char byte = 0;
+  iovec iov { &byte, 1 };
+  msghdr message {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof( control );
+  cmsghdr * cmsg = CMSG_FIRSTHDR( &message );
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN( sizeof( fds ) );
+  memcpy( CMSG_DATA( cmsg ), fds, sizeof( fds ) );
+  SystemCall( "sendmsg", sendmsg( peer.fd_num(), &message, MSG_NOSIGNAL ) );
+
+  return { move( memory ), move( ready ), move( freed ), move( peer ) };
+}
+
+FrameRingWriter::FrameRingWriter( const string & name, const size_t slot_length, const unsigned int slots,
+                                  const unsigned int timeout_ms )
+  : FrameRing( create( name, slot_length, slots, timeout_ms ) )
+{}
+
+FrameRingWriter::~FrameRingWriter()
+{
+  /* the reader's loss has been reported already; there is nothing to drain */
+  if ( reader_lost_ ) {
+    return;
+  }
+
+  try {
+    close();
+  } catch ( const exception & e ) {
+    print_exception( "FrameRingWriter", e );
+  }
+}
+
+uint8_t * FrameRingWriter::acquire()
+{
+  if ( acquired_ or closed_ ) {
+    throw runtime_error( "FrameRingWriter::acquire() out of turn" );
+  }
+
+  if ( next_ - shared_->released.load( memory_order_acquire ) >= shared_->slot_count ) {
+    const Stats::ScopedTimer timer { stall_probe };
+    shared_->writer_stalls++;
+
+    while ( true ) {
+      /* say we're waiting, then look again, so a release can't slip by */
+      shared_->writer_waiting = 1;
+      if ( next_ - shared_->released.load() < shared_->slot_count ) {
+        break;
+      }
+      if ( not wait( freed_ ) and next_ - shared_->released.load() >= shared_->slot_count ) {
+        shared_->writer_waiting = 0;
+        reader_lost_ = true;
+        throw runtime_error( "frame ring reader went away" );
+      }
+    }
+    shared_->writer_waiting = 0;
+  }
+
+  acquired_ = true;
+  return slot( next_ );
+}
+
+void FrameRingWriter::publish( const uint64_t frame_no )
+{
+  if ( not acquired_ ) {
+    throw runtime_error( "FrameRingWriter::publish() without acquire()" );
+  }
+  acquired_ = false;
+
+  shared_->frame_no[ next_ % shared_->slot_count ] = frame_no;
+  next_++;
+  shared_->published.store( next_ );
+
+  const uint64_t occupancy = next_ - shared_->released.load();
+  if ( occupancy > shared_->peak_occupancy.load( memory_order_relaxed ) ) {
+    shared_->peak_occupancy.store( occupancy, memory_order_relaxed );
+  }
+  if ( Stats::enabled() ) {
+    Stats::record( occupancy_probe, occupancy );
+  }
+
+  if ( shared_->reader_waiting.load() ) {
+    kick( ready_ );
+  }
+}
+
+void FrameRingWriter::close()
+{
+  if ( closed_ ) {
+    return;
+  }
+  closed_ = true;
+  shared_->closed.store( 1 );
+  kick( ready_ );
+
+  /* wait for the reader to finish, so no frame is lost unnoticed */
+  while ( true ) {
+    shared_->writer_waiting = 1;
+    if ( shared_->released.load() == next_ ) {
+      break;
+    }
+    if ( not wait( freed_ ) and shared_->released.load() != next_ ) {
+      shared_->writer_waiting = 0;
+      reader_lost_ = true;
+      throw runtime_error( "frame ring reader went away with "
+                           + to_string( next_ - shared_->released.load() ) + " frames unread" );
+    }
+  }
+  shared_->writer_waiting = 0;
+}
+
+FrameRing::Handles FrameRingReader::connect( const string & name, const unsigned int timeout_ms )
+{
+  FileDescriptor peer { SystemCall( "socket", socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 ) ) };
+  socklen_t address_length;
+  const sockaddr_un address = socket_address( socket_name( name ), address_length );
+
+  /* the writer may not have started yet */
+  const auto deadline = chrono::steady_clock::now() + chrono::milliseconds( timeout_ms );
+  while ( ::connect( peer.fd_num(), reinterpret_cast<const sockaddr *>( &address ), address_length ) < 0 ) {
+    if ( errno != ECONNREFUSED and errno != ENOENT and errno != EINTR ) {
+      throw unix_error( "connect" );
+    }
+    if ( chrono::steady_clock::now() >= deadline ) {
+      throw runtime_error( "no writer for frame ring " + name );
+    }
+    this_thread::sleep_for( chrono::milliseconds( 10 ) );
+  }
+
+  int fds[ 3 ];
+  char control[ CMSG_SPACE( sizeof( fds ) ) ] {};
+  char byte;
+  iovec iov { &byte, 1 };
+  msghdr message {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof( control );
+  if ( SystemCall( "recvmsg", recvmsg( peer.fd_num(), &message, MSG_CMSG_CLOEXEC ) ) == 0 ) {
+    throw runtime_error( "frame ring " + name + ": writer went away" );
+  }
+
+  const cmsghdr * cmsg = CMSG_FIRSTHDR( &message );
+  if ( not cmsg or cmsg->cmsg_type != SCM_RIGHTS or cmsg->cmsg_len != CMSG_LEN( sizeof( fds ) ) ) {
+    throw runtime_error( "frame ring " + name + ": bad handshake" );
+  }
+  memcpy( fds, CMSG_DATA( cmsg ), sizeof( fds ) );
+
+  return { FileDescriptor { fds[ 0 ] }, FileDescriptor { fds[ 1 ] }, FileDescriptor { fds[ 2 ] }, move( peer ) };
+}
+
+FrameRingReader::FrameRingReader( const string & name, const unsigned int timeout_ms )
+  : FrameRing( connect( name, timeout_ms ) )
+{
+  if ( memory_.length() < sizeof( Shared )
+       or memcmp( shared_->magic, ring_magic, sizeof( ring_magic ) )
+       or shared_->slot_count == 0 or shared_->slot_count > max_slots
+       or memory_.length() != round_up( sizeof( Shared ) ) + shared_->slot_count * shared_->slot_stride ) {
+    throw runtime_error( "frame ring " + name + ": not a frame ring" );
+  }
+}
+
+optional<FrameRingReader::Slot> FrameRingReader::next()
+{
+  if ( holding_ ) {
+    throw runtime_error( "FrameRingReader::next() before release()" );
+  }
+
+  if ( next_ == shared_->published.load( memory_order_acquire ) ) {
+    const Stats::ScopedTimer timer { wait_probe };
+    shared_->reader_waits++;
+
+    while ( true ) {
+      shared_->reader_waiting = 1;
+      if ( next_ != shared_->published.load() ) {
+        break;
+      }
+      /* closed is set after the last publish */
+      if ( shared_->closed.load() ) {
+        shared_->reader_waiting = 0;
+        if ( next_ != shared_->published.load() ) {
+          break;
+        }
+        return {};
+      }
+      if ( not wait( ready_ ) and next_ == shared_->published.load() and not shared_->closed.load() ) {
+        shared_->reader_waiting = 0;
+        throw runtime_error( "frame ring writer went away" );
+      }
+    }
+    shared_->reader_waiting = 0;
+  }
+
+  holding_ = true;
+  return Slot { slot( next_ ), shared_->slot_length, shared_->frame_no[ next_ % shared_->slot_count ] };
+}
+
+void FrameRingReader::release()
+{
+  if ( not holding_ ) {
+    throw runtime_error( "FrameRingReader::release() without next()" );
+  }
+  holding_ = false;
+
+  next_++;
+  shared_->released.store( next_ );
+
+  if ( shared_->writer_waiting.load() ) {
+    kick( freed_ );
+  }
+}
@@ -0,0 +1,134 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FRAME_RING_HH
+#define FRAME_RING_HH
+
+/* a ring of frame slots in shared memory, for handing frames from one
+   process to another without copying them through a pipe
+
+   The writer creates the ring: a memfd holding a header page and a
+   fixed number of page-aligned slots. It then waits on an abstract unix
+   socket named after the ring for one reader, and passes it the memfd
+   and two eventfds. From then on frames move by index alone: the writer
+   fills a slot in place and publishes it, the reader decodes it in
+   place and releases it. Neither side makes a system call while the
+   other keeps up; one that has to wait says so in the header, and the
+   other side kicks its eventfd. A full ring stalls the writer, so a
+   slow reader holds the writer back rather than losing frames. Each
+   side also watches the socket, so it notices if the other goes away.
+   The socket name is open to every local user, so the writer only hands
+   the ring to a reader running as its own user. */
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "file_descriptor.hh"
+#include "mmap_region.hh"
+
+class FrameRing
+{
+public:
+  static constexpr unsigned int max_slots = 256;
+
+  /* what the writer saw of the reader, and vice versa */
+  struct Counters
+  {
+    uint64_t frames;         /* frames published */
+    uint64_t peak_occupancy; /* most slots ever full at once */
+    uint64_t writer_stalls;  /* times the writer found the ring full */
+    uint64_t reader_waits;   /* times the reader found the ring empty */
+  };
+
+protected:
+  struct Shared;
+
+  /* the memfd, the writer's and the reader's eventfds, and the socket
+     to the other side */
+  struct Handles
+  {
+    FileDescriptor memory, ready, freed, peer;
+  };
+
+  FileDescriptor memory_fd_, ready_, freed_, peer_;
+  MMap_Region memory_;
+  Shared * shared_;
+
+  FrameRing( Handles && handles );
+
+  uint8_t * slot( const uint64_t sequence ) const;
+
+  /* sleep until fd is kicked; false if the other side has gone */
+  bool wait( const FileDescriptor & fd ) const;
+  static void kick( const FileDescriptor & fd );
+
+  static std::string socket_name( const std::string & name );
+
+public:
+  unsigned int slot_count() const;
+  size_t slot_length() const;
+
+  /* slots full right now */
+  unsigned int occupancy() const;
+  Counters counters() const;
+
+  FrameRing( const FrameRing & other ) = delete;
+  FrameRing & operator=( const FrameRing & other ) = delete;
+};
+
+class FrameRingWriter : public FrameRing
+{
+private:
+  uint64_t next_ { 0 };
+  bool acquired_ { false }, closed_ { false }, reader_lost_ { false };
+
+  static Handles create( const std::string & name, const size_t slot_length,
+                         const unsigned int slots, const unsigned int timeout_ms );
+
+public:
+  /* create the ring NAME and wait up to timeout_ms for its reader to
+     connect */
+  FrameRingWriter( const std::string & name, const size_t slot_length, const unsigned int slots = 8,
+                   const unsigned int timeout_ms = 10000 );
+  ~FrameRingWriter();
+
+  /* the next free slot, slot_length() bytes, waiting while the ring is
+     full; throws if the reader has gone */
+  uint8_t * acquire();
+
+  /* hand the slot from acquire() to the reader */
+  void publish( const uint64_t frame_no );
+
+  /* tell the reader there will be no more frames, and wait for it to
+     take the ones still in the ring; throws if it goes away first */
+  void close();
+};
+
+class FrameRingReader : public FrameRing
+{
+private:
+  uint64_t next_ { 0 };
+  bool holding_ { false };
+
+  static Handles connect( const std::string & name, const unsigned int timeout_ms );
+
+public:
+  struct Slot
+  {
+    const uint8_t * data;
+    size_t length;
+    uint64_t frame_no;
+  };
+
+  /* connect to the ring NAME, waiting up to timeout_ms for it to appear */
+  FrameRingReader( const std::string & name, const unsigned int timeout_ms = 10000 );
+
+  /* the next frame, waiting for one to be published, or nothing once
+     the writer has closed the ring; valid until release() */
+  std::optional<Slot> next();
+
+  /* give the slot from next() back to the writer */
+  void release();
+};
+
+#endif /* FRAME_RING_HH */
@@ -0,0 +1,40 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <stdexcept>
+
+#include "frame_view.hh"
+
+using namespace std;
+
+PixelFormat parse_pixel_format( const string & name )
+{
+  if ( name == "bgrx" or name == "bgra" ) { return PixelFormat::BGRX; }
+  if ( name == "i420" ) { return PixelFormat::I420; }
+  if ( name == "nv12" ) { return PixelFormat::NV12; }
+
+  throw runtime_error( "unknown pixel format: " + name );
+}
+
+string pixel_format_name( const PixelFormat format )
+{
+  switch ( format ) {
+  case PixelFormat::BGRX: return "bgrx";
+  case PixelFormat::I420: return "i420";
+  case PixelFormat::NV12: return "nv12";
+  }
+
+  throw runtime_error( "unknown pixel format" );
+}
+
+size_t frame_length( const PixelFormat format, const unsigned int width, const unsigned int height )
+{
+  switch ( format ) {
+  case PixelFormat::BGRX:
+    return size_t( width ) * height * 4;
+  case PixelFormat::I420:
+  case PixelFormat::NV12:
+    return size_t( width ) * height + 2 * ( size_t( width + 1 ) / 2 ) * ( ( height + 1 ) / 2 );
+  }
+
+  throw runtime_error( "unknown pixel format" );
+}
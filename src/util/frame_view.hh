@@ -0,0 +1,70 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FRAME_VIEW_HH
+#define FRAME_VIEW_HH
+
+#include <cstdint>
+#include <string>
+
+/* pixel layouts of headerless raw video files */
+enum class PixelFormat
+{
+  BGRX, /* 4 bytes per pixel: blue, green, red, unused */
+  I420, /* Y plane, then U and V planes at half resolution */
+  NV12, /* Y plane, then one plane of interleaved U and V at half resolution */
+};
+
+PixelFormat parse_pixel_format( const std::string & name );
+std::string pixel_format_name( const PixelFormat format );
+
+/* one BGRX pixel, as X and the raw files store it */
+struct RGBPixel
+{
+  uint8_t blue, green, red, xxx;
+};
+
+/* size of one packed frame */
+size_t frame_length( const PixelFormat format, const unsigned int width, const unsigned int height );
+
+/* an unowned frame in memory, as up to three planes with their strides
+   (for BGRX, planes[ 0 ] holds the pixels) */
+template <typename Byte>
+struct BasicFrameView
+{
+  PixelFormat format;
+  unsigned int width, height;
+  Byte * planes[ 3 ];
+  size_t strides[ 3 ];
+
+  unsigned int chroma_width() const { return ( width + 1 ) / 2; }
+  unsigned int chroma_height() const { return ( height + 1 ) / 2; }
+
+  /* a frame laid out as in a raw file */
+  static BasicFrameView packed( Byte * data, const PixelFormat format,
+                                const unsigned int width, const unsigned int height )
+  {
+    const size_t luma_length = size_t( width ) * height;
+    const size_t chroma_width = ( width + 1 ) / 2;
+    const size_t chroma_length = chroma_width * ( ( height + 1 ) / 2 );
+
+    switch ( format ) {
+    case PixelFormat::BGRX:
+      return { format, width, height, { data, nullptr, nullptr }, { width * size_t( 4 ), 0, 0 } };
+    case PixelFormat::I420:
+      return { format, width, height,
+               { data, data + luma_length, data + luma_length + chroma_length },
+               { width, chroma_width, chroma_width } };
+    case PixelFormat::NV12:
+      return { format, width, height,
+               { data, data + luma_length, nullptr },
+               { width, 2 * chroma_width, 0 } };
+    }
+
+    return {};
+  }
+};
+
+typedef BasicFrameView<const uint8_t> FrameView;
+typedef BasicFrameView<uint8_t> MutableFrameView;
+
+#endif /* FRAME_VIEW_HH */
@@ -0,0 +1,65 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <poll.h>
+
+#include "inotify.hh"
+#include "exception.hh"
+
+using namespace std;
+
+Inotify::Inotify()
+  : fd_( SystemCall( "inotify_init1", inotify_init1( IN_CLOEXEC ) ) )
+{}
+
+int Inotify::add_watch( const string & path, const uint32_t mask )
+{
+  return SystemCall( "inotify_add_watch " + path, inotify_add_watch( fd_.fd_num(), path.c_str(), mask ) );
+}
+
+vector<Inotify::Event> Inotify::wait( const int timeout_ms )
+{
+  using namespace std::chrono;
+  const auto deadline = steady_clock::now() + milliseconds( timeout_ms );
+
+  /* a signal cuts the wait short; carry on with what is left of it */
+  pollfd pfd { fd_.fd_num(), POLLIN, 0 };
+  int remaining_ms = timeout_ms;
+  while ( true ) {
+    const int ready = poll( &pfd, 1, remaining_ms );
+    if ( ready > 0 ) {
+      break;
+    }
+    if ( ready == 0 ) {
+      return {};
+    }
+    if ( errno != EINTR ) {
+      throw unix_error( "poll" );
+    }
+    if ( timeout_ms >= 0 ) {
+      remaining_ms = max<int64_t>( 0, duration_cast<milliseconds>( deadline - steady_clock::now() ).count() );
+    }
+  }
+
+  /* a read never returns a partial event */
+  const string buffer = fd_.read( 65536 );
+
+  vector<Event> events;
+  for ( size_t offset = 0; offset + sizeof( inotify_event ) <= buffer.size(); ) {
+    inotify_event header;
+    memcpy( &header, buffer.data() + offset, sizeof( header ) );
+    offset += sizeof( header );
+
+    string name = buffer.substr( offset, header.len );
+    name.resize( strnlen( name.c_str(), name.size() ) );
+    offset += header.len;
+
+    events.push_back( { header.wd, header.mask, name } );
+  }
+
+  return events;
+}
@@ -0,0 +1,40 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef INOTIFY_HH
+#define INOTIFY_HH
+
+#include <sys/inotify.h>
+
+#include <string>
+#include <vector>
+
+#include "file_descriptor.hh"
+
+/* wrapper class for an inotify instance */
+
+class Inotify
+{
+private:
+  FileDescriptor fd_;
+
+public:
+  struct Event
+  {
+    int watch;
+    uint32_t mask;
+    std::string name;
+  };
+
+  Inotify();
+
+  FileDescriptor & fd( void ) { return fd_; }
+
+  /* returns the watch descriptor */
+  int add_watch( const std::string & path, const uint32_t mask );
+
+  /* wait up to timeout_ms (-1 for ever) for events and return them,
+     or nothing if the time ran out */
+  std::vector<Event> wait( const int timeout_ms = -1 );
+};
+
+#endif /* INOTIFY_HH */
@@ -0,0 +1,143 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "io_uring.hh"
+
+using namespace std;
+
+static int io_uring_setup( const unsigned int entries, io_uring_params * params )
+{
+  return syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int io_uring_enter( const int fd, const unsigned int to_submit, const unsigned int min_complete,
+                           const unsigned int flags )
+{
+  return syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0 );
+}
+
+static int io_uring_register( const int fd, const unsigned int opcode, const void * arg,
+                              const unsigned int nr_args )
+{
+  return syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+template <typename T>
+static T * at( const unique_ptr<MMap_Region> & region, const uint32_t offset )
+{
+  return reinterpret_cast<T *>( region->addr() + offset );
+}
+
+static io_uring_params setup_params()
+{
+  io_uring_params params;
+  memset( &params, 0, sizeof( params ) );
+  return params;
+}
+
+IoUring::IoUring( const unsigned int entries )
+  : IoUring( entries, setup_params() )
+{}
+
+IoUring::IoUring( const unsigned int entries, io_uring_params params )
+  : fd_( SystemCall( "io_uring_setup", io_uring_setup( entries, &params ) ) ),
+    sq_entries_( params.sq_entries ),
+    cq_entries_( params.cq_entries ),
+    sq_ring_( make_unique<MMap_Region>( params.sq_off.array + params.sq_entries * sizeof( uint32_t ),
+                                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                        fd_.fd_num(), IORING_OFF_SQ_RING ) ),
+    cq_ring_( make_unique<MMap_Region>( params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe ),
+                                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                        fd_.fd_num(), IORING_OFF_CQ_RING ) ),
+    sqes_( make_unique<MMap_Region>( params.sq_entries * sizeof( io_uring_sqe ),
+                                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     fd_.fd_num(), IORING_OFF_SQES ) ),
+    sq_head_( at<atomic<uint32_t>>( sq_ring_, params.sq_off.head ) ),
+    sq_tail_( at<atomic<uint32_t>>( sq_ring_, params.sq_off.tail ) ),
+    cq_head_( at<atomic<uint32_t>>( cq_ring_, params.cq_off.head ) ),
+    cq_tail_( at<atomic<uint32_t>>( cq_ring_, params.cq_off.tail ) ),
+    sq_mask_( *at<uint32_t>( sq_ring_, params.sq_off.ring_mask ) ),
+    cq_mask_( *at<uint32_t>( cq_ring_, params.cq_off.ring_mask ) ),
+    sq_array_( at<uint32_t>( sq_ring_, params.sq_off.array ) ),
+    cqes_( at<io_uring_cqe>( cq_ring_, params.cq_off.cqes ) )
+{}
+
+bool IoUring::available()
+{
+  io_uring_params params = setup_params();
+  const int fd = io_uring_setup( 1, &params );
+  if ( fd < 0 ) {
+    return false;
+  }
+  close( fd );
+  return true;
+}
+
+void IoUring::register_buffer( uint8_t * buffer, const size_t length )
+{
+  const iovec vector { buffer, length };
+  SystemCall( "io_uring_register", io_uring_register( fd_.fd_num(), IORING_REGISTER_BUFFERS, &vector, 1 ) );
+  buffer_ = buffer;
+  buffer_length_ = length;
+}
+
+bool IoUring::read( const int fd, uint8_t * destination, const uint32_t length, const uint64_t offset,
+                    const uint64_t user_data )
+{
+  if ( destination < buffer_ or destination + length > buffer_ + buffer_length_ ) {
+    throw runtime_error( "IoUring: read outside the registered buffer" );
+  }
+
+  const uint32_t tail = sq_tail_->load( memory_order_relaxed );
+  if ( tail - sq_head_->load( memory_order_acquire ) >= sq_entries_ ) {
+    return false;
+  }
+
+  const uint32_t index = tail & sq_mask_;
+  io_uring_sqe & sqe = at<io_uring_sqe>( sqes_, 0 )[ index ];
+  memset( &sqe, 0, sizeof( sqe ) );
+  sqe.opcode = IORING_OP_READ_FIXED;
+  sqe.fd = fd;
+  sqe.addr = reinterpret_cast<uint64_t>( destination );
+  sqe.len = length;
+  sqe.off = offset;
+  sqe.buf_index = 0;
+  sqe.user_data = user_data;
+
+  sq_array_[ index ] = index;
+  sq_tail_->store( tail + 1, memory_order_release );
+  unsubmitted_++;
+  return true;
+}
+
+void IoUring::submit( const unsigned int wait_for )
+{
+  while ( unsubmitted_ or wait_for ) {
+    const int submitted = io_uring_enter( fd_.fd_num(), unsubmitted_, wait_for,
+                                          wait_for ? IORING_ENTER_GETEVENTS : 0 );
+    if ( submitted < 0 and errno == EINTR ) {
+      continue;
+    }
+    unsubmitted_ -= SystemCall( "io_uring_enter", submitted );
+    return;
+  }
+}
+
+bool IoUring::reap( Completion & completion )
+{
+  const uint32_t head = cq_head_->load( memory_order_relaxed );
+  if ( head == cq_tail_->load( memory_order_acquire ) ) {
+    return false;
+  }
+
+  const io_uring_cqe & cqe = static_cast<const io_uring_cqe *>( cqes_ )[ head & cq_mask_ ];
+  completion = { cqe.user_data, cqe.res };
+  cq_head_->store( head + 1, memory_order_release );
+  return true;
+}
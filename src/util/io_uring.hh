@@ -0,0 +1,73 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef IO_URING_HH
+#define IO_URING_HH
+
+/* a minimal io_uring, driven through the raw system calls
+
+   Reads go into one registered buffer (IORING_OP_READ_FIXED), so the
+   kernel pins it once instead of on every request. Nothing is sent to
+   the kernel until submit(). */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "file_descriptor.hh"
+#include "mmap_region.hh"
+
+struct io_uring_params;
+
+class IoUring
+{
+public:
+  struct Completion
+  {
+    uint64_t user_data;
+    int32_t result; /* bytes read, or -errno */
+  };
+
+private:
+  FileDescriptor fd_;
+  unsigned int sq_entries_, cq_entries_;
+
+  std::unique_ptr<MMap_Region> sq_ring_, cq_ring_, sqes_;
+
+  std::atomic<uint32_t> *sq_head_, *sq_tail_, *cq_head_, *cq_tail_;
+  uint32_t sq_mask_, cq_mask_;
+  uint32_t * sq_array_;
+  void * cqes_;
+
+  uint32_t unsubmitted_ { 0 };
+  uint8_t * buffer_ { nullptr };
+  size_t buffer_length_ { 0 };
+
+  IoUring( const unsigned int entries, io_uring_params params );
+
+public:
+  IoUring( const unsigned int entries );
+
+  /* true if the kernel lets this process use io_uring */
+  static bool available();
+
+  /* pin the memory that every read lands in */
+  void register_buffer( uint8_t * buffer, const size_t length );
+
+  /* queue a read into the registered buffer; false if the queue is full */
+  bool read( const int fd, uint8_t * destination, const uint32_t length, const uint64_t offset,
+             const uint64_t user_data );
+
+  /* hand queued reads to the kernel, then wait for at least wait_for completions */
+  void submit( const unsigned int wait_for = 0 );
+
+  /* take one completion, if there is one */
+  bool reap( Completion & completion );
+
+  unsigned int entries() const { return sq_entries_; }
+  unsigned int completion_entries() const { return cq_entries_; }
+
+  IoUring( const IoUring & other ) = delete;
+  IoUring & operator=( const IoUring & other ) = delete;
+};
+
+#endif /* IO_URING_HH */
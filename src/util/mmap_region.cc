@@ -1,31 +1,150 @@
 /* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include "mmap_region.hh"
 #include "exception.hh"
+#include "stats.hh"
 
 using namespace std;
 
-MMap_Region::MMap_Region( const size_t length, const int prot, const int flags, const int fd ) 
-  : addr_( static_cast<uint8_t *>( mmap( nullptr, length, prot, flags, fd, 0 ) ) ), 
+atomic<uint64_t> MMap_Region::mapped_bytes_ { 0 };
+atomic<uint64_t> MMap_Region::peak_mapped_bytes_ { 0 };
+
+static Stats::Probe mmap_probe { "mmap" };
+
+static size_t page_size()
+{
+  static const size_t size = sysconf( _SC_PAGESIZE );
+  return size;
+}
+
+static int madvice( const MMap_Region::Access access )
+{
+  switch ( access ) {
+  case MMap_Region::Access::Normal: return MADV_NORMAL;
+  case MMap_Region::Access::Sequential: return MADV_SEQUENTIAL;
+  case MMap_Region::Access::Random: return MADV_RANDOM;
+  case MMap_Region::Access::WillNeed: return MADV_WILLNEED;
+  }
+
+  throw LogicError();
+}
+
+MMap_Region::MMap_Region( const size_t length, const int prot, const int flags, const int fd,
+                          const off_t offset, const Options & options )
+  : base_( nullptr ),
+    map_length_( length + offset % page_size() ),
+    addr_( nullptr ),
     length_( length )
 {
-  if ( addr_ == MAP_FAILED ) {
+  const off_t aligned_offset = offset - offset % page_size();
+
+  const Stats::ScopedTimer timer { mmap_probe };
+  base_ = static_cast<uint8_t *>( mmap( nullptr, map_length_, prot,
+                                        flags | ( options.populate ? MAP_POPULATE : 0 ),
+                                        fd, aligned_offset ) );
+  if ( base_ == MAP_FAILED ) {
     throw unix_error( "mmap" );
   }
+
+  addr_ = base_ + ( offset - aligned_offset );
+
+  const uint64_t now_mapped = mapped_bytes_ += map_length_;
+  uint64_t peak = peak_mapped_bytes_;
+  while ( now_mapped > peak and not peak_mapped_bytes_.compare_exchange_weak( peak, now_mapped ) ) {}
+
+  /* only hints: a kernel that can't take them (MADV_HUGEPAGE without
+     THP gives EINVAL) still leaves a perfectly good mapping, and throwing
+     here would leak it, since the destructor never runs */
+  if ( options.access != Access::Normal ) {
+    madvise( base_, map_length_, madvice( options.access ) );
+  }
+
+  if ( options.hugepages ) {
+    madvise( base_, map_length_, MADV_HUGEPAGE );
+  }
 }
 
+MMap_Region::MMap_Region( const size_t length, const int prot, const int flags, const int fd,
+                          const off_t offset )
+  : MMap_Region( length, prot, flags, fd, offset, Options() )
+{}
+
 MMap_Region::~MMap_Region()
 {
-  if ( addr_ ) {
-    SystemCall( "munmap", munmap( addr_, length_ ) );
+  if ( base_ ) {
+    SystemCall( "munmap", munmap( base_, map_length_ ) );
+    mapped_bytes_ -= map_length_;
   }
 }
 
 MMap_Region::MMap_Region( MMap_Region && other )
-  : addr_( other.addr_ ),
+  : base_( other.base_ ),
+    map_length_( other.map_length_ ),
+    addr_( other.addr_ ),
     length_( other.length_ )
 {
+  other.base_ = nullptr;
   other.addr_ = nullptr;
 }
+
+void MMap_Region::advise( const Access access, const size_t offset, const size_t length ) const
+{
+  /* round outward to whole pages */
+  const uintptr_t start = reinterpret_cast<uintptr_t>( addr_ + offset );
+  const uintptr_t aligned_start = start - start % page_size();
+
+  SystemCall( "madvise", madvise( reinterpret_cast<void *>( aligned_start ),
+                                  length + ( start - aligned_start ),
+                                  madvice( access ) ) );
+}
+
+void MMap_Region::discard( const size_t offset, const size_t length ) const
+{
+  /* round inward, so pages shared with a neighbouring range survive */
+  const uintptr_t start = reinterpret_cast<uintptr_t>( addr_ + offset );
+  const uintptr_t end = start + length;
+  const uintptr_t aligned_start = ( start + page_size() - 1 ) / page_size() * page_size();
+  const uintptr_t aligned_end = end / page_size() * page_size();
+
+  if ( aligned_end > aligned_start ) {
+    SystemCall( "madvise", madvise( reinterpret_cast<void *>( aligned_start ),
+                                    aligned_end - aligned_start, MADV_DONTNEED ) );
+  }
+}
+
+void MMap_Region::extend( const size_t new_length )
+{
+  if ( new_length <= length_ ) {
+    return;
+  }
+
+  const size_t misalignment = addr_ - base_;
+  const size_t new_map_length = new_length + misalignment;
+
+  void * const new_base = mremap( base_, map_length_, new_map_length, MREMAP_MAYMOVE );
+  if ( new_base == MAP_FAILED ) {
+    throw unix_error( "mremap" );
+  }
+
+  const uint64_t now_mapped = mapped_bytes_ += new_map_length - map_length_;
+  uint64_t peak = peak_mapped_bytes_;
+  while ( now_mapped > peak and not peak_mapped_bytes_.compare_exchange_weak( peak, now_mapped ) ) {}
+
+  base_ = static_cast<uint8_t *>( new_base );
+  map_length_ = new_map_length;
+  addr_ = base_ + misalignment;
+  length_ = new_length;
+}
+
+MappingStats MappingStats::current()
+{
+  rusage usage;
+  SystemCall( "getrusage", getrusage( RUSAGE_SELF, &usage ) );
+
+  return { static_cast<uint64_t>( usage.ru_majflt ), static_cast<uint64_t>( usage.ru_minflt ),
+           MMap_Region::mapped_bytes(), MMap_Region::peak_mapped_bytes() };
+}
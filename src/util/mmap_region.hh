@@ -3,16 +3,37 @@
 #ifndef MMAP_REGION_HH
 #define MMAP_REGION_HH
 
+#include <atomic>
 #include <cstdint>
+#include <sys/types.h>
 
 class MMap_Region
 {
+public:
+  /* how the mapping will be used (passed on to the kernel as advice) */
+  enum class Access { Normal, Sequential, Random, WillNeed };
+
+  struct Options
+  {
+    Access access { Access::Normal };
+    bool populate { false };  /* prefault the whole mapping (MAP_POPULATE) */
+    bool hugepages { false }; /* ask for transparent hugepages (MADV_HUGEPAGE), if the kernel has them */
+  };
+
 private:
-  uint8_t *addr_;
+  uint8_t *base_;     /* page-aligned start of the mapping */
+  size_t map_length_; /* length of the mapping starting at base_ */
+  uint8_t *addr_;     /* the byte at the requested offset */
   size_t length_;
 
+  static std::atomic<uint64_t> mapped_bytes_, peak_mapped_bytes_;
+
 public:
-  MMap_Region( const size_t length, const int prot, const int flags, const int fd );
+  /* offset need not be page-aligned; addr() points at the byte at offset */
+  MMap_Region( const size_t length, const int prot, const int flags, const int fd,
+               const off_t offset, const Options & options );
+  MMap_Region( const size_t length, const int prot, const int flags, const int fd,
+               const off_t offset = 0 );
 
   ~MMap_Region();
 
@@ -23,8 +44,32 @@ public:
   /* Allow moving */
   MMap_Region( MMap_Region && other );
 
-  /* Getter */
+  /* advise the kernel about a range (relative to addr()) */
+  void advise( const Access access, const size_t offset, const size_t length ) const;
+
+  /* drop the pages wholly inside a range (relative to addr()) from this mapping */
+  void discard( const size_t offset, const size_t length ) const;
+
+  /* grow the mapping in place if possible (it may move, changing addr()),
+     keeping the pages already faulted in */
+  void extend( const size_t new_length );
+
+  /* Getters */
   uint8_t *addr() const { return addr_; }
+  size_t length() const { return length_; }
+
+  /* bytes currently mapped by all regions, and the most ever mapped at once */
+  static uint64_t mapped_bytes() { return mapped_bytes_; }
+  static uint64_t peak_mapped_bytes() { return peak_mapped_bytes_; }
+};
+
+/* process-wide counters for checking what a mapping strategy costs */
+struct MappingStats
+{
+  uint64_t major_faults, minor_faults;
+  uint64_t mapped_bytes, peak_mapped_bytes;
+
+  static MappingStats current();
 };
 
 #endif /* MMAP_REGION_HH */
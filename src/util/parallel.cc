@@ -0,0 +1,109 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "parallel.hh"
+
+using namespace std;
+
+namespace {
+
+/* one parallel_for call, waiting for helpers */
+struct Job
+{
+  const function<void()> & worker;
+  unsigned int wanted;      /* helpers still welcome */
+  unsigned int running { 0 };
+  condition_variable finished {};
+};
+
+class Helpers
+{
+private:
+  mutex lock_ {};
+  condition_variable work_available_ {};
+  deque<Job *> jobs_ {};
+  vector<thread> threads_ {};
+  bool stopping_ { false };
+
+  void work()
+  {
+    unique_lock<mutex> lock { lock_ };
+    while ( true ) {
+      work_available_.wait( lock, [&] { return stopping_ or not jobs_.empty(); } );
+      if ( stopping_ ) {
+        return;
+      }
+
+      Job & job = *jobs_.front();
+      if ( --job.wanted == 0 ) {
+        jobs_.pop_front();
+      }
+      job.running++;
+
+      lock.unlock();
+      job.worker(); /* catches everything itself */
+      lock.lock();
+
+      if ( --job.running == 0 ) {
+        job.finished.notify_all();
+      }
+    }
+  }
+
+public:
+  void run( const unsigned int helpers, const function<void()> & worker )
+  {
+    Job job { worker, helpers };
+
+    {
+      lock_guard<mutex> guard { lock_ };
+      while ( threads_.size() < helpers ) {
+        threads_.emplace_back( [this] { work(); } );
+      }
+      jobs_.push_back( &job );
+    }
+    if ( helpers == 1 ) {
+      work_available_.notify_one();
+    } else {
+      work_available_.notify_all();
+    }
+
+    worker();
+
+    /* no more helpers once the caller is done, then wait for those in it */
+    unique_lock<mutex> lock { lock_ };
+    if ( job.wanted ) {
+      for ( auto it = jobs_.begin(); it != jobs_.end(); it++ ) {
+        if ( *it == &job ) {
+          jobs_.erase( it );
+          break;
+        }
+      }
+    }
+    job.finished.wait( lock, [&] { return job.running == 0; } );
+  }
+
+  ~Helpers()
+  {
+    {
+      lock_guard<mutex> guard { lock_ };
+      stopping_ = true;
+    }
+    work_available_.notify_all();
+    for ( auto & thread : threads_ ) {
+      thread.join();
+    }
+  }
+};
+
+}
+
+void run_on_helpers( const unsigned int helpers, const function<void()> & worker )
+{
+  static Helpers pool;
+  pool.run( helpers, worker );
+}
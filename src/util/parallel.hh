@@ -0,0 +1,59 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+/* run procedure( i ) for every i in [0, count) on up to `threads` threads
+   (including the caller); rethrows the first exception thrown by any call
+
+   The helpers come from a process-wide set of parked threads, started
+   the first time they are needed and reused after that, so a call per
+   frame costs a wakeup rather than a thread creation. The caller works
+   through the indices too, and waits only for helpers that actually
+   joined in, so a call never waits for a helper that is busy elsewhere
+   (e.g. in another parallel_for) and nesting cannot deadlock. */
+
+/* run worker() on the caller and on up to `helpers` parked threads, and
+   return once every one of those runs has returned */
+void run_on_helpers( const unsigned int helpers, const std::function<void()> & worker );
+
+template <typename Procedure>
+void parallel_for( const size_t count, const unsigned int threads, Procedure && procedure )
+{
+  std::atomic<size_t> next { 0 };
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto worker = [&]() {
+    try {
+      for ( size_t i = next++; i < count; i = next++ ) {
+        procedure( i );
+      }
+    } catch ( ... ) {
+      std::lock_guard<std::mutex> lock { error_mutex };
+      if ( not error ) {
+        error = std::current_exception();
+      }
+      next = count;
+    }
+  };
+
+  const size_t helper_count = count ? std::min<size_t>( std::max( threads, 1u ), count ) - 1 : 0;
+  if ( helper_count ) {
+    run_on_helpers( helper_count, worker );
+  } else {
+    worker();
+  }
+
+  if ( error ) {
+    std::rethrow_exception( error );
+  }
+}
+
+#endif /* PARALLEL_HH */
@@ -0,0 +1,282 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "signalfd.hh"
+#include "stats.hh"
+
+using namespace std;
+using namespace Stats;
+
+namespace {
+
+const unsigned int max_probes = 64;
+
+/* log-linear buckets: each power of two is split into 8, so a bucket
+   is at most 12.5% wide */
+const unsigned int sub_bucket_bits = 3;
+const unsigned int sub_buckets = 1 << sub_bucket_bits;
+const unsigned int bucket_count = 64 * sub_buckets;
+
+unsigned int bucket_of( const uint64_t value )
+{
+  if ( value < sub_buckets ) {
+    return value;
+  }
+
+  const unsigned int shift = 63 - __builtin_clzll( value ) - sub_bucket_bits;
+  return ( ( shift + 1 ) << sub_bucket_bits ) + ( ( value >> shift ) & ( sub_buckets - 1 ) );
+}
+
+/* largest value that falls in a bucket */
+uint64_t bucket_limit( const unsigned int bucket )
+{
+  if ( bucket < sub_buckets ) {
+    return bucket;
+  }
+
+  const unsigned int shift = ( bucket >> sub_bucket_bits ) - 1;
+  const uint64_t mantissa = sub_buckets + ( bucket & ( sub_buckets - 1 ) );
+  return ( ( mantissa + 1 ) << shift ) - 1;
+}
+
+/* written only by its thread; relaxed atomics let dump() read it meanwhile */
+struct Histogram
+{
+  atomic<uint64_t> count { 0 }, total { 0 }, max { 0 };
+  atomic<uint64_t> buckets[ bucket_count ] {};
+
+  static void bump( atomic<uint64_t> & counter, const uint64_t amount )
+  {
+    counter.store( counter.load( memory_order_relaxed ) + amount, memory_order_relaxed );
+  }
+
+  void add( const uint64_t value )
+  {
+    bump( count, 1 );
+    bump( total, value );
+    bump( buckets[ bucket_of( value ) ], 1 );
+    if ( value > max.load( memory_order_relaxed ) ) {
+      max.store( value, memory_order_relaxed );
+    }
+  }
+};
+
+struct ThreadStats
+{
+  /* allocated on a probe's first use in this thread */
+  atomic<Histogram *> histograms[ max_probes ] {};
+
+  ThreadStats() {}
+
+  ~ThreadStats()
+  {
+    for ( auto & histogram : histograms ) {
+      delete histogram.load();
+    }
+  }
+
+  ThreadStats( const ThreadStats & other ) = delete;
+  ThreadStats & operator=( const ThreadStats & other ) = delete;
+};
+
+/* outlives the threads, so exited threads still show up in the totals */
+struct Registry
+{
+  mutex lock {};
+  vector<const Probe *> probes {};
+  vector<shared_ptr<ThreadStats>> threads {};
+};
+
+Registry & registry()
+{
+  static Registry the_registry;
+  return the_registry;
+}
+
+ThreadStats & this_thread_stats()
+{
+  thread_local shared_ptr<ThreadStats> stats = [] {
+    auto ret = make_shared<ThreadStats>();
+    lock_guard<mutex> guard { registry().lock };
+    registry().threads.push_back( ret );
+    return ret;
+  }();
+
+  return *stats;
+}
+
+string format_value( const double value, const Unit unit )
+{
+  ostringstream out;
+  out << fixed << setprecision( 1 );
+
+  if ( unit == Unit::Bytes ) {
+    out << value << "B";
+  } else if ( unit == Unit::Count ) {
+    out << value;
+  } else if ( value >= 1e6 ) {
+    out << value / 1e6 << "ms";
+  } else if ( value >= 1e3 ) {
+    out << value / 1e3 << "us";
+  } else {
+    out << value << "ns";
+  }
+
+  return out.str();
+}
+
+}
+
+atomic<bool> Stats::enabled_flag { false };
+
+Probe::Probe( const string & name, const Unit unit )
+  : name_( name ), unit_( unit ), id_()
+{
+  lock_guard<mutex> guard { registry().lock };
+
+  if ( registry().probes.size() >= max_probes ) {
+    throw runtime_error( "too many stats probes" );
+  }
+
+  id_ = registry().probes.size();
+  registry().probes.push_back( this );
+}
+
+void Stats::enable()
+{
+  enabled_flag.store( true, memory_order_relaxed );
+}
+
+void Stats::record( const Probe & probe, const uint64_t value )
+{
+  atomic<Histogram *> & slot = this_thread_stats().histograms[ probe.id() ];
+
+  Histogram * histogram = slot.load( memory_order_acquire );
+  if ( not histogram ) {
+    histogram = new Histogram;
+    slot.store( histogram, memory_order_release );
+  }
+
+  histogram->add( value );
+}
+
+void Stats::dump( ostream & out )
+{
+  ostringstream report;
+
+  {
+    lock_guard<mutex> guard { registry().lock };
+
+    for ( const Probe * probe : registry().probes ) {
+      uint64_t count = 0, total = 0, max = 0;
+      vector<uint64_t> buckets( bucket_count );
+
+      for ( const auto & thread : registry().threads ) {
+        const Histogram * histogram = thread->histograms[ probe->id() ].load( memory_order_acquire );
+        if ( not histogram ) {
+          continue;
+        }
+
+        count += histogram->count.load( memory_order_relaxed );
+        total += histogram->total.load( memory_order_relaxed );
+        max = std::max( max, histogram->max.load( memory_order_relaxed ) );
+        for ( unsigned int i = 0; i < bucket_count; i++ ) {
+          buckets[ i ] += histogram->buckets[ i ].load( memory_order_relaxed );
+        }
+      }
+
+      if ( count == 0 ) {
+        continue;
+      }
+
+      /* percentiles are reported as the upper edge of their bucket */
+      auto percentile = [&]( const double p ) {
+        const uint64_t rank = p / 100 * ( count - 1 );
+        uint64_t seen = 0;
+        for ( unsigned int i = 0; i < bucket_count; i++ ) {
+          seen += buckets[ i ];
+          if ( seen > rank ) {
+            return std::min( bucket_limit( i ), max );
+          }
+        }
+        return max;
+      };
+
+      const Unit unit = probe->unit();
+      report << "# stats " << probe->name()
+             << " count=" << count
+             << " total=" << format_value( total, unit )
+             << " mean=" << format_value( double( total ) / count, unit )
+             << " p50=" << format_value( percentile( 50 ), unit )
+             << " p90=" << format_value( percentile( 90 ), unit )
+             << " p99=" << format_value( percentile( 99 ), unit )
+             << " max=" << format_value( max, unit ) << "\n";
+    }
+  }
+
+  out << report.str() << flush;
+}
+
+StatsReporter::StatsReporter()
+  : wakeup_( SystemCall( "eventfd", eventfd( 0, EFD_CLOEXEC ) ) )
+{
+  if ( getenv( "CAPTAIN_EO_STATS" ) ) {
+    Stats::enable();
+  }
+
+  /* take SIGUSR1 even with the stats off, so that asking a long run for
+     a dump never kills it; add it to the mask rather than replacing it */
+  const SignalMask signals { SIGUSR1 };
+  SystemCall( "sigprocmask", sigprocmask( SIG_BLOCK, &signals.mask(), nullptr ) );
+
+  thread_ = thread( [this, signal_fd = SignalFD( signals )]() mutable {
+      pollfd fds[ 2 ] = { { signal_fd.fd().fd_num(), POLLIN, 0 },
+                          { wakeup_.fd_num(), POLLIN, 0 } };
+
+      while ( true ) {
+        /* a signal that lands on this thread must not end the process */
+        if ( poll( fds, 2, -1 ) < 0 ) {
+          if ( errno == EINTR ) {
+            continue;
+          }
+          throw unix_error( "poll" );
+        }
+
+        if ( fds[ 1 ].revents ) {
+          return;
+        }
+
+        if ( fds[ 0 ].revents ) {
+          signal_fd.read_signal();
+          if ( Stats::enabled() ) {
+            Stats::dump( cerr );
+          } else {
+            cerr << "# stats disabled (set CAPTAIN_EO_STATS to collect them)\n" << flush;
+          }
+        }
+      }
+    } );
+}
+
+StatsReporter::~StatsReporter()
+{
+  const uint64_t one = 1;
+  SystemCall( "write", ::write( wakeup_.fd_num(), &one, sizeof( one ) ) );
+  thread_.join();
+
+  if ( Stats::enabled() ) {
+    Stats::dump( cerr );
+  }
+}
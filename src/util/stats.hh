@@ -0,0 +1,125 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef STATS_HH
+#define STATS_HH
+
+/* hot-path instrumentation
+
+   A Probe names something worth measuring. ScopedTimer records how long
+   a scope took (CLOCK_MONOTONIC_RAW) into the calling thread's histogram
+   for that probe; Stats::record() adds a plain value, like a byte count.
+   Threads never share histograms, so recording takes no locks.
+
+   Recording is off until Stats::enable() is called (StatsReporter does so
+   when CAPTAIN_EO_STATS is set in the environment); while off, a timer
+   costs one relaxed load and a branch. Configuring with
+   --disable-instrumentation compiles the timers out entirely. */
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include <time.h>
+
+#include "config.h"
+#include "file_descriptor.hh"
+
+namespace Stats {
+
+enum class Unit { Nanoseconds, Bytes, Count };
+
+class Probe
+{
+private:
+  std::string name_;
+  Unit unit_;
+  unsigned int id_;
+
+public:
+  Probe( const std::string & name, const Unit unit = Unit::Nanoseconds );
+
+  const std::string & name() const { return name_; }
+  Unit unit() const { return unit_; }
+  unsigned int id() const { return id_; }
+
+  /* probes are registered by address */
+  Probe( const Probe & other ) = delete;
+  Probe & operator=( const Probe & other ) = delete;
+};
+
+extern std::atomic<bool> enabled_flag;
+
+inline bool enabled() { return enabled_flag.load( std::memory_order_relaxed ); }
+void enable();
+
+/* add a value to the calling thread's histogram for a probe */
+void record( const Probe & probe, const uint64_t value );
+
+/* merge every thread's histograms and print one line per probe */
+void dump( std::ostream & out );
+
+inline uint64_t now_ns()
+{
+  timespec ts;
+  clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+  return uint64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef ENABLE_INSTRUMENTATION
+
+class ScopedTimer
+{
+private:
+  const Probe & probe_;
+  uint64_t start_;
+
+public:
+  ScopedTimer( const Probe & probe )
+    : probe_( probe ), start_( enabled() ? now_ns() : 0 )
+  {}
+
+  ~ScopedTimer()
+  {
+    if ( start_ ) {
+      record( probe_, now_ns() - start_ );
+    }
+  }
+
+  ScopedTimer( const ScopedTimer & other ) = delete;
+  ScopedTimer & operator=( const ScopedTimer & other ) = delete;
+};
+
+#else
+
+class ScopedTimer
+{
+public:
+  ScopedTimer( const Probe & ) {}
+};
+
+#endif
+
+}
+
+/* enables the stats if CAPTAIN_EO_STATS is set, then dumps them to
+   stderr whenever SIGUSR1 arrives and once more when destroyed; with
+   the stats off, SIGUSR1 just gets a note saying so. Create
+   it first thing in main(), before any other thread starts, so that
+   every thread inherits the blocked SIGUSR1 */
+class StatsReporter
+{
+private:
+  FileDescriptor wakeup_;
+  std::thread thread_ {};
+
+public:
+  StatsReporter();
+  ~StatsReporter();
+
+  StatsReporter( const StatsReporter & other ) = delete;
+  StatsReporter & operator=( const StatsReporter & other ) = delete;
+};
+
+#endif /* STATS_HH */
@@ -0,0 +1,133 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <stdexcept>
+
+#include "thread_pool.hh"
+
+using namespace std;
+
+/* the pool and queue the calling thread works for, if any */
+static thread_local const ThreadPool * current_pool = nullptr;
+static thread_local size_t current_queue = 0;
+
+ThreadPool::ThreadPool( const unsigned int threads )
+{
+  if ( threads == 0 ) {
+    throw runtime_error( "ThreadPool: need at least one thread" );
+  }
+
+  for ( unsigned int i = 0; i < threads; i++ ) {
+    queues_.push_back( make_unique<Queue>() );
+  }
+
+  for ( unsigned int i = 0; i < threads; i++ ) {
+    threads_.emplace_back( [this, i] { work( i ); } );
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    lock_guard<mutex> guard { state_lock_ };
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+
+  for ( auto & thread : threads_ ) {
+    thread.join();
+  }
+}
+
+void ThreadPool::submit( Task && task )
+{
+  const size_t queue = current_pool == this ? current_queue : next_queue_++ % queues_.size();
+
+  /* count the task before any worker can see it, or one could run and
+     uncount it first, letting wait() return while its parent still runs */
+  {
+    lock_guard<mutex> guard { state_lock_ };
+    pending_++;
+    queued_++;
+  }
+
+  {
+    lock_guard<mutex> guard { queues_[ queue ]->lock };
+    queues_[ queue ]->tasks.push_back( move( task ) );
+  }
+  work_available_.notify_one();
+}
+
+bool ThreadPool::take( const size_t self, Task & task )
+{
+  /* newest first from our own queue, for locality */
+  {
+    Queue & own = *queues_[ self ];
+    lock_guard<mutex> guard { own.lock };
+    if ( not own.tasks.empty() ) {
+      task = move( own.tasks.back() );
+      own.tasks.pop_back();
+      queued_--;
+      return true;
+    }
+  }
+
+  /* oldest first from everyone else's */
+  for ( size_t i = 1; i < queues_.size(); i++ ) {
+    Queue & victim = *queues_[ ( self + i ) % queues_.size() ];
+    lock_guard<mutex> guard { victim.lock };
+    if ( not victim.tasks.empty() ) {
+      task = move( victim.tasks.front() );
+      victim.tasks.pop_front();
+      queued_--;
+      steals_++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ThreadPool::work( const size_t self )
+{
+  current_pool = this;
+  current_queue = self;
+
+  while ( true ) {
+    Task task;
+
+    if ( not take( self, task ) ) {
+      unique_lock<mutex> lock { state_lock_ };
+      work_available_.wait( lock, [&] { return stopping_ or queued_ > 0; } );
+      if ( stopping_ and queued_ == 0 ) {
+        return;
+      }
+      continue;
+    }
+
+    try {
+      task();
+    } catch ( ... ) {
+      lock_guard<mutex> guard { state_lock_ };
+      if ( not error_ ) {
+        error_ = current_exception();
+      }
+    }
+
+    lock_guard<mutex> guard { state_lock_ };
+    if ( --pending_ == 0 ) {
+      all_done_.notify_all();
+    }
+  }
+}
+
+void ThreadPool::wait()
+{
+  unique_lock<mutex> lock { state_lock_ };
+  all_done_.wait( lock, [&] { return pending_ == 0; } );
+
+  if ( error_ ) {
+    exception_ptr error = error_;
+    error_ = nullptr;
+    rethrow_exception( error );
+  }
+}
@@ -0,0 +1,70 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+/* a fixed set of worker threads with one task queue each
+
+   A worker takes the newest task from its own queue and, when that is
+   empty, steals the oldest task from another worker. Tasks submitted
+   from outside the pool are dealt round-robin; tasks submitted by a
+   worker go on that worker's own queue. */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  typedef std::function<void()> Task;
+
+private:
+  struct Queue
+  {
+    std::mutex lock {};
+    std::deque<Task> tasks {};
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues_ {};
+  std::vector<std::thread> threads_ {};
+
+  std::mutex state_lock_ {};
+  std::condition_variable work_available_ {};
+  std::condition_variable all_done_ {};
+  std::atomic<size_t> queued_ { 0 };
+  size_t pending_ { 0 };
+  bool stopping_ { false };
+  std::exception_ptr error_ {};
+
+  std::atomic<size_t> next_queue_ { 0 };
+  std::atomic<uint64_t> steals_ { 0 };
+
+  bool take( const size_t self, Task & task );
+  void work( const size_t self );
+
+public:
+  ThreadPool( const unsigned int threads );
+  ~ThreadPool();
+
+  void submit( Task && task );
+
+  /* block until every submitted task has run, then rethrow the first
+     exception any of them threw */
+  void wait();
+
+  size_t size() const { return threads_.size(); }
+  uint64_t steals() const { return steals_; }
+
+  /* Disallow copying */
+  ThreadPool( const ThreadPool & other ) = delete;
+  ThreadPool & operator=( const ThreadPool & other ) = delete;
+};
+
+#endif /* THREAD_POOL_HH */
@@ -0,0 +1,463 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "config.h"
+
+#include <cstring>
+#include <endian.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "tiled_video.hh"
+#include "parallel.hh"
+#include "exception.hh"
+
+using namespace std;
+
+static const string file_magic = "CEOTILE1";
+static const string index_magic = "CEOINDEX";
+static const uint32_t frame_magic = 0x4D415246; /* "FRAM" */
+static const size_t header_length = 32;
+static const unsigned int bgrx_pixel_length = 4;
+
+static void put_le32( string & str, const uint32_t value )
+{
+  const uint32_t le = htole32( value );
+  str.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+}
+
+static void put_le64( string & str, const uint64_t value )
+{
+  const uint64_t le = htole64( value );
+  str.append( reinterpret_cast<const char *>( &le ), sizeof( le ) );
+}
+
+TileCodec parse_tile_codec( const string & name )
+{
+  if ( name == "none" ) { return TileCodec::None; }
+  if ( name == "lz4" ) { return TileCodec::LZ4; }
+  if ( name == "zstd" ) { return TileCodec::Zstd; }
+
+  throw runtime_error( "unknown tile codec: " + name );
+}
+
+string tile_codec_name( const TileCodec codec )
+{
+  switch ( codec ) {
+  case TileCodec::None: return "none";
+  case TileCodec::LZ4: return "lz4";
+  case TileCodec::Zstd: return "zstd";
+  }
+
+  throw Invalid( "unknown tile codec " + to_string( static_cast<uint32_t>( codec ) ) );
+}
+
+bool tile_codec_available( const TileCodec codec )
+{
+  switch ( codec ) {
+  case TileCodec::None: return true;
+#ifdef HAVE_LZ4
+  case TileCodec::LZ4: return true;
+#endif
+#ifdef HAVE_ZSTD
+  case TileCodec::Zstd: return true;
+#endif
+  default: return false;
+  }
+}
+
+/* compress src into dst; returns false if the codec could not make it smaller */
+static bool compress( const TileCodec codec, [[maybe_unused]] const int level,
+                      [[maybe_unused]] const vector<uint8_t> & src,
+                      [[maybe_unused]] vector<uint8_t> & dst )
+{
+  switch ( codec ) {
+  case TileCodec::None:
+    return false;
+
+  case TileCodec::LZ4:
+#ifdef HAVE_LZ4
+    {
+      dst.resize( LZ4_compressBound( src.size() ) );
+      const int size = LZ4_compress_default( reinterpret_cast<const char *>( src.data() ),
+                                             reinterpret_cast<char *>( dst.data() ),
+                                             src.size(), dst.size() );
+      if ( size <= 0 ) {
+        throw internal_error( "LZ4_compress_default", "failed" );
+      }
+      dst.resize( size );
+      return dst.size() < src.size();
+    }
+#else
+    break;
+#endif
+
+  case TileCodec::Zstd:
+#ifdef HAVE_ZSTD
+    {
+      dst.resize( ZSTD_compressBound( src.size() ) );
+      const size_t size = ZSTD_compress( dst.data(), dst.size(), src.data(), src.size(), level );
+      if ( ZSTD_isError( size ) ) {
+        throw internal_error( "ZSTD_compress", ZSTD_getErrorName( size ) );
+      }
+      dst.resize( size );
+      return dst.size() < src.size();
+    }
+#else
+    break;
+#endif
+  }
+
+  throw runtime_error( "tile codec not available in this build: " + tile_codec_name( codec ) );
+}
+
+static void decompress( const TileCodec codec,
+                        [[maybe_unused]] const Chunk & src,
+                        [[maybe_unused]] vector<uint8_t> & dst )
+{
+  switch ( codec ) {
+  case TileCodec::None:
+    break;
+
+  case TileCodec::LZ4:
+#ifdef HAVE_LZ4
+    {
+      const int size = LZ4_decompress_safe( reinterpret_cast<const char *>( src.buffer() ),
+                                            reinterpret_cast<char *>( dst.data() ),
+                                            src.size(), dst.size() );
+      if ( size < 0 or static_cast<size_t>( size ) != dst.size() ) {
+        throw Invalid( "corrupt LZ4 tile" );
+      }
+      return;
+    }
+#else
+    break;
+#endif
+
+  case TileCodec::Zstd:
+#ifdef HAVE_ZSTD
+    {
+      const size_t size = ZSTD_decompress( dst.data(), dst.size(), src.buffer(), src.size() );
+      if ( ZSTD_isError( size ) or size != dst.size() ) {
+        throw Invalid( "corrupt zstd tile" );
+      }
+      return;
+    }
+#else
+    break;
+#endif
+  }
+
+  throw runtime_error( "tile codec not available in this build: " + tile_codec_name( codec ) );
+}
+
+TileLayout::TileLayout( const unsigned int width, const unsigned int height,
+                        const unsigned int tile_width, const unsigned int tile_height )
+  : width_( width ), height_( height ),
+    tile_width_( tile_width ), tile_height_( tile_height ),
+    tiles_x_(), tiles_y_()
+{
+  if ( width == 0 or height == 0 or tile_width == 0 or tile_height == 0 ) {
+    throw runtime_error( "TileLayout: dimensions must be nonzero" );
+  }
+
+  tiles_x_ = ( width + tile_width - 1 ) / tile_width;
+  tiles_y_ = ( height + tile_height - 1 ) / tile_height;
+}
+
+unsigned int TileLayout::tile_columns( const unsigned int tile ) const
+{
+  return min( tile_width_, width_ - tile_x( tile ) );
+}
+
+unsigned int TileLayout::tile_rows( const unsigned int tile ) const
+{
+  return min( tile_height_, height_ - tile_y( tile ) );
+}
+
+vector<unsigned int> TileLayout::tiles_covering( const unsigned int x, const unsigned int y,
+                                                 const unsigned int width, const unsigned int height ) const
+{
+  vector<unsigned int> tiles;
+
+  if ( width == 0 or height == 0 or x >= width_ or y >= height_ ) {
+    return tiles;
+  }
+
+  const unsigned int last_x = min( x + width, width_ ) - 1;
+  const unsigned int last_y = min( y + height, height_ ) - 1;
+
+  for ( unsigned int ty = y / tile_height_; ty <= last_y / tile_height_; ty++ ) {
+    for ( unsigned int tx = x / tile_width_; tx <= last_x / tile_width_; tx++ ) {
+      tiles.push_back( ty * tiles_x_ + tx );
+    }
+  }
+
+  return tiles;
+}
+
+TiledVideoWriter::TiledVideoWriter( FileDescriptor && fd, const TileLayout & layout,
+                                    const TileCodec codec, const int level, const unsigned int threads )
+  : fd_( move( fd ) ),
+    layout_( layout ),
+    codec_( codec ),
+    level_( level ),
+    threads_( threads )
+{
+  if ( not tile_codec_available( codec_ ) ) {
+    throw runtime_error( "tile codec not available in this build: " + tile_codec_name( codec_ ) );
+  }
+
+  string header = file_magic;
+  put_le32( header, layout_.width() );
+  put_le32( header, layout_.height() );
+  put_le32( header, layout_.tile_width() );
+  put_le32( header, layout_.tile_height() );
+  put_le32( header, bgrx_pixel_length );
+  put_le32( header, static_cast<uint32_t>( codec_ ) );
+  write( header );
+}
+
+void TiledVideoWriter::write( const string & str )
+{
+  fd_.write( str );
+  bytes_written_ += str.size();
+}
+
+void TiledVideoWriter::write( const Chunk & chunk )
+{
+  if ( chunk.size() ) {
+    fd_.write( chunk );
+    bytes_written_ += chunk.size();
+  }
+}
+
+void TiledVideoWriter::write_frame( const Chunk & frame )
+{
+  if ( finished_ ) {
+    throw runtime_error( "TiledVideoWriter: write_frame() after finish()" );
+  }
+
+  const size_t row_length = size_t( layout_.width() ) * bgrx_pixel_length;
+  if ( frame.size() != row_length * layout_.height() ) {
+    throw runtime_error( "TiledVideoWriter: invalid frame size" );
+  }
+
+  const unsigned int tile_count = layout_.tile_count();
+  vector<vector<uint8_t>> raw( tile_count ), compressed( tile_count );
+  vector<TileCodec> codecs( tile_count, codec_ );
+
+  parallel_for( tile_count, threads_, [&]( const size_t tile ) {
+      const size_t tile_row_length = size_t( layout_.tile_columns( tile ) ) * bgrx_pixel_length;
+      const unsigned int rows = layout_.tile_rows( tile );
+
+      raw[ tile ].resize( tile_row_length * rows );
+      for ( unsigned int row = 0; row < rows; row++ ) {
+        memcpy( raw[ tile ].data() + row * tile_row_length,
+                frame.buffer() + ( layout_.tile_y( tile ) + row ) * row_length
+                + size_t( layout_.tile_x( tile ) ) * bgrx_pixel_length,
+                tile_row_length );
+      }
+
+      if ( not compress( codec_, level_, raw[ tile ], compressed[ tile ] ) ) {
+        codecs[ tile ] = TileCodec::None;
+      }
+    } );
+
+  frame_offsets_.push_back( bytes_written_ );
+
+  string frame_header;
+  put_le32( frame_header, frame_magic );
+  put_le32( frame_header, tile_count );
+  for ( unsigned int tile = 0; tile < tile_count; tile++ ) {
+    const auto & payload = codecs[ tile ] == TileCodec::None ? raw[ tile ] : compressed[ tile ];
+    put_le32( frame_header, static_cast<uint32_t>( codecs[ tile ] ) );
+    put_le32( frame_header, payload.size() );
+  }
+  write( frame_header );
+
+  for ( unsigned int tile = 0; tile < tile_count; tile++ ) {
+    write( Chunk( codecs[ tile ] == TileCodec::None ? raw[ tile ] : compressed[ tile ] ) );
+  }
+}
+
+void TiledVideoWriter::finish()
+{
+  if ( finished_ ) {
+    return;
+  }
+
+  string index;
+  for ( const uint64_t offset : frame_offsets_ ) {
+    put_le64( index, offset );
+  }
+  put_le64( index, frame_offsets_.size() );
+  index.append( index_magic );
+  write( index );
+
+  finished_ = true;
+}
+
+TiledVideoWriter::~TiledVideoWriter()
+{
+  try {
+    finish();
+  } catch ( const exception & e ) {
+    print_exception( "TiledVideoWriter", e );
+  }
+}
+
+bool TiledVideoReader::is_tiled_video( const Chunk & prefix )
+{
+  return prefix.size() >= file_magic.size()
+    and prefix( 0, file_magic.size() ).to_string() == file_magic;
+}
+
+static TileLayout parse_layout( const File & file )
+{
+  if ( file.size() < header_length or not TiledVideoReader::is_tiled_video( file( 0, header_length ) ) ) {
+    throw Invalid( "not a tiled video" );
+  }
+
+  const Chunk header = file( file_magic.size(), header_length - file_magic.size() );
+  return TileLayout( header( 0, 4 ).le32(), header( 4, 4 ).le32(),
+                     header( 8, 4 ).le32(), header( 12, 4 ).le32() );
+}
+
+TiledVideoReader::TiledVideoReader( const string & filename )
+  : file_( filename ),
+    layout_( parse_layout( file_ ) ),
+    bytes_per_pixel_( file_( file_magic.size() + 16, 4 ).le32() )
+{
+  if ( bytes_per_pixel_ != bgrx_pixel_length ) {
+    throw Unsupported( "tiled video with " + to_string( bytes_per_pixel_ ) + " bytes per pixel" );
+  }
+
+  find_frames();
+}
+
+void TiledVideoReader::find_frames()
+{
+  const uint64_t trailer_length = sizeof( uint64_t ) + index_magic.size();
+
+  /* use the index if the writer got to finish */
+  if ( file_.size() >= header_length + trailer_length
+       and file_( file_.size() - index_magic.size(), index_magic.size() ).to_string() == index_magic ) {
+    const uint64_t count = file_( file_.size() - trailer_length, sizeof( uint64_t ) ).le64();
+    /* compared before multiplying, so that a corrupt count can't wrap */
+    if ( count > ( file_.size() - header_length - trailer_length ) / sizeof( uint64_t ) ) {
+      throw Invalid( "tiled video index is too long" );
+    }
+    const uint64_t index_length = count * sizeof( uint64_t );
+
+    const Chunk index = file_( file_.size() - trailer_length - index_length, index_length );
+    for ( uint64_t i = 0; i < count; i++ ) {
+      frame_offsets_.push_back( index( i * sizeof( uint64_t ), sizeof( uint64_t ) ).le64() );
+    }
+    return;
+  }
+
+  /* otherwise, walk the frames and stop at the first incomplete one */
+  const uint64_t tile_count = layout_.tile_count();
+  const uint64_t frame_header_length = 8 + 8 * tile_count;
+  uint64_t offset = header_length;
+
+  while ( offset + frame_header_length <= file_.size() ) {
+    const Chunk frame_header = file_( offset, frame_header_length );
+    if ( frame_header( 0, 4 ).le32() != frame_magic or frame_header( 4, 4 ).le32() != tile_count ) {
+      break;
+    }
+
+    uint64_t frame_length = frame_header_length;
+    for ( uint64_t tile = 0; tile < tile_count; tile++ ) {
+      frame_length += frame_header( 12 + 8 * tile, 4 ).le32();
+    }
+
+    if ( offset + frame_length > file_.size() ) {
+      break;
+    }
+
+    frame_offsets_.push_back( offset );
+    offset += frame_length;
+  }
+}
+
+void TiledVideoReader::decode_tile( const Chunk & frame, const vector<uint64_t> & payload_offsets,
+                                    const unsigned int tile, uint8_t * output, vector<uint8_t> & scratch ) const
+{
+  if ( tile >= layout_.tile_count() ) {
+    throw out_of_range( "tile index out of range" );
+  }
+
+  const TileCodec codec = static_cast<TileCodec>( frame( 8 + 8 * tile, 4 ).le32() );
+  const Chunk payload = frame( payload_offsets[ tile ], payload_offsets[ tile + 1 ] - payload_offsets[ tile ] );
+
+  const size_t row_length = size_t( layout_.width() ) * bytes_per_pixel_;
+  const size_t tile_row_length = size_t( layout_.tile_columns( tile ) ) * bytes_per_pixel_;
+  const unsigned int rows = layout_.tile_rows( tile );
+
+  const uint8_t * rows_in = payload.buffer();
+  if ( codec != TileCodec::None ) {
+    scratch.resize( tile_row_length * rows );
+    decompress( codec, payload, scratch );
+    rows_in = scratch.data();
+  } else if ( payload.size() != tile_row_length * rows ) {
+    throw Invalid( "uncompressed tile has wrong size" );
+  }
+
+  uint8_t * rows_out = output + layout_.tile_y( tile ) * row_length
+    + size_t( layout_.tile_x( tile ) ) * bytes_per_pixel_;
+  for ( unsigned int row = 0; row < rows; row++ ) {
+    memcpy( rows_out + row * row_length, rows_in + row * tile_row_length, tile_row_length );
+  }
+}
+
+void TiledVideoReader::decode_tiles( const uint64_t frame_no, const vector<unsigned int> & tiles,
+                                     uint8_t * output, const unsigned int threads ) const
+{
+  if ( frame_no >= frame_offsets_.size() ) {
+    throw out_of_range( "tiled video frame out of range" );
+  }
+
+  const Chunk frame = file_.chunk()( frame_offsets_.at( frame_no ) );
+  const uint32_t tile_count = layout_.tile_count();
+
+  if ( frame( 0, 4 ).le32() != frame_magic or frame( 4, 4 ).le32() != tile_count ) {
+    throw Invalid( "bad tiled video frame header" );
+  }
+
+  /* payloads follow the frame header back to back */
+  vector<uint64_t> payload_offsets( tile_count + 1 );
+  payload_offsets[ 0 ] = 8 + 8 * uint64_t( tile_count );
+  for ( unsigned int tile = 0; tile < tile_count; tile++ ) {
+    payload_offsets[ tile + 1 ] = payload_offsets[ tile ] + frame( 12 + 8 * tile, 4 ).le32();
+  }
+
+  if ( threads <= 1 or tiles.size() <= 1 ) {
+    vector<uint8_t> scratch;
+    for ( const unsigned int tile : tiles ) {
+      decode_tile( frame, payload_offsets, tile, output, scratch );
+    }
+    return;
+  }
+
+  parallel_for( tiles.size(), threads, [&]( const size_t i ) {
+      thread_local vector<uint8_t> scratch;
+      decode_tile( frame, payload_offsets, tiles[ i ], output, scratch );
+    } );
+}
+
+void TiledVideoReader::decode_frame( const uint64_t frame_no, uint8_t * output, const unsigned int threads ) const
+{
+  vector<unsigned int> all_tiles( layout_.tile_count() );
+  for ( unsigned int i = 0; i < all_tiles.size(); i++ ) {
+    all_tiles[ i ] = i;
+  }
+
+  decode_tiles( frame_no, all_tiles, output, threads );
+}
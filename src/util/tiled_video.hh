@@ -0,0 +1,128 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef TILED_VIDEO_HH
+#define TILED_VIDEO_HH
+
+/* raw BGRX video stored as independently compressed tiles
+
+   file:  header | frame 0 | frame 1 | ... | index
+   header: "CEOTILE1", then le32 width, height, tile width, tile height,
+           bytes per pixel, default codec
+   frame: le32 "FRAM", le32 tile count, then le32 codec and le32 size
+          for each tile (row-major), then the tile payloads in order
+   index: le64 offset of each frame, le64 frame count, "CEOINDEX"
+
+   A tile's payload holds its rows back to back. The index is written
+   last, so a file whose writer was interrupted is still readable by
+   scanning its frames from the start. */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chunk.hh"
+#include "file.hh"
+#include "file_descriptor.hh"
+
+enum class TileCodec : uint32_t { None = 0, LZ4 = 1, Zstd = 2 };
+
+TileCodec parse_tile_codec( const std::string & name );
+std::string tile_codec_name( const TileCodec codec );
+bool tile_codec_available( const TileCodec codec );
+
+/* the tile grid of a frame */
+class TileLayout
+{
+private:
+  unsigned int width_, height_, tile_width_, tile_height_;
+  unsigned int tiles_x_, tiles_y_;
+
+public:
+  TileLayout( const unsigned int width, const unsigned int height,
+              const unsigned int tile_width, const unsigned int tile_height );
+
+  unsigned int width() const { return width_; }
+  unsigned int height() const { return height_; }
+  unsigned int tile_width() const { return tile_width_; }
+  unsigned int tile_height() const { return tile_height_; }
+  unsigned int tile_count() const { return tiles_x_ * tiles_y_; }
+
+  /* position and size of a tile in pixels (edge tiles may be smaller) */
+  unsigned int tile_x( const unsigned int tile ) const { return tile % tiles_x_ * tile_width_; }
+  unsigned int tile_y( const unsigned int tile ) const { return tile / tiles_x_ * tile_height_; }
+  unsigned int tile_columns( const unsigned int tile ) const;
+  unsigned int tile_rows( const unsigned int tile ) const;
+
+  /* tiles overlapping a rectangle */
+  std::vector<unsigned int> tiles_covering( const unsigned int x, const unsigned int y,
+                                            const unsigned int width, const unsigned int height ) const;
+};
+
+class TiledVideoWriter
+{
+private:
+  FileDescriptor fd_;
+  TileLayout layout_;
+  TileCodec codec_;
+  int level_;
+  unsigned int threads_;
+
+  uint64_t bytes_written_ { 0 };
+  std::vector<uint64_t> frame_offsets_ {};
+  bool finished_ { false };
+
+  void write( const std::string & str );
+  void write( const Chunk & chunk );
+
+public:
+  TiledVideoWriter( FileDescriptor && fd, const TileLayout & layout,
+                    const TileCodec codec, const int level = 0, const unsigned int threads = 1 );
+
+  /* compress and append one BGRX frame */
+  void write_frame( const Chunk & frame );
+
+  /* append the frame index */
+  void finish();
+
+  uint64_t frame_count() const { return frame_offsets_.size(); }
+  uint64_t bytes_written() const { return bytes_written_; }
+
+  ~TiledVideoWriter();
+
+  /* Disallow copying */
+  TiledVideoWriter( const TiledVideoWriter & other ) = delete;
+  TiledVideoWriter & operator=( const TiledVideoWriter & other ) = delete;
+};
+
+class TiledVideoReader
+{
+private:
+  File file_;
+  TileLayout layout_;
+  unsigned int bytes_per_pixel_;
+  std::vector<uint64_t> frame_offsets_ {};
+
+  void find_frames();
+  void decode_tile( const Chunk & frame, const std::vector<uint64_t> & payload_offsets,
+                    const unsigned int tile, uint8_t * output, std::vector<uint8_t> & scratch ) const;
+
+public:
+  TiledVideoReader( const std::string & filename );
+
+  /* does this look like the start of a tiled video? */
+  static bool is_tiled_video( const Chunk & prefix );
+
+  const TileLayout & layout() const { return layout_; }
+  uint64_t frame_count() const { return frame_offsets_.size(); }
+  uint64_t frame_length() const { return uint64_t( layout_.width() ) * layout_.height() * bytes_per_pixel_; }
+
+  /* decode some tiles of a frame into a full-size BGRX buffer; the rest
+     of the buffer is left untouched */
+  void decode_tiles( const uint64_t frame_no, const std::vector<unsigned int> & tiles,
+                     uint8_t * output, const unsigned int threads = 1 ) const;
+
+  /* decode a whole frame */
+  void decode_frame( const uint64_t frame_no, uint8_t * output, const unsigned int threads = 1 ) const;
+};
+
+#endif /* TILED_VIDEO_HH */